@@ -0,0 +1,971 @@
+#include "AdvectKernels.h"
+#include <algorithm>
+
+#if defined(SIMD_X86)
+	#include <immintrin.h>
+#endif
+
+namespace AdvectKernels
+{
+	//------------------------------------------------------------------------------
+	static inline void BacktraceCell( const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x, uint y, uint& index, float& s1, float& t1 )
+	{
+		const uint cell = (y * stride) + x;
+
+		float x1 = x - dt0 * u[cell];
+		float y1 = y - dt0 * v[cell];
+
+		x1 = std::min( std::max( x1, 0.5f ), size_x - 1.501f );
+		y1 = std::min( std::max( y1, 0.5f ), size_y - 1.501f );
+
+		const int i0 = (int)x1;
+		const int j0 = (int)y1;
+
+		index	= (j0 * stride) + i0;
+		s1		= x1-i0;
+		t1		= y1-j0;
+	}
+
+	//------------------------------------------------------------------------------
+	static inline float SampleCell( const float* d0, uint index, float s1, float t1, uint stride )
+	{
+		const float s0 = 1-s1;
+		const float t0 = 1-t1;
+
+		const float* src = d0 + index;
+
+		return s0*(t0*src[0]+t1*src[stride])+s1*(t0*src[1]+t1*src[stride+1]);
+	}
+
+	//------------------------------------------------------------------------------
+	void Scalar( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			for( uint x = x_begin; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					d[f][(y * stride) + x] = SampleCell( d0[f], index, s1, t1, stride );
+				}
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > static inline void SampleInterleavedCell( T* dst, const float* d0, uint index, float s1, float t1, float decay, uint stride )
+	{
+		const float s0 = 1-s1;
+		const float t0 = 1-t1;
+
+		const uint row_stride = stride * INTERLEAVED_CHANNELS;
+		const float* src = d0 + (index * INTERLEAVED_CHANNELS);
+
+		for( uint ch = 0; ch < INTERLEAVED_CHANNELS; ++ch )
+		{
+			float value = s0*(t0*src[ch]+t1*src[row_stride+ch])+s1*(t0*src[INTERLEAVED_CHANNELS+ch]+t1*src[row_stride+INTERLEAVED_CHANNELS+ch]);
+
+			value -= decay;
+			if( value < 0.0f )
+			{
+				value = 0.0f;
+			}
+
+			dst[ch] = T( value );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > static void InterleavedScalarT( T* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			for( uint x = x_begin; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				SampleInterleavedCell( d + ((y * stride) + x) * INTERLEAVED_CHANNELS, d0, index, s1, t1, decay, stride );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	void InterleavedScalar( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		InterleavedScalarT( d, d0, u, v, dt0, decay, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	static inline float CorrectValue( float hat, float d0, float back, const float* src, uint stride, uint step )
+	{
+		//src is the departure point's top left source value, step the distance to the next column
+		const float lo = std::min( std::min( src[0], src[step] ), std::min( src[stride], src[stride + step] ) );
+		const float hi = std::max( std::max( src[0], src[step] ), std::max( src[stride], src[stride + step] ) );
+
+		const float value = hat + 0.5f * (d0 - back);
+
+		return std::min( std::max( value, lo ), hi );
+	}
+
+	//------------------------------------------------------------------------------
+	void CorrectScalar( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			for( uint x = x_begin; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				const uint cell = (y * stride) + x;
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					d[f][cell] = CorrectValue( d[f][cell], d0[f][cell], back[f][cell], d0[f] + index, stride, 1 );
+				}
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > static inline void CorrectInterleavedCell( T* dst, const float* hat, const float* d0, const float* back, uint cell, uint index, float decay, uint stride )
+	{
+		const uint row_stride = stride * INTERLEAVED_CHANNELS;
+		const float* src = d0 + (index * INTERLEAVED_CHANNELS);
+		const uint i = cell * INTERLEAVED_CHANNELS;
+
+		for( uint ch = 0; ch < INTERLEAVED_CHANNELS; ++ch )
+		{
+			float value = CorrectValue( hat[i + ch], d0[i + ch], back[i + ch], src + ch, row_stride, INTERLEAVED_CHANNELS );
+
+			value -= decay;
+			if( value < 0.0f )
+			{
+				value = 0.0f;
+			}
+
+			dst[i + ch] = T( value );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > static void InterleavedCorrectScalarT( T* d, const float* hat, const float* d0, const float* back, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			for( uint x = x_begin; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				CorrectInterleavedCell( d, hat, d0, back, (y * stride) + x, index, decay, stride );
+			}
+		}
+	}
+
+#if defined(SIMD_X86)
+	//------------------------------------------------------------------------------
+	struct BacktraceSSE2Constants
+	{
+		__m128	mLane;
+		__m128	mDt0;
+		__m128	mLo;
+		__m128	mHiX;
+		__m128	mHiY;
+	};
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline BacktraceSSE2Constants MakeBacktraceSSE2Constants( float dt0, uint size_x, uint size_y )
+	{
+		BacktraceSSE2Constants c;
+		c.mLane	= _mm_setr_ps( 0.0f, 1.0f, 2.0f, 3.0f );
+		c.mDt0	= _mm_set1_ps( dt0 );
+		c.mLo	= _mm_set1_ps( 0.5f );
+		c.mHiX	= _mm_set1_ps( size_x - 1.501f );
+		c.mHiY	= _mm_set1_ps( size_y - 1.501f );
+		return c;
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128i MulLoSSE2( __m128i a, __m128i b )
+	{
+		//SSE2 only multiplies the even lanes, so do the odd lanes separately and interleave
+		const __m128i even	= _mm_mul_epu32( a, b );
+		const __m128i odd	= _mm_mul_epu32( _mm_srli_si128( a, 4 ), _mm_srli_si128( b, 4 ) );
+
+		return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE( 0, 0, 2, 0 ) ), _mm_shuffle_epi32( odd, _MM_SHUFFLE( 0, 0, 2, 0 ) ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline void BacktraceLanesSSE2( const BacktraceSSE2Constants& c, const float* u, const float* v, uint stride, uint x, uint y, __m128i& index, __m128& s1, __m128& t1 )
+	{
+		const uint cell = (y * stride) + x;
+		const __m128 fx = _mm_add_ps( _mm_set1_ps( (float)x ), c.mLane );
+		const __m128 fy = _mm_set1_ps( (float)y );
+
+		__m128 x1 = _mm_sub_ps( fx, _mm_mul_ps( c.mDt0, _mm_loadu_ps( u + cell ) ) );
+		__m128 y1 = _mm_sub_ps( fy, _mm_mul_ps( c.mDt0, _mm_loadu_ps( v + cell ) ) );
+
+		x1 = _mm_min_ps( _mm_max_ps( x1, c.mLo ), c.mHiX );
+		y1 = _mm_min_ps( _mm_max_ps( y1, c.mLo ), c.mHiY );
+
+		const __m128i i0 = _mm_cvttps_epi32( x1 );
+		const __m128i j0 = _mm_cvttps_epi32( y1 );
+
+		index	= _mm_add_epi32( MulLoSSE2( j0, _mm_set1_epi32( (int)stride ) ), i0 );
+		s1		= _mm_sub_ps( x1, _mm_cvtepi32_ps( i0 ) );
+		t1		= _mm_sub_ps( y1, _mm_cvtepi32_ps( j0 ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 LoadPairsSSE2( const float* src, uint a, uint b )
+	{
+		//(src[a], src[a+1], src[b], src[b+1])
+		return _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), (const __m64*)(src + a) ), (const __m64*)(src + b) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline void GatherCornersSSE2( const float* d0, __m128i index, uint stride, __m128& d00, __m128& d10, __m128& d01, __m128& d11 )
+	{
+		//SSE2 has no gather, so load each (i0, i0+1) pair from both source rows with one 64 bit load
+		uint ii[4];
+		_mm_storeu_si128( (__m128i*)ii, index );
+
+		const __m128 top01 = LoadPairsSSE2( d0, ii[0], ii[1] );
+		const __m128 top23 = LoadPairsSSE2( d0, ii[2], ii[3] );
+		const __m128 bot01 = LoadPairsSSE2( d0 + stride, ii[0], ii[1] );
+		const __m128 bot23 = LoadPairsSSE2( d0 + stride, ii[2], ii[3] );
+
+		d00 = _mm_shuffle_ps( top01, top23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+		d10 = _mm_shuffle_ps( top01, top23, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+		d01 = _mm_shuffle_ps( bot01, bot23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+		d11 = _mm_shuffle_ps( bot01, bot23, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 SampleLanesSSE2( const float* d0, __m128i index, __m128 s1, __m128 t1, uint stride )
+	{
+		const __m128 one = _mm_set1_ps( 1.0f );
+		const __m128 s0 = _mm_sub_ps( one, s1 );
+		const __m128 t0 = _mm_sub_ps( one, t1 );
+
+		__m128 d00, d10, d01, d11;
+		GatherCornersSSE2( d0, index, stride, d00, d10, d01, d11 );
+
+		const __m128 left	= _mm_add_ps( _mm_mul_ps( t0, d00 ), _mm_mul_ps( t1, d01 ) );
+		const __m128 right	= _mm_add_ps( _mm_mul_ps( t0, d10 ), _mm_mul_ps( t1, d11 ) );
+
+		return _mm_add_ps( _mm_mul_ps( s0, left ), _mm_mul_ps( s1, right ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 void SSE2( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const BacktraceSSE2Constants c = MakeBacktraceSSE2Constants( dt0, size_x, size_y );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			const uint row = y * stride;
+
+			uint x = x_begin;
+			for( ; x + 4 <= x_end; x += 4 )
+			{
+				__m128i index;
+				__m128 s1, t1;
+				BacktraceLanesSSE2( c, u, v, stride, x, y, index, s1, t1 );
+
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					_mm_storeu_ps( d[f] + row + x, SampleLanesSSE2( d0[f], index, s1, t1, stride ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					d[f][row + x] = SampleCell( d0[f], index, s1, t1, stride );
+				}
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 SampleInterleavedSSE2( const float* d0, uint index, float s1, float t1, __m128 decay, uint stride )
+	{
+		const __m128 one = _mm_set1_ps( 1.0f );
+		const __m128 vs1 = _mm_set1_ps( s1 );
+		const __m128 vt1 = _mm_set1_ps( t1 );
+		const __m128 vs0 = _mm_sub_ps( one, vs1 );
+		const __m128 vt0 = _mm_sub_ps( one, vt1 );
+
+		const uint row_stride = stride * INTERLEAVED_CHANNELS;
+		const float* src = d0 + (index * INTERLEAVED_CHANNELS);
+
+		const __m128 left	= _mm_add_ps( _mm_mul_ps( vt0, _mm_loadu_ps( src ) ), _mm_mul_ps( vt1, _mm_loadu_ps( src + row_stride ) ) );
+		const __m128 right	= _mm_add_ps( _mm_mul_ps( vt0, _mm_loadu_ps( src + INTERLEAVED_CHANNELS ) ), _mm_mul_ps( vt1, _mm_loadu_ps( src + row_stride + INTERLEAVED_CHANNELS ) ) );
+		const __m128 value	= _mm_add_ps( _mm_mul_ps( vs0, left ), _mm_mul_ps( vs1, right ) );
+
+		//Zero first so a -0 result is kept, matching the scalar clamp
+		return _mm_max_ps( _mm_setzero_ps(), _mm_sub_ps( value, decay ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline void StoreCellSSE2( float* dst, __m128 value )
+	{
+		_mm_storeu_ps( dst, value );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline void StoreCellSSE2( Half::Float16* dst, __m128 value )
+	{
+		//SSE2 has no conversion to half, F16C arrives with AVX2
+		float values[ INTERLEAVED_CHANNELS ];
+		_mm_storeu_ps( values, value );
+
+		for( uint ch = 0; ch < INTERLEAVED_CHANNELS; ++ch )
+		{
+			dst[ch] = Half::Float16( values[ch] );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline void StoreCellSSE2( Half::BFloat16* dst, __m128 value )
+	{
+		//Round to nearest even on the integer unit. The arithmetic shift keeps the results in
+		//range for the signed pack, which then just drops the top halves. Densities are never NaN.
+		const __m128i bits	= _mm_castps_si128( value );
+		const __m128i odd	= _mm_and_si128( _mm_srli_epi32( bits, 16 ), _mm_set1_epi32( 1 ) );
+		const __m128i round	= _mm_add_epi32( _mm_add_epi32( bits, _mm_set1_epi32( 0x7fff ) ), odd );
+		const __m128i top	= _mm_srai_epi32( round, 16 );
+
+		_mm_storel_epi64( (__m128i*)dst, _mm_packs_epi32( top, top ) );
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_SSE2 static void InterleavedSSE2T( T* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const BacktraceSSE2Constants c = MakeBacktraceSSE2Constants( dt0, size_x, size_y );
+		const __m128 vdecay = _mm_set1_ps( decay );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			T* dst = d + (y * stride) * INTERLEAVED_CHANNELS;
+
+			uint x = x_begin;
+			for( ; x + 4 <= x_end; x += 4 )
+			{
+				__m128i index;
+				__m128 s1, t1;
+				BacktraceLanesSSE2( c, u, v, stride, x, y, index, s1, t1 );
+
+				uint ii[4];
+				float ss[4], tt[4];
+				_mm_storeu_si128( (__m128i*)ii, index );
+				_mm_storeu_ps( ss, s1 );
+				_mm_storeu_ps( tt, t1 );
+
+				for( uint k = 0; k < 4; ++k )
+				{
+					StoreCellSSE2( dst + (x + k) * INTERLEAVED_CHANNELS, SampleInterleavedSSE2( d0, ii[k], ss[k], tt[k], vdecay, stride ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				StoreCellSSE2( dst + x * INTERLEAVED_CHANNELS, SampleInterleavedSSE2( d0, index, s1, t1, vdecay, stride ) );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 void InterleavedSSE2( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		InterleavedSSE2T( d, d0, u, v, dt0, decay, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 CorrectLanesSSE2( __m128 hat, __m128 d0, __m128 back, __m128 d00, __m128 d10, __m128 d01, __m128 d11 )
+	{
+		//Operands ordered so ties pick the same value as std::min and std::max
+		const __m128 lo = _mm_min_ps( _mm_min_ps( d11, d01 ), _mm_min_ps( d10, d00 ) );
+		const __m128 hi = _mm_max_ps( _mm_max_ps( d11, d01 ), _mm_max_ps( d10, d00 ) );
+
+		const __m128 value = _mm_add_ps( hat, _mm_mul_ps( _mm_set1_ps( 0.5f ), _mm_sub_ps( d0, back ) ) );
+
+		return _mm_min_ps( hi, _mm_max_ps( lo, value ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 void CorrectSSE2( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const BacktraceSSE2Constants c = MakeBacktraceSSE2Constants( dt0, size_x, size_y );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			const uint row = y * stride;
+
+			uint x = x_begin;
+			for( ; x + 4 <= x_end; x += 4 )
+			{
+				__m128i index;
+				__m128 s1, t1;
+				BacktraceLanesSSE2( c, u, v, stride, x, y, index, s1, t1 );
+
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					__m128 d00, d10, d01, d11;
+					GatherCornersSSE2( d0[f], index, stride, d00, d10, d01, d11 );
+
+					const uint cell = row + x;
+					_mm_storeu_ps( d[f] + cell, CorrectLanesSSE2( _mm_loadu_ps( d[f] + cell ), _mm_loadu_ps( d0[f] + cell ), _mm_loadu_ps( back[f] + cell ), d00, d10, d01, d11 ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				const uint cell = row + x;
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					d[f][cell] = CorrectValue( d[f][cell], d0[f][cell], back[f][cell], d0[f] + index, stride, 1 );
+				}
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 CorrectInterleavedSSE2( const float* hat, const float* d0, const float* back, uint cell, uint index, __m128 decay, uint stride )
+	{
+		//One vector holds all four channels of the cell
+		const uint row_stride = stride * INTERLEAVED_CHANNELS;
+		const float* src = d0 + (index * INTERLEAVED_CHANNELS);
+		const uint i = cell * INTERLEAVED_CHANNELS;
+
+		const __m128 value = CorrectLanesSSE2( _mm_loadu_ps( hat + i ), _mm_loadu_ps( d0 + i ), _mm_loadu_ps( back + i ),
+			_mm_loadu_ps( src ), _mm_loadu_ps( src + INTERLEAVED_CHANNELS ), _mm_loadu_ps( src + row_stride ), _mm_loadu_ps( src + row_stride + INTERLEAVED_CHANNELS ) );
+
+		return _mm_max_ps( _mm_setzero_ps(), _mm_sub_ps( value, decay ) );
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_SSE2 static void InterleavedCorrectSSE2T( T* d, const float* hat, const float* d0, const float* back, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const BacktraceSSE2Constants c = MakeBacktraceSSE2Constants( dt0, size_x, size_y );
+		const __m128 vdecay = _mm_set1_ps( decay );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			const uint row = y * stride;
+
+			uint x = x_begin;
+			for( ; x + 4 <= x_end; x += 4 )
+			{
+				__m128i index;
+				__m128 s1, t1;
+				BacktraceLanesSSE2( c, u, v, stride, x, y, index, s1, t1 );
+
+				uint ii[4];
+				_mm_storeu_si128( (__m128i*)ii, index );
+
+				for( uint k = 0; k < 4; ++k )
+				{
+					StoreCellSSE2( d + (row + x + k) * INTERLEAVED_CHANNELS, CorrectInterleavedSSE2( hat, d0, back, row + x + k, ii[k], vdecay, stride ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				StoreCellSSE2( d + (row + x) * INTERLEAVED_CHANNELS, CorrectInterleavedSSE2( hat, d0, back, row + x, index, vdecay, stride ) );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	struct BacktraceAVX2Constants
+	{
+		__m256	mLane;
+		__m256	mDt0;
+		__m256	mLo;
+		__m256	mHiX;
+		__m256	mHiY;
+	};
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline BacktraceAVX2Constants MakeBacktraceAVX2Constants( float dt0, uint size_x, uint size_y )
+	{
+		BacktraceAVX2Constants c;
+		c.mLane	= _mm256_setr_ps( 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f );
+		c.mDt0	= _mm256_set1_ps( dt0 );
+		c.mLo	= _mm256_set1_ps( 0.5f );
+		c.mHiX	= _mm256_set1_ps( size_x - 1.501f );
+		c.mHiY	= _mm256_set1_ps( size_y - 1.501f );
+		return c;
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void BacktraceLanesAVX2( const BacktraceAVX2Constants& c, const float* u, const float* v, uint stride, uint x, uint y, __m256i& index, __m256& s1, __m256& t1 )
+	{
+		const uint cell = (y * stride) + x;
+		const __m256 fx = _mm256_add_ps( _mm256_set1_ps( (float)x ), c.mLane );
+		const __m256 fy = _mm256_set1_ps( (float)y );
+
+		__m256 x1 = _mm256_sub_ps( fx, _mm256_mul_ps( c.mDt0, _mm256_loadu_ps( u + cell ) ) );
+		__m256 y1 = _mm256_sub_ps( fy, _mm256_mul_ps( c.mDt0, _mm256_loadu_ps( v + cell ) ) );
+
+		x1 = _mm256_min_ps( _mm256_max_ps( x1, c.mLo ), c.mHiX );
+		y1 = _mm256_min_ps( _mm256_max_ps( y1, c.mLo ), c.mHiY );
+
+		const __m256i i0 = _mm256_cvttps_epi32( x1 );
+		const __m256i j0 = _mm256_cvttps_epi32( y1 );
+
+		index	= _mm256_add_epi32( _mm256_mullo_epi32( j0, _mm256_set1_epi32( (int)stride ) ), i0 );
+		s1		= _mm256_sub_ps( x1, _mm256_cvtepi32_ps( i0 ) );
+		t1		= _mm256_sub_ps( y1, _mm256_cvtepi32_ps( j0 ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void GatherCornersAVX2( const float* d0, __m256i index, uint stride, __m256& d00, __m256& d10, __m256& d01, __m256& d11 )
+	{
+		//Paired 64 bit loads of (i0, i0+1) from both source rows, which measured faster than
+		//four vgatherdps per field once several fields share the same departure points
+		uint ii[8];
+		_mm256_storeu_si256( (__m256i*)ii, index );
+
+		const __m256 top0145 = _mm256_set_m128( LoadPairsSSE2( d0, ii[4], ii[5] ), LoadPairsSSE2( d0, ii[0], ii[1] ) );
+		const __m256 top2367 = _mm256_set_m128( LoadPairsSSE2( d0, ii[6], ii[7] ), LoadPairsSSE2( d0, ii[2], ii[3] ) );
+		const __m256 bot0145 = _mm256_set_m128( LoadPairsSSE2( d0 + stride, ii[4], ii[5] ), LoadPairsSSE2( d0 + stride, ii[0], ii[1] ) );
+		const __m256 bot2367 = _mm256_set_m128( LoadPairsSSE2( d0 + stride, ii[6], ii[7] ), LoadPairsSSE2( d0 + stride, ii[2], ii[3] ) );
+
+		d00 = _mm256_shuffle_ps( top0145, top2367, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+		d10 = _mm256_shuffle_ps( top0145, top2367, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+		d01 = _mm256_shuffle_ps( bot0145, bot2367, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+		d11 = _mm256_shuffle_ps( bot0145, bot2367, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 SampleLanesAVX2( const float* d0, __m256i index, __m256 s1, __m256 t1, uint stride )
+	{
+		const __m256 one = _mm256_set1_ps( 1.0f );
+		const __m256 s0 = _mm256_sub_ps( one, s1 );
+		const __m256 t0 = _mm256_sub_ps( one, t1 );
+
+		__m256 d00, d10, d01, d11;
+		GatherCornersAVX2( d0, index, stride, d00, d10, d01, d11 );
+
+		const __m256 left	= _mm256_add_ps( _mm256_mul_ps( t0, d00 ), _mm256_mul_ps( t1, d01 ) );
+		const __m256 right	= _mm256_add_ps( _mm256_mul_ps( t0, d10 ), _mm256_mul_ps( t1, d11 ) );
+
+		return _mm256_add_ps( _mm256_mul_ps( s0, left ), _mm256_mul_ps( s1, right ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 void AVX2( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const BacktraceAVX2Constants c = MakeBacktraceAVX2Constants( dt0, size_x, size_y );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			const uint row = y * stride;
+
+			uint x = x_begin;
+			for( ; x + 8 <= x_end; x += 8 )
+			{
+				__m256i index;
+				__m256 s1, t1;
+				BacktraceLanesAVX2( c, u, v, stride, x, y, index, s1, t1 );
+
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					_mm256_storeu_ps( d[f] + row + x, SampleLanesAVX2( d0[f], index, s1, t1, stride ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					d[f][row + x] = SampleCell( d0[f], index, s1, t1, stride );
+				}
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 LoadCellPairAVX2( const float* src, uint a, uint b )
+	{
+		return _mm256_set_m128( _mm_loadu_ps( src + b ), _mm_loadu_ps( src + a ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 SampleInterleavedAVX2( const float* d0, const uint* ii, const float* ss, const float* tt, __m256 decay, uint stride )
+	{
+		const __m256 one = _mm256_set1_ps( 1.0f );
+		const __m256 vs1 = _mm256_set_m128( _mm_set1_ps( ss[1] ), _mm_set1_ps( ss[0] ) );
+		const __m256 vt1 = _mm256_set_m128( _mm_set1_ps( tt[1] ), _mm_set1_ps( tt[0] ) );
+		const __m256 vs0 = _mm256_sub_ps( one, vs1 );
+		const __m256 vt0 = _mm256_sub_ps( one, vt1 );
+
+		//Each half of the vector is one cell with all four channels
+		const uint row_stride = stride * INTERLEAVED_CHANNELS;
+		const uint a = ii[0] * INTERLEAVED_CHANNELS;
+		const uint b = ii[1] * INTERLEAVED_CHANNELS;
+
+		const __m256 d00 = LoadCellPairAVX2( d0, a, b );
+		const __m256 d10 = LoadCellPairAVX2( d0 + INTERLEAVED_CHANNELS, a, b );
+		const __m256 d01 = LoadCellPairAVX2( d0 + row_stride, a, b );
+		const __m256 d11 = LoadCellPairAVX2( d0 + row_stride + INTERLEAVED_CHANNELS, a, b );
+
+		const __m256 left	= _mm256_add_ps( _mm256_mul_ps( vt0, d00 ), _mm256_mul_ps( vt1, d01 ) );
+		const __m256 right	= _mm256_add_ps( _mm256_mul_ps( vt0, d10 ), _mm256_mul_ps( vt1, d11 ) );
+		const __m256 value	= _mm256_add_ps( _mm256_mul_ps( vs0, left ), _mm256_mul_ps( vs1, right ) );
+
+		return _mm256_max_ps( _mm256_setzero_ps(), _mm256_sub_ps( value, decay ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void StoreCellAVX2( float* dst, __m128 value )
+	{
+		_mm_storeu_ps( dst, value );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void StoreCellAVX2( Half::Float16* dst, __m128 value )
+	{
+		_mm_storel_epi64( (__m128i*)dst, _mm_cvtps_ph( value, _MM_FROUND_TO_NEAREST_INT ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void StoreCellAVX2( Half::BFloat16* dst, __m128 value )
+	{
+		StoreCellSSE2( dst, value );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void StoreCellPairAVX2( float* dst, __m256 value )
+	{
+		_mm256_storeu_ps( dst, value );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void StoreCellPairAVX2( Half::Float16* dst, __m256 value )
+	{
+		_mm_storeu_si128( (__m128i*)dst, _mm256_cvtps_ph( value, _MM_FROUND_TO_NEAREST_INT ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline void StoreCellPairAVX2( Half::BFloat16* dst, __m256 value )
+	{
+		StoreCellSSE2( dst, _mm256_castps256_ps128( value ) );
+		StoreCellSSE2( dst + INTERLEAVED_CHANNELS, _mm256_extractf128_ps( value, 1 ) );
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_AVX2 static void InterleavedAVX2T( T* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const BacktraceAVX2Constants c = MakeBacktraceAVX2Constants( dt0, size_x, size_y );
+		const __m256 vdecay = _mm256_set1_ps( decay );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			T* dst = d + (y * stride) * INTERLEAVED_CHANNELS;
+
+			uint x = x_begin;
+			for( ; x + 8 <= x_end; x += 8 )
+			{
+				__m256i index;
+				__m256 s1, t1;
+				BacktraceLanesAVX2( c, u, v, stride, x, y, index, s1, t1 );
+
+				uint ii[8];
+				float ss[8], tt[8];
+				_mm256_storeu_si256( (__m256i*)ii, index );
+				_mm256_storeu_ps( ss, s1 );
+				_mm256_storeu_ps( tt, t1 );
+
+				for( uint k = 0; k < 8; k += 2 )
+				{
+					StoreCellPairAVX2( dst + (x + k) * INTERLEAVED_CHANNELS, SampleInterleavedAVX2( d0, ii + k, ss + k, tt + k, vdecay, stride ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				StoreCellAVX2( dst + x * INTERLEAVED_CHANNELS, SampleInterleavedSSE2( d0, index, s1, t1, _mm256_castps256_ps128( vdecay ), stride ) );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 void InterleavedAVX2( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		InterleavedAVX2T( d, d0, u, v, dt0, decay, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 void CorrectAVX2( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const BacktraceAVX2Constants c = MakeBacktraceAVX2Constants( dt0, size_x, size_y );
+		const __m256 half = _mm256_set1_ps( 0.5f );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			const uint row = y * stride;
+
+			uint x = x_begin;
+			for( ; x + 8 <= x_end; x += 8 )
+			{
+				__m256i index;
+				__m256 s1, t1;
+				BacktraceLanesAVX2( c, u, v, stride, x, y, index, s1, t1 );
+
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					__m256 d00, d10, d01, d11;
+					GatherCornersAVX2( d0[f], index, stride, d00, d10, d01, d11 );
+
+					//As CorrectLanesSSE2
+					const __m256 lo = _mm256_min_ps( _mm256_min_ps( d11, d01 ), _mm256_min_ps( d10, d00 ) );
+					const __m256 hi = _mm256_max_ps( _mm256_max_ps( d11, d01 ), _mm256_max_ps( d10, d00 ) );
+
+					const uint cell = row + x;
+					const __m256 value = _mm256_add_ps( _mm256_loadu_ps( d[f] + cell ), _mm256_mul_ps( half, _mm256_sub_ps( _mm256_loadu_ps( d0[f] + cell ), _mm256_loadu_ps( back[f] + cell ) ) ) );
+
+					_mm256_storeu_ps( d[f] + cell, _mm256_min_ps( hi, _mm256_max_ps( lo, value ) ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				const uint cell = row + x;
+				for( uint f = 0; f < num_fields; ++f )
+				{
+					d[f][cell] = CorrectValue( d[f][cell], d0[f][cell], back[f][cell], d0[f] + index, stride, 1 );
+				}
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_AVX2 static void InterleavedCorrectAVX2T( T* d, const float* hat, const float* d0, const float* back, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		//Eight backtraces at a time, then each cell's four channels corrected in one 128 bit vector
+		const BacktraceAVX2Constants c = MakeBacktraceAVX2Constants( dt0, size_x, size_y );
+		const __m128 vdecay = _mm_set1_ps( decay );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			const uint row = y * stride;
+
+			uint x = x_begin;
+			for( ; x + 8 <= x_end; x += 8 )
+			{
+				__m256i index;
+				__m256 s1, t1;
+				BacktraceLanesAVX2( c, u, v, stride, x, y, index, s1, t1 );
+
+				uint ii[8];
+				_mm256_storeu_si256( (__m256i*)ii, index );
+
+				for( uint k = 0; k < 8; ++k )
+				{
+					StoreCellAVX2( d + (row + x + k) * INTERLEAVED_CHANNELS, CorrectInterleavedSSE2( hat, d0, back, row + x + k, ii[k], vdecay, stride ) );
+				}
+			}
+
+			for( ; x < x_end; ++x )
+			{
+				uint index;
+				float s1, t1;
+				BacktraceCell( u, v, dt0, size_x, size_y, stride, x, y, index, s1, t1 );
+
+				StoreCellAVX2( d + (row + x) * INTERLEAVED_CHANNELS, CorrectInterleavedSSE2( hat, d0, back, row + x, index, vdecay, stride ) );
+			}
+		}
+	}
+#else
+	//------------------------------------------------------------------------------
+	void SSE2( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		Scalar( d, d0, num_fields, u, v, dt0, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	void AVX2( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		Scalar( d, d0, num_fields, u, v, dt0, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	void InterleavedSSE2( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		InterleavedScalar( d, d0, u, v, dt0, decay, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	void InterleavedAVX2( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		InterleavedScalar( d, d0, u, v, dt0, decay, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	void CorrectSSE2( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		CorrectScalar( d, d0, back, num_fields, u, v, dt0, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	void CorrectAVX2( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		CorrectScalar( d, d0, back, num_fields, u, v, dt0, size_x, size_y, stride, x_begin, x_end, y_begin, y_end );
+	}
+#endif
+
+	//------------------------------------------------------------------------------
+	Kernel Get( Simd::Level level )
+	{
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return AVX2;
+		case Simd::LEVEL_SSE2:		return SSE2;
+		case Simd::LEVEL_SCALAR:	return Scalar;
+		}
+
+		return Scalar;
+	}
+
+	//------------------------------------------------------------------------------
+	InterleavedKernel GetInterleaved( Simd::Level level )
+	{
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return InterleavedAVX2;
+		case Simd::LEVEL_SSE2:		return InterleavedSSE2;
+		case Simd::LEVEL_SCALAR:	return InterleavedScalar;
+		}
+
+		return InterleavedScalar;
+	}
+
+	//------------------------------------------------------------------------------
+	InterleavedFloat16Kernel GetInterleavedFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return InterleavedAVX2T<Half::Float16>;
+		case Simd::LEVEL_SSE2:		return InterleavedSSE2T<Half::Float16>;
+		case Simd::LEVEL_SCALAR:	return InterleavedScalarT<Half::Float16>;
+		}
+#endif
+
+		return InterleavedScalarT<Half::Float16>;
+	}
+
+	//------------------------------------------------------------------------------
+	InterleavedBFloat16Kernel GetInterleavedBFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return InterleavedAVX2T<Half::BFloat16>;
+		case Simd::LEVEL_SSE2:		return InterleavedSSE2T<Half::BFloat16>;
+		case Simd::LEVEL_SCALAR:	return InterleavedScalarT<Half::BFloat16>;
+		}
+#endif
+
+		return InterleavedScalarT<Half::BFloat16>;
+	}
+
+	//------------------------------------------------------------------------------
+	CorrectKernel GetCorrect( Simd::Level level )
+	{
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return CorrectAVX2;
+		case Simd::LEVEL_SSE2:		return CorrectSSE2;
+		case Simd::LEVEL_SCALAR:	return CorrectScalar;
+		}
+
+		return CorrectScalar;
+	}
+
+	//------------------------------------------------------------------------------
+	InterleavedCorrectKernel GetInterleavedCorrect( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return InterleavedCorrectAVX2T<float>;
+		case Simd::LEVEL_SSE2:		return InterleavedCorrectSSE2T<float>;
+		case Simd::LEVEL_SCALAR:	return InterleavedCorrectScalarT<float>;
+		}
+#endif
+
+		return InterleavedCorrectScalarT<float>;
+	}
+
+	//------------------------------------------------------------------------------
+	InterleavedCorrectFloat16Kernel GetInterleavedCorrectFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return InterleavedCorrectAVX2T<Half::Float16>;
+		case Simd::LEVEL_SSE2:		return InterleavedCorrectSSE2T<Half::Float16>;
+		case Simd::LEVEL_SCALAR:	return InterleavedCorrectScalarT<Half::Float16>;
+		}
+#endif
+
+		return InterleavedCorrectScalarT<Half::Float16>;
+	}
+
+	//------------------------------------------------------------------------------
+	InterleavedCorrectBFloat16Kernel GetInterleavedCorrectBFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return InterleavedCorrectAVX2T<Half::BFloat16>;
+		case Simd::LEVEL_SSE2:		return InterleavedCorrectSSE2T<Half::BFloat16>;
+		case Simd::LEVEL_SCALAR:	return InterleavedCorrectScalarT<Half::BFloat16>;
+		}
+#endif
+
+		return InterleavedCorrectScalarT<Half::BFloat16>;
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef ADVECTKERNELS_H
+#define ADVECTKERNELS_H
+
+
+#include "Half.h"
+#include "Simd.h"
+#include "types.h"
+
+
+//Semi-Lagrangian advection kernels used by FluidSim::Advect. Each cell in
+//columns [x_begin, x_end) of rows [y_begin, y_end) is traced back through
+//(u, v) once, then every one of the num_fields source fields is sampled at the
+//departure point. Rows start stride cells apart, which is at least size_x.
+//All kernels produce bit-identical results.
+namespace AdvectKernels
+{
+	//Floats per cell in the interleaved (RGBX) layout
+	const static uint INTERLEAVED_CHANNELS = 4;
+
+	typedef void (*Kernel)( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//Reference implementation
+	void Scalar( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//4 cells per iteration, gathering with paired loads from the two source rows
+	void SSE2( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//8 cells per iteration, same paired loads as SSE2
+	void AVX2( float* const* d, const float* const* d0, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	Kernel Get( Simd::Level level );
+
+	//Interleaved variants advect every channel of an RGBX grid from one backtrace
+	//per cell, then subtract decay and clamp at zero as the result is written
+	typedef void (*InterleavedKernel)( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	void InterleavedScalar( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//One 128 bit vector per cell holds all four channels
+	void InterleavedSSE2( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//Two cells per 256 bit vector
+	void InterleavedAVX2( float* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	InterleavedKernel GetInterleaved( Simd::Level level );
+
+	//The interleaved kernels again, rounding each cell to 16 bit storage as it's written
+	typedef void (*InterleavedFloat16Kernel)( Half::Float16* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+	typedef void (*InterleavedBFloat16Kernel)( Half::BFloat16* d, const float* d0, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	InterleavedFloat16Kernel GetInterleavedFloat16( Simd::Level level );
+	InterleavedBFloat16Kernel GetInterleavedBFloat16( Simd::Level level );
+
+	//MacCormack correction. d holds the advection of d0 and back is d advected back
+	//again with dt0 negated, so half their difference from d0 is the error of one
+	//step. That's added to d, then each cell is limited to the range of the four d0
+	//values its departure point was interpolated from so no new extrema appear.
+	typedef void (*CorrectKernel)( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	void CorrectScalar( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+	void CorrectSSE2( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+	void CorrectAVX2( float* const* d, const float* const* d0, const float* const* back, uint num_fields, const float* u, const float* v, float dt0, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	CorrectKernel GetCorrect( Simd::Level level );
+
+	//The interleaved correction reads the forward advection from hat, then subtracts
+	//decay and clamps at zero as it writes d in its storage precision
+	typedef void (*InterleavedCorrectKernel)( float* d, const float* hat, const float* d0, const float* back, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+	typedef void (*InterleavedCorrectFloat16Kernel)( Half::Float16* d, const float* hat, const float* d0, const float* back, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+	typedef void (*InterleavedCorrectBFloat16Kernel)( Half::BFloat16* d, const float* hat, const float* d0, const float* back, const float* u, const float* v, float dt0, float decay, uint size_x, uint size_y, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	InterleavedCorrectKernel GetInterleavedCorrect( Simd::Level level );
+	InterleavedCorrectFloat16Kernel GetInterleavedCorrectFloat16( Simd::Level level );
+	InterleavedCorrectBFloat16Kernel GetInterleavedCorrectBFloat16( Simd::Level level );
+}
+
+
+#endif //ADVECTKERNELS_H
@@ -0,0 +1,1088 @@
+#include "Benchmark.h"
+#include "FluidSim.h"
+#include "FluidSimEnsemble.h"
+#include "FluidSimT.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+// Constants:
+namespace
+{
+	//main.cpp's simulation parameters
+	const float		VISCOSITY		= 0.0002f;
+	const float		DIFFUSION		= 0.0001f;
+	const float		DECAY			= 0.5f;
+	const float		GRAVITY			= -10.0f;
+	const float		TIME_DELTA		= 0.03f;
+
+	const float		SOURCE_DENSITY	= 15.0f;
+	const float		PUSH_VELOCITY	= 40.0f;
+	const uint		PUSH_INTERVAL	= 10;
+
+	const uint		CHECK_WIDTH		= 60;
+	const uint		CHECK_HEIGHT	= 100;
+	const uint		CHECK_STEPS		= 200;
+	const uint		TIMED_STEPS		= 40;
+
+	const uint		ENSEMBLE_SIZE	= 8;
+
+	const float		SMALL_GRID_TOLERANCE	= 1e-4f;
+	const uint		SMALL_GRID_CYCLES		= 100;
+	const uint		SMALL_GRID_STEPS		= 20;
+
+	const float		VORTEX_CELLS	= 4.0f;		//How far the kernel timings' vortex moves each cell in a step
+	const uint		KERNEL_RUNS		= 50;		//Best of this many at 256x256, fewer for larger grids
+	const uint		MIN_KERNEL_RUNS	= 5;
+
+	const uint		THREAD_SIZE		= 1024;
+	const uint		THREAD_STEPS	= 10;
+
+	const uint		ADVECT_RUNS		= 20;		//Best of this many at 512x512, fewer for larger grids
+	const uint		MIN_ADVECT_RUNS	= 3;
+
+	const uint		SOLVER_SIZE		= 256;
+	const uint		SOLVER_RUNS		= 3;		//Best of this many for each solve
+
+	const uint		FAST_VORTEX_SIZE	= 4096;
+	const uint		FAST_VORTEX_RUNS	= 3;
+
+	const float		DETAIL_ERROR	= 0.45f;		//The slotted disk's error that counts as keeping its detail
+	const uint		DISK_STEPS		= 2;		//Steps per cell of the grid's width for the disk's turn
+}
+
+namespace Benchmark
+{
+	//Times each of FluidSimT's kernels on its own, for comparing layouts, and
+	//reads the FluidSim state the public interface doesn't show
+	class KernelTimer
+	{
+	public:
+		template< template< uint, uint > class Layout > static void Run( const char* name, uint size );
+		static void TimeSolvers( uint size );
+		static void TimeAdvect( uint size );
+		static void ReadVelocities( const FluidSim& sim, std::vector<double>& out_velocities );
+		static double TurnDisk( uint size, FluidSim::AdvectionScheme scheme, double& out_ms );
+		static void TimeBlockedAdvect( uint size, float cells );
+
+	private:
+		static void SetVortex( FluidSim& sim, uint size, float cells );
+		template< typename Reset, typename Func > static double Best( uint runs, Reset reset, Func func );
+	};
+}
+
+namespace
+{
+	//------------------------------------------------------------------------------
+	//Two sources near the bottom, rising under gravity, with a push every so often
+	template< typename Sim >
+	void Simulate( Sim& sim, uint size_x, uint size_y, uint steps )
+	{
+		sim.SetGravity( 0.0f, GRAVITY );
+		sim.PlaceSource( size_x/2, (size_y*4)/5, SOURCE_DENSITY, SOURCE_DENSITY/2, SOURCE_DENSITY/5 );
+		sim.PlaceSource( size_x/3, (size_y*9)/10, SOURCE_DENSITY/5, SOURCE_DENSITY/2, SOURCE_DENSITY );
+
+		for( uint step = 0; step < steps; ++step )
+		{
+			if( (step % PUSH_INTERVAL) == 0 )
+			{
+				sim.ApplyForce( size_x/2, (size_y*7)/10, PUSH_VELOCITY );
+			}
+
+			sim.Update( TIME_DELTA );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	//The red, green and blue densities of every cell, row by row
+	void ReadDensities( const FluidSim& sim, uint size_x, uint size_y, std::vector<double>& out_densities )
+	{
+		PixelToaster::vector<PixelToaster::Pixel> pixels;
+		sim.Draw( pixels, false, false, false );
+
+		out_densities.clear();
+		for( uint pixel = 0; pixel < size_x * size_y; ++pixel )
+		{
+			out_densities.push_back( pixels[ pixel ].r );
+			out_densities.push_back( pixels[ pixel ].g );
+			out_densities.push_back( pixels[ pixel ].b );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+	void ReadDensities( const FluidSimT< Real, W, H, Layout >& sim, uint size_x, uint size_y, std::vector<double>& out_densities )
+	{
+		out_densities.clear();
+		for( uint y = 0; y < size_y; ++y )
+		{
+			for( uint x = 0; x < size_x; ++x )
+			{
+				for( uint channel = 0; channel < 3; ++channel )
+				{
+					out_densities.push_back( sim.GetDensity( x, y, channel ) );
+				}
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	double RelativeL2( const std::vector<double>& values, const std::vector<double>& reference )
+	{
+		double diff = 0.0;
+		double norm = 0.0;
+		for( size_t i = 0; i < reference.size(); ++i )
+		{
+			diff += (values[i] - reference[i]) * (values[i] - reference[i]);
+			norm += reference[i] * reference[i];
+		}
+
+		return norm > 0.0 ? std::sqrt( diff / norm ) : std::sqrt( diff );
+	}
+
+	//------------------------------------------------------------------------------
+	//Relative L2 difference of Sim's densities from reference after the check run
+	template< typename Sim >
+	double Difference( const std::vector<double>& reference )
+	{
+		Sim sim( CHECK_WIDTH, CHECK_HEIGHT, VISCOSITY, DIFFUSION, DECAY );
+		Simulate( sim, CHECK_WIDTH, CHECK_HEIGHT, CHECK_STEPS );
+
+		std::vector<double> densities;
+		ReadDensities( sim, CHECK_WIDTH, CHECK_HEIGHT, densities );
+
+		return RelativeL2( densities, reference );
+	}
+
+	//------------------------------------------------------------------------------
+	//Prints the difference, exact ones fail unless it's 0
+	bool Report( const char* name, double difference, bool exact )
+	{
+		if( difference == 0.0 )
+		{
+			printf( "  %-34s identical\n", name );
+		}
+		else
+		{
+			printf( "  %-34s rel L2 %g%s\n", name, difference, exact ? ", FAILED" : "" );
+		}
+
+		return ! exact || difference == 0.0;
+	}
+
+	//------------------------------------------------------------------------------
+	//Milliseconds per step, after the sources have had a few steps to spread
+	template< typename Sim >
+	double TimeSteps( uint size )
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		Sim sim( size, size, VISCOSITY, DIFFUSION, DECAY );
+		Simulate( sim, size, size, PUSH_INTERVAL );
+
+		const Clock::time_point start = Clock::now();
+		for( uint step = 0; step < TIMED_STEPS; ++step )
+		{
+			sim.Update( TIME_DELTA );
+		}
+
+		return std::chrono::duration<double, std::milli>( Clock::now() - start ).count() / TIMED_STEPS;
+	}
+
+	//------------------------------------------------------------------------------
+	template< uint SIZE >
+	void TimeTemplates()
+	{
+		const double fluid_sim		= TimeSteps< FluidSim >( SIZE );
+		const double fixed_size		= TimeSteps< FluidSimT<float, SIZE, SIZE> >( SIZE );
+		const double dynamic_size	= TimeSteps< FluidSimT<float> >( SIZE );
+		const double double_fixed	= TimeSteps< FluidSimT<double, SIZE, SIZE> >( SIZE );
+
+		printf( "  %4ux%-4u  %9.1f %7.1f %8.1f %7.1f\n", SIZE, SIZE, fluid_sim, fixed_size, dynamic_size, double_fixed );
+	}
+
+	//------------------------------------------------------------------------------
+	//FluidSimT<float> has to match FluidSim, double is only expected to be close
+	bool CheckTemplates()
+	{
+		printf( "FluidSimT against FluidSim, %ux%u, %u steps\n", CHECK_WIDTH, CHECK_HEIGHT, CHECK_STEPS );
+
+		std::vector<double> reference;
+		{
+			FluidSim sim( CHECK_WIDTH, CHECK_HEIGHT, VISCOSITY, DIFFUSION, DECAY );
+			Simulate( sim, CHECK_WIDTH, CHECK_HEIGHT, CHECK_STEPS );
+			ReadDensities( sim, CHECK_WIDTH, CHECK_HEIGHT, reference );
+		}
+
+		bool passed = true;
+		passed &= Report( "FluidSimT<float, 60, 100>", Difference< FluidSimT<float, CHECK_WIDTH, CHECK_HEIGHT> >( reference ), true );
+		passed &= Report( "FluidSimT<float>", Difference< FluidSimT<float> >( reference ), true );
+		passed &= Report( "FluidSimT<double, 60, 100>", Difference< FluidSimT<double, CHECK_WIDTH, CHECK_HEIGHT> >( reference ), false );
+		passed &= Report( "FluidSimT<float, 60, 100, Tiled>", Difference< FluidSimT<float, CHECK_WIDTH, CHECK_HEIGHT, TiledLayout> >( reference ), true );
+		passed &= Report( "FluidSimT<float, 60, 100, Morton>", Difference< FluidSimT<float, CHECK_WIDTH, CHECK_HEIGHT, MortonLayout> >( reference ), true );
+		passed &= Report( "FluidSimT<float, Tiled>", Difference< FluidSimT<float, DYNAMIC_SIZE, DYNAMIC_SIZE, TiledLayout> >( reference ), true );
+		passed &= Report( "FluidSimT<float, Morton>", Difference< FluidSimT<float, DYNAMIC_SIZE, DYNAMIC_SIZE, MortonLayout> >( reference ), true );
+
+		printf( "\nms/step, %u steps\n", TIMED_STEPS );
+		printf( "  size       FluidSim  static  dynamic  double\n" );
+		TimeTemplates<128>();
+		TimeTemplates<256>();
+		TimeTemplates<512>();
+		printf( "\n" );
+
+		return passed;
+	}
+
+	//------------------------------------------------------------------------------
+	//Densities and velocities after steps of the check run with the given storage precision
+	void RunPrecision( FluidSim::Precision precision, uint steps, std::vector<double>& out_densities, std::vector<double>& out_velocities )
+	{
+		FluidSim sim( CHECK_WIDTH, CHECK_HEIGHT, VISCOSITY, DIFFUSION, DECAY );
+		sim.SetStoragePrecision( precision );
+		Simulate( sim, CHECK_WIDTH, CHECK_HEIGHT, steps );
+
+		ReadDensities( sim, CHECK_WIDTH, CHECK_HEIGHT, out_densities );
+		Benchmark::KernelTimer::ReadVelocities( sim, out_velocities );
+	}
+
+	//------------------------------------------------------------------------------
+	//The 16 bit formats round every density they store, so they're only expected
+	//to be close to float. Velocities stay float but carry the densities' buoyancy.
+	//Over the whole check run the scene is chaotic enough that any rounding grows
+	//as large as double's difference, the first push shows the formats' own error.
+	void CheckPrecision()
+	{
+		printf( "16 bit storage against float, %ux%u\n", CHECK_WIDTH, CHECK_HEIGHT );
+
+		const uint steps[] = { PUSH_INTERVAL, CHECK_STEPS };
+		const FluidSim::Precision precisions[] = { FluidSim::PRECISION_FLOAT16, FluidSim::PRECISION_BFLOAT16 };
+		const char* const formats[] = { "float16", "bfloat16" };
+
+		for( uint s = 0; s < 2; ++s )
+		{
+			std::vector<double> densities;
+			std::vector<double> velocities;
+			RunPrecision( FluidSim::PRECISION_FLOAT32, steps[s], densities, velocities );
+
+			for( uint i = 0; i < 2; ++i )
+			{
+				std::vector<double> half_densities;
+				std::vector<double> half_velocities;
+				RunPrecision( precisions[i], steps[s], half_densities, half_velocities );
+
+				char name[ 64 ];
+				snprintf( name, sizeof(name), "%s densities, %u steps", formats[i], steps[s] );
+				Report( name, RelativeL2( half_densities, densities ), false );
+				snprintf( name, sizeof(name), "%s velocities, %u steps", formats[i], steps[s] );
+				Report( name, RelativeL2( half_velocities, velocities ), false );
+			}
+		}
+
+		printf( "\n" );
+	}
+
+	//------------------------------------------------------------------------------
+	//Member m's parameters, sources and pushes differ from every other member's
+	template< typename Sim >
+	void SetupMember( Sim& sim, uint member, uint step )
+	{
+		const uint source_x	= (CHECK_WIDTH/4) + (member * 4);
+		const uint force_x	= (CHECK_WIDTH/2) + member - (ENSEMBLE_SIZE/2);
+
+		if( step == 0 )
+		{
+			sim.SetGravity( 0.0f, GRAVITY * (member % 3) / 2 );
+			sim.PlaceSource( source_x, (CHECK_HEIGHT*4)/5, SOURCE_DENSITY, SOURCE_DENSITY * member / ENSEMBLE_SIZE, SOURCE_DENSITY/5 );
+		}
+
+		if( (step % (PUSH_INTERVAL + member)) == 0 )
+		{
+			sim.ApplyForce( force_x, (CHECK_HEIGHT*7)/10, PUSH_VELOCITY );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	//Lets SetupMember drive one member of an ensemble
+	template< typename Ensemble >
+	class EnsembleMember
+	{
+	public:
+		EnsembleMember( Ensemble& ensemble, uint member ) : mEnsemble( ensemble ), mMember( member ) {}
+
+		void SetGravity( float gu, float gv )								{ mEnsemble.SetGravity( mMember, gu, gv ); }
+		void PlaceSource( uint x, uint y, float r, float g, float b )		{ mEnsemble.PlaceSource( mMember, x, y, r, g, b ); }
+		void ApplyForce( uint x, uint y, float amount )						{ mEnsemble.ApplyForce( mMember, x, y, amount ); }
+
+	private:
+		Ensemble&	mEnsemble;
+		uint		mMember;
+	};
+
+	//------------------------------------------------------------------------------
+	//Every member of an ensemble has to give the same densities and velocities,
+	//bit for bit, as a FluidSimT run with that member's parameters
+	bool CheckEnsemble()
+	{
+		typedef FluidSimEnsemble<float, ENSEMBLE_SIZE, CHECK_WIDTH, CHECK_HEIGHT> Ensemble;
+		typedef FluidSimT<float, CHECK_WIDTH, CHECK_HEIGHT> Single;
+
+		printf( "FluidSimEnsemble<float, %u, 60, 100> members against FluidSimT, %u steps\n", ENSEMBLE_SIZE, CHECK_STEPS );
+
+		Ensemble ensemble( CHECK_WIDTH, CHECK_HEIGHT, VISCOSITY, DIFFUSION, DECAY );
+		for( uint member = 0; member < ENSEMBLE_SIZE; ++member )
+		{
+			ensemble.SetViscosity( member, VISCOSITY * (member + 1) );
+			ensemble.SetDiffusion( member, DIFFUSION * (member + 1) / 2 );
+			ensemble.SetDecay( member, DECAY * member / ENSEMBLE_SIZE );
+		}
+
+		for( uint step = 0; step < CHECK_STEPS; ++step )
+		{
+			for( uint member = 0; member < ENSEMBLE_SIZE; ++member )
+			{
+				EnsembleMember<Ensemble> driver( ensemble, member );
+				SetupMember( driver, member, step );
+			}
+
+			ensemble.Update( TIME_DELTA );
+		}
+
+		bool passed = true;
+		for( uint member = 0; member < ENSEMBLE_SIZE; ++member )
+		{
+			Single single( CHECK_WIDTH, CHECK_HEIGHT, VISCOSITY * (member + 1), DIFFUSION * (member + 1) / 2, DECAY * member / ENSEMBLE_SIZE );
+			for( uint step = 0; step < CHECK_STEPS; ++step )
+			{
+				SetupMember( single, member, step );
+				single.Update( TIME_DELTA );
+			}
+
+			uint mismatches = 0;
+			for( uint y = 0; y < CHECK_HEIGHT; ++y )
+			{
+				for( uint x = 0; x < CHECK_WIDTH; ++x )
+				{
+					for( uint channel = 0; channel < 4; ++channel )
+					{
+						mismatches += ensemble.GetDensity( member, x, y, channel ) != single.GetDensity( x, y, channel );
+					}
+
+					mismatches += ensemble.GetVelocityU( member, x, y ) != single.GetVelocityU( x, y );
+					mismatches += ensemble.GetVelocityV( member, x, y ) != single.GetVelocityV( x, y );
+				}
+			}
+
+			if( mismatches == 0 )
+			{
+				printf( "  member %-27u identical\n", member );
+			}
+			else
+			{
+				printf( "  member %-27u %u values differ, FAILED\n", member, mismatches );
+				passed = false;
+			}
+		}
+
+		printf( "\n" );
+		return passed;
+	}
+
+	//------------------------------------------------------------------------------
+	//Grids too small for multigrid to coarsen solve on their finest level alone.
+	//Both cycles have to bring every pressure solve down to the tolerance.
+	bool CheckSmallGrids()
+	{
+		printf( "Multigrid pressure solves on small grids, %u steps to a residual of %g\n", SMALL_GRID_STEPS, SMALL_GRID_TOLERANCE );
+
+		const uint sizes[][2] = { { 3, 3 }, { 4, 4 }, { 5, 7 }, { 6, 3 }, { 8, 8 }, { 10, 10 }, { 20, 5 } };
+		const FluidSim::Solver solvers[] = { FluidSim::SOLVER_MULTIGRID_V, FluidSim::SOLVER_MULTIGRID_F };
+
+		bool passed = true;
+		for( uint s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s )
+		{
+			const uint size_x = sizes[s][0];
+			const uint size_y = sizes[s][1];
+
+			for( uint i = 0; i < 2; ++i )
+			{
+				FluidSim sim( size_x, size_y, VISCOSITY, DIFFUSION, DECAY );
+				sim.SetPressureSolver( solvers[i] );
+				sim.SetPressurePolicy( FluidSim::SolverPolicy::Tolerance( SMALL_GRID_TOLERANCE, SMALL_GRID_CYCLES, 1 ) );
+				sim.SetGravity( 0.0f, GRAVITY );
+				sim.PlaceSource( size_x/2, size_y/2, SOURCE_DENSITY, SOURCE_DENSITY/2, SOURCE_DENSITY/5 );
+
+				float residual = 0.0f;
+				for( uint step = 0; step < SMALL_GRID_STEPS; ++step )
+				{
+					sim.ApplyForce( size_x/2, size_y/2, PUSH_VELOCITY );
+					sim.Update( TIME_DELTA );
+					residual = std::max( residual, sim.GetPressureStats().mResidual );
+				}
+
+				PixelToaster::vector<PixelToaster::Pixel> pixels;
+				sim.Draw( pixels, false, false, true );
+
+				bool finite = true;
+				for( uint pixel = 0; pixel < pixels.size(); ++pixel )
+				{
+					finite &= std::isfinite( pixels[ pixel ].r );
+				}
+
+				const bool converged = finite && residual <= SMALL_GRID_TOLERANCE;
+				printf( "  %2ux%-2u %-28s residual %g%s\n", size_x, size_y, i == 0 ? "V-cycle" : "F-cycle", residual, converged ? "" : ", FAILED" );
+				passed &= converged;
+			}
+		}
+
+		printf( "\n" );
+		return passed;
+	}
+
+	//------------------------------------------------------------------------------
+	//Update with red-black solves for pressure and diffusion, on 1, 2, 4 and so on
+	//threads, up to as many as the machine has
+	void TimeThreads()
+	{
+		const uint max_threads = std::max( std::thread::hardware_concurrency(), 1u );
+
+		std::vector<uint> counts;
+		for( uint threads = 1; threads < max_threads; threads *= 2 )
+		{
+			counts.push_back( threads );
+		}
+		counts.push_back( max_threads );
+
+		printf( "Red-black Update by thread count, %ux%u, %u steps\n", THREAD_SIZE, THREAD_SIZE, THREAD_STEPS );
+		printf( "  threads   ms/step  speedup\n" );
+
+		double single = 0.0;
+		for( uint i = 0; i < counts.size(); ++i )
+		{
+			typedef std::chrono::steady_clock Clock;
+
+			const uint threads = counts[i];
+
+			FluidSim sim( THREAD_SIZE, THREAD_SIZE, VISCOSITY, DIFFUSION, DECAY );
+			sim.SetThreadCount( threads );
+			sim.SetPressureSolver( FluidSim::SOLVER_RED_BLACK_GAUSS_SEIDEL );
+			sim.SetDiffusionSolver( FluidSim::SOLVER_RED_BLACK_GAUSS_SEIDEL );
+			Simulate( sim, THREAD_SIZE, THREAD_SIZE, 1 );
+
+			const Clock::time_point start = Clock::now();
+			for( uint step = 0; step < THREAD_STEPS; ++step )
+			{
+				sim.Update( TIME_DELTA );
+			}
+
+			const double ms = std::chrono::duration<double, std::milli>( Clock::now() - start ).count() / THREAD_STEPS;
+			if( threads == 1 )
+			{
+				single = ms;
+			}
+
+			printf( "  %7u %9.1f %8.2f\n", threads, ms, single / ms );
+		}
+
+		printf( "\n" );
+	}
+
+	//------------------------------------------------------------------------------
+	//L1 data load, last level cache and data TLB load misses on this thread, through
+	//perf_event_open. Counters the kernel or the machine doesn't offer read -1.
+	class PerfCounters
+	{
+	public:
+		enum Counter
+		{
+			COUNTER_L1D,
+			COUNTER_LLC,
+			COUNTER_DTLB,
+			NUM_COUNTERS,
+		};
+
+		PerfCounters()
+		{
+#if defined(__linux__)
+			//Load misses, but the last level cache's are often missing under a hypervisor
+			//and every last level miss is close enough
+			const unsigned int read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			const unsigned int types[ NUM_COUNTERS ] = { PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+			const unsigned long long configs[ NUM_COUNTERS ] = { PERF_COUNT_HW_CACHE_L1D | read_miss, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_CACHE_DTLB | read_miss };
+			for( uint c = 0; c < NUM_COUNTERS; ++c )
+			{
+				perf_event_attr attr;
+				memset( &attr, 0, sizeof(attr) );
+				attr.size			= sizeof(attr);
+				attr.type			= types[c];
+				attr.config			= configs[c];
+				attr.disabled		= 1;
+				attr.exclude_kernel	= 1;
+				attr.exclude_hv		= 1;
+
+				mFiles[c] = (int)syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+			}
+#else
+			for( uint c = 0; c < NUM_COUNTERS; ++c )
+			{
+				mFiles[c] = -1;
+			}
+#endif
+		}
+
+		~PerfCounters()
+		{
+#if defined(__linux__)
+			for( uint c = 0; c < NUM_COUNTERS; ++c )
+			{
+				if( mFiles[c] >= 0 )
+				{
+					close( mFiles[c] );
+				}
+			}
+#endif
+		}
+
+		void Start()
+		{
+#if defined(__linux__)
+			for( uint c = 0; c < NUM_COUNTERS; ++c )
+			{
+				if( mFiles[c] >= 0 )
+				{
+					ioctl( mFiles[c], PERF_EVENT_IOC_RESET, 0 );
+					ioctl( mFiles[c], PERF_EVENT_IOC_ENABLE, 0 );
+				}
+			}
+#endif
+		}
+
+		void Stop()
+		{
+#if defined(__linux__)
+			for( uint c = 0; c < NUM_COUNTERS; ++c )
+			{
+				if( mFiles[c] >= 0 )
+				{
+					ioctl( mFiles[c], PERF_EVENT_IOC_DISABLE, 0 );
+				}
+			}
+#endif
+		}
+
+		long long Read( Counter counter ) const
+		{
+#if defined(__linux__)
+			unsigned long long count = 0;
+			if( mFiles[ counter ] >= 0 && read( mFiles[ counter ], &count, sizeof(count) ) == sizeof(count) )
+			{
+				return (long long)count;
+			}
+#endif
+			(void)counter;
+			return -1;
+		}
+
+	private:
+		int mFiles[ NUM_COUNTERS ];
+	};
+
+	//------------------------------------------------------------------------------
+	void TimeAdvectKernels()
+	{
+		printf( "Advect by instruction set, ms, one thread\n" );
+		printf( "  %4s  %8s %8s %6s %8s\n", "size", "scalar", "sse2", "", "avx2" );
+
+		const uint sizes[] = { 512, 1024, 2048, 4096 };
+		for( uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i )
+		{
+			Benchmark::KernelTimer::TimeAdvect( sizes[i] );
+		}
+
+		printf( "\n" );
+	}
+
+	//------------------------------------------------------------------------------
+	//Vortices fast enough that neighbouring rows trace back to rows far apart,
+	//where the gathers miss in the caches and the TLB without blocking
+	void TimeFastVortex()
+	{
+		printf( "Advect with and without blocking in a fast vortex, %ux%u, one thread, misses per cell\n", FAST_VORTEX_SIZE, FAST_VORTEX_SIZE );
+		printf( "  cells/step  blocked        ms       L1D       LLC      dTLB\n" );
+
+		const float cells[] = { 4.0f, 20.0f, 60.0f };
+		for( uint i = 0; i < sizeof(cells) / sizeof(cells[0]); ++i )
+		{
+			Benchmark::KernelTimer::TimeBlockedAdvect( FAST_VORTEX_SIZE, cells[i] );
+		}
+
+		printf( "\n" );
+	}
+
+	//------------------------------------------------------------------------------
+	//Zalesak's slotted disk, 1 inside and 0 outside. It sits a quarter of the grid
+	//above the centre with the slot cut up through its middle.
+	float SlottedDisk( float x, float y, uint size )
+	{
+		const float dx = x / size - 0.5f;
+		const float dy = y / size - 0.25f;
+
+		const bool in_disk	= dx*dx + dy*dy < 0.15f * 0.15f;
+		const bool in_slot	= std::abs( dx ) < 0.025f && dy > -0.1f;
+
+		return in_disk && ! in_slot ? 1.0f : 0.0f;
+	}
+
+	//------------------------------------------------------------------------------
+	//Turns the slotted disk once around the centre with each scheme, at the same
+	//Courant number on every grid. The error is the relative L2 against the disk
+	//it started as, the first grid where it's within DETAIL_ERROR is the size and
+	//time each scheme needs to keep the disk's edges and slot.
+	void TimeAdvectionQuality()
+	{
+		printf( "Slotted disk after one turn, rel L2 and ms, one thread\n" );
+		printf( "  size  semi-lagrangian       maccormack\n" );
+
+		const FluidSim::AdvectionScheme schemes[] = { FluidSim::ADVECTION_SEMI_LAGRANGIAN, FluidSim::ADVECTION_MACCORMACK };
+		const char* const names[] = { "semi-lagrangian", "maccormack" };
+		const uint sizes[] = { 32, 64, 128, 256, 512 };
+
+		uint detail_size[2]	= { 0, 0 };
+		double detail_ms[2]	= { 0.0, 0.0 };
+
+		for( uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i )
+		{
+			printf( "  %4u", sizes[i] );
+			for( uint s = 0; s < 2; ++s )
+			{
+				double ms = 0.0;
+				const double error = Benchmark::KernelTimer::TurnDisk( sizes[i], schemes[s], ms );
+				printf( "  %7.4f %9.1f", error, ms );
+
+				if( error <= DETAIL_ERROR && detail_size[s] == 0 )
+				{
+					detail_size[s]	= sizes[i];
+					detail_ms[s]	= ms;
+				}
+			}
+			printf( "\n" );
+		}
+
+		for( uint s = 0; s < 2; ++s )
+		{
+			if( detail_size[s] != 0 )
+			{
+				printf( "  %s reaches %g at %ux%u in %.1f ms\n", names[s], DETAIL_ERROR, detail_size[s], detail_size[s], detail_ms[s] );
+			}
+			else
+			{
+				printf( "  %s doesn't reach %g\n", names[s], DETAIL_ERROR );
+			}
+		}
+
+		printf( "\n" );
+	}
+
+	//------------------------------------------------------------------------------
+	void TimeLayouts()
+	{
+		printf( "FluidSimT kernels by layout, ms, one core\n" );
+		printf( "  size  layout   sources  forces  diffuse advect-d advect-uv project\n" );
+
+		const uint sizes[] = { 256, 1024, 2048 };
+		for( uint i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i )
+		{
+			Benchmark::KernelTimer::Run<RowMajorLayout>( "row", sizes[i] );
+			Benchmark::KernelTimer::Run<TiledLayout>( "tiled", sizes[i] );
+			Benchmark::KernelTimer::Run<MortonLayout>( "morton", sizes[i] );
+		}
+
+		printf( "\n" );
+	}
+}
+
+namespace Benchmark
+{
+	//------------------------------------------------------------------------------
+	//The fastest of runs calls to func, each after an untimed call to reset
+	template< typename Reset, typename Func >
+	double KernelTimer::Best( uint runs, Reset reset, Func func )
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		double best = 0.0;
+		for( uint run = 0; run < runs; ++run )
+		{
+			reset();
+
+			const Clock::time_point start = Clock::now();
+			func();
+			const double ms = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+
+			best = ( run == 0 ) ? ms : std::min( best, ms );
+		}
+
+		return best;
+	}
+
+	//------------------------------------------------------------------------------
+	//The densities are a gradient with sources everywhere, and the velocities a
+	//vortex around the centre that every run starts from again
+	template< template< uint, uint > class Layout >
+	void KernelTimer::Run( const char* name, uint size )
+	{
+		typedef FluidSimT< float, DYNAMIC_SIZE, DYNAMIC_SIZE, Layout > Sim;
+
+		Sim sim( size, size, VISCOSITY, DIFFUSION, DECAY );
+		sim.SetGravity( 0.0f, GRAVITY );
+
+		const uint num_cells	= sim.NumCells();
+		const float dt			= TIME_DELTA;
+		const float speed		= VORTEX_CELLS / (dt * size);
+		const float centre		= size / 2.0f;
+
+		std::vector<float> vortex_u( num_cells, 0.0f );
+		std::vector<float> vortex_v( num_cells, 0.0f );
+		std::vector<float> pressure( num_cells, 0.0f );
+		std::vector<float> divergence( num_cells, 0.0f );
+
+		for( uint y = 0; y < size; ++y )
+		{
+			for( uint x = 0; x < size; ++x )
+			{
+				const uint i		= sim.IDX( x, y );
+				const float dx		= x - centre;
+				const float dy		= y - centre;
+				const float radius	= std::max( std::sqrt( dx*dx + dy*dy ), 1.0f );
+
+				vortex_u[i] = -speed * dy / radius;
+				vortex_v[i] = speed * dx / radius;
+
+				for( uint channel = 0; channel < 3; ++channel )
+				{
+					sim.mDensities[ (i * Sim::CHANNELS) + channel ]	= (float)( (x + y + channel) % size ) / size;
+					sim.mSources[ (i * Sim::CHANNELS) + channel ]		= SOURCE_DENSITY / size;
+				}
+			}
+		}
+
+		const size_t velocity_bytes = num_cells * sizeof(float);
+
+		const uint runs = std::max( (KERNEL_RUNS * 256 * 256) / (size * size), MIN_KERNEL_RUNS );
+
+		const auto reset = [&]()
+		{
+			memcpy( sim.mVelocitiesU, &vortex_u[0], velocity_bytes );
+			memcpy( sim.mVelocitiesV, &vortex_v[0], velocity_bytes );
+			memcpy( sim.mVelocitiesU0, &vortex_u[0], velocity_bytes );
+			memcpy( sim.mVelocitiesV0, &vortex_v[0], velocity_bytes );
+		};
+
+		const double sources = Best( runs, reset, [&]()
+		{
+			sim.AddSources( sim.mDensities, sim.mSources, dt, Sim::CHANNELS );
+		} );
+
+		const double forces = Best( runs, reset, [&]()
+		{
+			sim.AddForces( sim.mVelocitiesU, sim.mVelocitiesV, sim.mVelocitiesU0, sim.mVelocitiesV0, dt );
+		} );
+
+		const double diffuse = Best( runs, reset, [&]()
+		{
+			sim.Diffuse( 0, sim.mDensities0, sim.mDensities, sim.mDiffusion, dt, Sim::CHANNELS );
+		} );
+
+		const double advect_density = Best( runs, reset, [&]()
+		{
+			sim.AdvectDensity( sim.mDensities, sim.mDensities0, sim.mVelocitiesU0, sim.mVelocitiesV0, sim.mDecay * dt, dt );
+		} );
+
+		const double advect_velocity = Best( runs, reset, [&]()
+		{
+			sim.AdvectVelocity( sim.mVelocitiesU, sim.mVelocitiesV, sim.mVelocitiesU0, sim.mVelocitiesV0, dt );
+		} );
+
+		const double project = Best( runs, reset, [&]()
+		{
+			sim.Project( sim.mVelocitiesU, sim.mVelocitiesV, &pressure[0], &divergence[0] );
+		} );
+
+		printf( "  %4u  %-7s %8.2f %7.2f %8.2f %8.2f %9.2f %7.2f\n", size, name, sources, forces, diffuse, advect_density, advect_velocity, project );
+	}
+
+	//------------------------------------------------------------------------------
+	//Every solver starts from zero on the same pressure system, Project's for the
+	//velocities the scene leaves after a few steps. Each is run for a range of
+	//iteration counts and the residual is FluidSim's RelativeResidual, which the
+	//timings include once, as they do under a tolerance policy. Convergence is the
+	//factor the residual fell by, in decimal digits per millisecond.
+	void KernelTimer::TimeSolvers( uint size )
+	{
+		struct SolverRun
+		{
+			FluidSim::Solver	mSolver;
+			const char*			mName;
+			uint				mIterations[4];
+		};
+
+		const SolverRun solvers[] =
+		{
+			{ FluidSim::SOLVER_GAUSS_SEIDEL,	"gauss-seidel",		{ 10, 40, 160, 640 } },
+			{ FluidSim::SOLVER_MULTIGRID_V,		"multigrid V",		{ 1, 2, 4, 8 } },
+			{ FluidSim::SOLVER_MULTIGRID_F,		"multigrid F",		{ 1, 2, 4, 8 } },
+			{ FluidSim::SOLVER_JACOBI_CHEBYSHEV,	"chebyshev-jacobi",	{ 10, 40, 160, 640 } },
+		};
+
+		printf( "Pressure solve convergence, %ux%u, best of %u\n", size, size, SOLVER_RUNS );
+		printf( "  solver            iterations       ms   residual  digits/ms\n" );
+
+		FluidSim sim( size, size, VISCOSITY, DIFFUSION, DECAY );
+		Simulate( sim, size, size, PUSH_INTERVAL );
+
+		const size_t bytes = sim.mNumCells * sizeof(float);
+		std::vector<float> u( sim.mNumCells ), v( sim.mNumCells ), p( sim.mNumCells ), div( sim.mNumCells );
+
+		for( uint s = 0; s < sizeof(solvers) / sizeof(solvers[0]); ++s )
+		{
+			sim.SetPressureSolver( solvers[s].mSolver );
+
+			for( uint k = 0; k < 4; ++k )
+			{
+				const uint iterations = solvers[s].mIterations[k];
+				sim.SetPressurePolicy( FluidSim::SolverPolicy::Tolerance( 0.0f, iterations, iterations ) );
+
+				double best = 0.0;
+				for( uint run = 0; run < SOLVER_RUNS; ++run )
+				{
+					//Project writes back the velocities, so every run starts from the scene's
+					memcpy( &u[0], sim.mVelocitiesU, bytes );
+					memcpy( &v[0], sim.mVelocitiesV, bytes );
+
+					//Chebyshev tunes itself for as many iterations as the last solve ran, which here it's told
+					const FluidSim::SolverStats none = {};
+					sim.mPressureStats = none;
+					sim.mPressureIterations[0] = 0;
+					sim.Project( &u[0], &v[0], &p[0], &div[0], 0 );
+
+					best = ( run == 0 ) ? sim.mPressureStats.mMilliseconds : std::min( best, (double)sim.mPressureStats.mMilliseconds );
+				}
+
+				const float residual = sim.mPressureStats.mResidual;
+				printf( "  %-17s %10u %8.2f   %.2e %10.3f\n", solvers[s].mName, iterations, best, residual, -std::log10( residual ) / best );
+			}
+		}
+
+		printf( "\n" );
+	}
+
+	//------------------------------------------------------------------------------
+	//Advect on its own, moving both velocity components along the timings' vortex
+	//as VelocityStep does, with each instruction set's kernel on one thread
+	void KernelTimer::TimeAdvect( uint size )
+	{
+		FluidSim sim( size, size, VISCOSITY, DIFFUSION, DECAY );
+		sim.SetThreadCount( 1 );
+		SetVortex( sim, size, VORTEX_CELLS );
+
+		const int b[]			= { 1, 2 };
+		float* const d[]		= { sim.mVelocitiesU, sim.mVelocitiesV };
+		float* const d0[]		= { sim.mVelocitiesU0, sim.mVelocitiesV0 };
+		const Simd::Level levels[] = { Simd::LEVEL_SCALAR, Simd::LEVEL_SSE2, Simd::LEVEL_AVX2 };
+		const uint runs = std::max( (ADVECT_RUNS * 512 * 512) / (size * size), MIN_ADVECT_RUNS );
+
+		double ms[3];
+		for( uint l = 0; l < 3; ++l )
+		{
+			if( levels[l] > Simd::DetectLevel() )
+			{
+				ms[l] = 0.0;
+				continue;
+			}
+
+			sim.SetSimdLevel( levels[l] );
+			ms[l] = Best( runs, [](){}, [&]()
+			{
+				sim.Advect( b, d, d0, 2, sim.mVelocitiesU0, sim.mVelocitiesV0, TIME_DELTA );
+			} );
+		}
+
+		printf( "  %4u  %8.2f", size, ms[0] );
+		for( uint l = 1; l < 3; ++l )
+		{
+			if( ms[l] > 0.0 )
+			{
+				printf( " %8.2f %5.2fx", ms[l], ms[0] / ms[l] );
+			}
+			else
+			{
+				printf( " %8s %6s", "n/a", "" );
+			}
+		}
+		printf( "\n" );
+	}
+
+	//------------------------------------------------------------------------------
+	//The velocity components' Advect along the vortex, with plain spans then
+	//blocked ones. Misses are counted over one more run after the timed ones.
+	void KernelTimer::TimeBlockedAdvect( uint size, float cells )
+	{
+		FluidSim sim( size, size, VISCOSITY, DIFFUSION, DECAY );
+		sim.SetThreadCount( 1 );
+		SetVortex( sim, size, cells );
+
+		const int b[]			= { 1, 2 };
+		float* const d[]		= { sim.mVelocitiesU, sim.mVelocitiesV };
+		float* const d0[]		= { sim.mVelocitiesU0, sim.mVelocitiesV0 };
+		const double num_cells	= (double)size * size;
+
+		PerfCounters counters;
+		for( uint blocked = 0; blocked < 2; ++blocked )
+		{
+			sim.SetBlockedAdvection( blocked != 0 );
+
+			const double ms = Best( FAST_VORTEX_RUNS, [](){}, [&]()
+			{
+				sim.Advect( b, d, d0, 2, sim.mVelocitiesU0, sim.mVelocitiesV0, TIME_DELTA );
+			} );
+
+			counters.Start();
+			sim.Advect( b, d, d0, 2, sim.mVelocitiesU0, sim.mVelocitiesV0, TIME_DELTA );
+			counters.Stop();
+
+			printf( "  %10g  %7s %9.2f", cells, blocked ? "yes" : "no", ms );
+			for( uint c = 0; c < PerfCounters::NUM_COUNTERS; ++c )
+			{
+				const long long misses = counters.Read( (PerfCounters::Counter)c );
+				if( misses >= 0 )
+				{
+					printf( " %9.4f", misses / num_cells );
+				}
+				else
+				{
+					printf( " %9s", "n/a" );
+				}
+			}
+			printf( "\n" );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	//A vortex around the centre in U0 and V0, moving each cell the given number of
+	//cells a step
+	void KernelTimer::SetVortex( FluidSim& sim, uint size, float cells )
+	{
+		const float speed	= cells / (TIME_DELTA * size);
+		const float centre	= size / 2.0f;
+
+		for( uint y = 0; y < size; ++y )
+		{
+			for( uint x = 0; x < size; ++x )
+			{
+				const float dx		= x - centre;
+				const float dy		= y - centre;
+				const float radius	= std::max( std::sqrt( dx*dx + dy*dy ), 1.0f );
+
+				sim.mVelocitiesU0[ sim.IDX( x, y ) ] = -speed * dy / radius;
+				sim.mVelocitiesV0[ sim.IDX( x, y ) ] = speed * dx / radius;
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	//Both velocity components of every cell, row by row
+	void KernelTimer::ReadVelocities( const FluidSim& sim, std::vector<double>& out_velocities )
+	{
+		out_velocities.clear();
+		for( uint y = 0; y < sim.mSizeY; ++y )
+		{
+			for( uint x = 0; x < sim.mSizeX; ++x )
+			{
+				out_velocities.push_back( sim.mVelocitiesU[ sim.IDX( x, y ) ] );
+				out_velocities.push_back( sim.mVelocitiesV[ sim.IDX( x, y ) ] );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	//Advects the slotted disk through one turn of a solid rotation, between the
+	//two pressure grids. The velocities don't change so they're set once.
+	double KernelTimer::TurnDisk( uint size, FluidSim::AdvectionScheme scheme, double& out_ms )
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		FluidSim sim( size, size, VISCOSITY, DIFFUSION, DECAY );
+		sim.SetThreadCount( 1 );
+		sim.SetAdvectionScheme( scheme );
+
+		const uint steps	= DISK_STEPS * size;
+		const float omega	= 2.0f * 3.14159265f / (steps * TIME_DELTA);
+		const float centre	= (size - 1) / 2.0f;
+
+		float* d0	= sim.mPressures[0];
+		float* d	= sim.mPressures[1];
+
+		for( uint y = 0; y < size; ++y )
+		{
+			for( uint x = 0; x < size; ++x )
+			{
+				sim.mVelocitiesU0[ sim.IDX( x, y ) ] = -omega * (y - centre) / size;
+				sim.mVelocitiesV0[ sim.IDX( x, y ) ] = omega * (x - centre) / size;
+				d0[ sim.IDX( x, y ) ] = SlottedDisk( x, y, size );
+			}
+		}
+
+		const int b[] = { 0 };
+
+		const Clock::time_point start = Clock::now();
+		for( uint step = 0; step < steps; ++step )
+		{
+			sim.Advect( b, &d, &d0, 1, sim.mVelocitiesU0, sim.mVelocitiesV0, TIME_DELTA );
+			std::swap( d, d0 );
+		}
+		out_ms = std::chrono::duration<double, std::milli>( Clock::now() - start ).count();
+
+		std::vector<double> values;
+		std::vector<double> exact;
+		for( uint y = 1; y < size-1; ++y )
+		{
+			for( uint x = 1; x < size-1; ++x )
+			{
+				values.push_back( d0[ sim.IDX( x, y ) ] );
+				exact.push_back( SlottedDisk( x, y, size ) );
+			}
+		}
+
+		return RelativeL2( values, exact );
+	}
+
+	//------------------------------------------------------------------------------
+	bool Run()
+	{
+		bool passed = true;
+		passed &= CheckTemplates();
+		CheckPrecision();
+		passed &= CheckEnsemble();
+		passed &= CheckSmallGrids();
+		KernelTimer::TimeSolvers( SOLVER_SIZE );
+		TimeThreads();
+		TimeAdvectKernels();
+		TimeFastVortex();
+		TimeAdvectionQuality();
+		TimeLayouts();
+
+		printf( passed ? "All checks passed\n" : "Some checks FAILED\n" );
+		return passed;
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+
+//Checks and timings for the alternative simulations, run with -benchmark
+//instead of opening the window. Everything is printed to stdout.
+namespace Benchmark
+{
+	//Returns false if any of the checks failed
+	bool Run();
+}
+
+
+#endif //BENCHMARK_H
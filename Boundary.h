@@ -0,0 +1,102 @@
+#ifndef BOUNDARY_H
+#define BOUNDARY_H
+
+
+#include "types.h"
+
+
+//Fills the ghost cells that copy interior row y: the two side cells of the row,
+//plus the whole top or bottom ghost row when y is the first or last interior
+//row. B has the same meaning as b in SetBoundary, as a template parameter the
+//choice between copying and mirroring is made at compile time rather than per
+//cell. Rows start stride cells apart.
+//Each ghost cell is only read by the interior cell it copies, so a solver can
+//refresh a row's ghost cells as soon as it has updated the row instead of
+//making a separate pass once the sweep is done.
+template< int B, typename T >
+inline void SetBoundaryRow( T* d, uint size_x, uint size_y, uint stride, uint y, uint channels = 1 )
+{
+	const uint row_stride = stride * channels;
+	const uint row = y * row_stride;
+	const uint last_column = (size_x-1) * channels;
+
+	for( uint ch = 0; ch < channels; ++ch )
+	{
+		d[row + ch]					= T( B==1 ? -d[row + channels + ch]				: d[row + channels + ch] );
+		d[row + last_column + ch]	= T( B==1 ? -d[row + last_column - channels + ch]	: d[row + last_column - channels + ch] );
+	}
+
+	if( y == 1 )
+	{
+		for( uint i = channels; i < last_column; ++i )
+		{
+			d[i] = T( B==2 ? -d[row + i] : d[row + i] );
+		}
+	}
+
+	if( y == size_y-2 )
+	{
+		for( uint i = channels; i < last_column; ++i )
+		{
+			d[row + row_stride + i] = T( B==2 ? -d[row + i] : d[row + i] );
+		}
+	}
+}
+
+template< typename T >
+inline void SetBoundaryRow( int b, T* d, uint size_x, uint size_y, uint stride, uint y, uint channels = 1 )
+{
+	switch( b )
+	{
+	case 1:		SetBoundaryRow<1>( d, size_x, size_y, stride, y, channels );	break;
+	case 2:		SetBoundaryRow<2>( d, size_x, size_y, stride, y, channels );	break;
+	default:	SetBoundaryRow<0>( d, size_x, size_y, stride, y, channels );	break;
+	}
+}
+
+//The corners average their two ghost neighbours, and no interior cell reads them
+template< typename T >
+inline void SetBoundaryCorners( T* d, uint size_x, uint size_y, uint stride, uint channels = 1 )
+{
+	const uint row_stride = stride * channels;
+	const uint last_row = (size_y-1) * row_stride;
+	const uint last_column = (size_x-1) * channels;
+
+	for( uint ch = 0; ch < channels; ++ch )
+	{
+		d[ch]							= T( 0.5f*(d[channels + ch]							+ d[row_stride + ch]) );
+		d[last_row + ch]				= T( 0.5f*(d[last_row + channels + ch]					+ d[last_row - row_stride + ch]) );
+		d[last_column + ch]				= T( 0.5f*(d[last_column - channels + ch]				+ d[row_stride + last_column + ch]) );
+		d[last_row + last_column + ch]	= T( 0.5f*(d[last_row + last_column - channels + ch]	+ d[last_row - row_stride + last_column + ch]) );
+	}
+}
+
+template< int B, typename T >
+inline void SetBoundary( T* d, uint size_x, uint size_y, uint stride, uint channels = 1 )
+{
+	for( uint y = 1; y < (size_y-1); ++y )
+	{
+		SetBoundaryRow<B>( d, size_x, size_y, stride, y, channels );
+	}
+
+	SetBoundaryCorners( d, size_x, size_y, stride, channels );
+}
+
+//Fills the ghost cells around a grid. b == 1 and b == 2 mirror the x and y
+//velocity components so they vanish at the walls, anything else is a
+//Neumann (zero gradient) boundary. Interleaved grids store channels values
+//per cell and every channel gets the same boundary. T is float or one of the
+//16 bit formats in Half.h.
+template< typename T >
+inline void SetBoundary( int b, T* d, uint size_x, uint size_y, uint stride, uint channels = 1 )
+{
+	switch( b )
+	{
+	case 1:		SetBoundary<1>( d, size_x, size_y, stride, channels );	break;
+	case 2:		SetBoundary<2>( d, size_x, size_y, stride, channels );	break;
+	default:	SetBoundary<0>( d, size_x, size_y, stride, channels );	break;
+	}
+}
+
+
+#endif //BOUNDARY_H
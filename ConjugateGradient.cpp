@@ -0,0 +1,352 @@
+#include "ConjugateGradient.h"
+#include "Boundary.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+//------------------------------------------------------------------------------
+const static uint  PRECONDITIONER_CACHE_SIZE	= 4;
+const static float MIC_TUNING					= 0.97f;
+const static float MIC_SAFETY					= 0.25f;
+
+//------------------------------------------------------------------------------
+ConjugateGradient::ConjugateGradient( uint size_x, uint size_y, uint stride )
+	:	mSizeX( size_x )
+	,	mSizeY( size_y )
+	,	mStride( stride )
+	,	mResidual( stride * size_y, 0.0f )
+	,	mAuxiliary( stride * size_y, 0.0f )
+	,	mSearch( stride * size_y, 0.0f )
+	,	mProduct( stride * size_y, 0.0f )
+	,	mNextPreconditioner( 0 )
+	,	mLastResidual( 0.0f )
+{
+}
+
+//------------------------------------------------------------------------------
+uint ConjugateGradient::Solve( int b, float* x, const float* x0, float a, float c, float tolerance, uint max_iterations, Preconditioner preconditioner, float time_budget )
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	const uint sx = mStride;
+	float* r = &mResidual[ 0 ];
+	float* z = &mAuxiliary[ 0 ];
+	float* s = &mSearch[ 0 ];
+	float* q = &mProduct[ 0 ];
+
+	const float* precon = GetPreconditioner( preconditioner, b, a, c );
+
+	//The pressure system only fixes x up to a constant, so solve for the part of x0 it can reach
+	const bool singular = ( b != 1 && b != 2 && c == 4.0f*a );
+
+	Multiply( b, q, x, a, c );
+	for( uint y = 1; y < (mSizeY-1); ++y )
+	{
+		for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+		{
+			r[i] = x0[i] - q[i];
+		}
+	}
+
+	if( singular )
+	{
+		RemoveMean( r );
+	}
+
+	const double target = (double)tolerance * tolerance * Dot( x0, x0 );
+	double rr = Dot( r, r );
+
+	uint k = 0;
+	if( rr > target )
+	{
+		ApplyPreconditioner( preconditioner, precon, z, r, a );
+		for( uint y = 1; y < (mSizeY-1); ++y )
+		{
+			for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+			{
+				s[i] = z[i];
+			}
+		}
+
+		double rho = Dot( r, z );
+
+		while( k < max_iterations )
+		{
+			++k;
+
+			Multiply( b, q, s, a, c );
+
+			const double sq = Dot( s, q );
+			if( sq <= 0.0 )
+			{
+				break;
+			}
+
+			const float alpha = (float)( rho / sq );
+			for( uint y = 1; y < (mSizeY-1); ++y )
+			{
+				for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+				{
+					x[i] += alpha * s[i];
+					r[i] -= alpha * q[i];
+				}
+			}
+
+			rr = Dot( r, r );
+			if( rr <= target )
+			{
+				break;
+			}
+
+			if( time_budget > 0.0f && std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() - start ).count() >= time_budget )
+			{
+				break;
+			}
+
+			ApplyPreconditioner( preconditioner, precon, z, r, a );
+
+			const double rho_new = Dot( r, z );
+			const float beta = (float)( rho_new / rho );
+			rho = rho_new;
+
+			for( uint y = 1; y < (mSizeY-1); ++y )
+			{
+				for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+				{
+					s[i] = z[i] + beta * s[i];
+				}
+			}
+		}
+	}
+
+	const double bb = Dot( x0, x0 );
+	mLastResidual = bb > 0.0 ? (float)std::sqrt( rr / bb ) : 0.0f;
+
+	SetBoundary( b, x, mSizeX, mSizeY, mStride );
+
+	return k;
+}
+
+//------------------------------------------------------------------------------
+template< typename Rhs >
+uint ConjugateGradient::SolveInterleaved( int b, float* x, const Rhs* x0, uint channels, float a, float c, float tolerance, uint max_iterations, Preconditioner preconditioner, float time_budget )
+{
+	const uint num_points = mStride * mSizeY;
+
+	//The channel workspaces are only needed for interleaved grids
+	mChannelX.resize( num_points );
+	mChannelX0.resize( num_points );
+
+	uint iterations = 0;
+	float worst_residual = 0.0f;
+
+	for( uint ch = 0; ch < channels; ++ch )
+	{
+		for( uint i = 0; i < num_points; ++i )
+		{
+			mChannelX[i]	= x[(i * channels) + ch];
+			mChannelX0[i]	= x0[(i * channels) + ch];
+		}
+
+		iterations += Solve( b, &mChannelX[ 0 ], &mChannelX0[ 0 ], a, c, tolerance, max_iterations, preconditioner, time_budget / channels );
+		worst_residual = std::max( worst_residual, mLastResidual );
+
+		for( uint i = 0; i < num_points; ++i )
+		{
+			x[(i * channels) + ch] = mChannelX[i];
+		}
+	}
+
+	mLastResidual = worst_residual;
+
+	return iterations;
+}
+
+template uint ConjugateGradient::SolveInterleaved( int, float*, const float*, uint, float, float, float, uint, Preconditioner, float );
+template uint ConjugateGradient::SolveInterleaved( int, float*, const Half::Float16*, uint, float, float, float, uint, Preconditioner, float );
+template uint ConjugateGradient::SolveInterleaved( int, float*, const Half::BFloat16*, uint, float, float, float, uint, Preconditioner, float );
+
+//------------------------------------------------------------------------------
+void ConjugateGradient::Multiply( int b, float* out, float* in, float a, float c )
+{
+	const uint sx = mStride;
+
+	//Ghost cells fold the boundary conditions into the operator's diagonal
+	SetBoundary( b, in, mSizeX, mSizeY, mStride );
+
+	for( uint y = 1; y < (mSizeY-1); ++y )
+	{
+		for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+		{
+			out[i] = c*in[i] - a*(in[i-1] + in[i+1] + in[i-sx] + in[i+sx]);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void ConjugateGradient::ApplyPreconditioner( Preconditioner preconditioner, const float* precon, float* out, const float* in, float a )
+{
+	const uint sx = mStride;
+
+	switch( preconditioner )
+	{
+	case PRECONDITIONER_JACOBI:
+		for( uint y = 1; y < (mSizeY-1); ++y )
+		{
+			for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+			{
+				out[i] = in[i] * precon[i];
+			}
+		}
+		break;
+
+	case PRECONDITIONER_MIC:
+		//Forward substitution with L then backward with L transpose. The preconditioner and the
+		//output are never written in the ghost cells, so the boundary rows need no special casing
+		for( uint y = 1; y < (mSizeY-1); ++y )
+		{
+			for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+			{
+				const float t = in[i] + a*(precon[i-1]*out[i-1] + precon[i-sx]*out[i-sx]);
+				out[i] = t * precon[i];
+			}
+		}
+
+		for( uint y = mSizeY-2; y >= 1; --y )
+		{
+			for( uint i = (y * sx) + mSizeX-2; i >= (y * sx) + 1; --i )
+			{
+				const float t = out[i] + a*precon[i]*(out[i+1] + out[i+sx]);
+				out[i] = t * precon[i];
+			}
+		}
+		break;
+	}
+}
+
+//------------------------------------------------------------------------------
+const float* ConjugateGradient::GetPreconditioner( Preconditioner preconditioner, int b, float a, float c )
+{
+	for( uint n = 0; n < mPreconditioners.size(); ++n )
+	{
+		const PreconditionerCache& cache = mPreconditioners[ n ];
+		if( cache.mType == preconditioner && cache.mB == b && cache.mA == a && cache.mC == c )
+		{
+			return &cache.mValues[ 0 ];
+		}
+	}
+
+	//Replace the oldest entry once the cache is full
+	if( mPreconditioners.size() < PRECONDITIONER_CACHE_SIZE )
+	{
+		mPreconditioners.push_back( PreconditionerCache() );
+		mPreconditioners.back().mValues.resize( mStride * mSizeY, 0.0f );
+		mNextPreconditioner = (uint)mPreconditioners.size() - 1;
+	}
+
+	PreconditionerCache& cache = mPreconditioners[ mNextPreconditioner ];
+	mNextPreconditioner = (mNextPreconditioner + 1) % PRECONDITIONER_CACHE_SIZE;
+
+	cache.mType	= preconditioner;
+	cache.mB	= b;
+	cache.mA	= a;
+	cache.mC	= c;
+
+	const uint sx = mStride;
+	float* precon = &cache.mValues[ 0 ];
+
+	for( uint y = 1; y < (mSizeY-1); ++y )
+	{
+		for( uint x = 1; x < (mSizeX-1); ++x )
+		{
+			const uint i = (y * sx) + x;
+			const float diag = Diagonal( b, x, y, a, c );
+
+			if( preconditioner == PRECONDITIONER_JACOBI )
+			{
+				precon[i] = 1.0f / diag;
+				continue;
+			}
+
+			//Modified incomplete Cholesky, following Bridson's MIC(0)
+			const float px = a * precon[i-1];
+			const float py = a * precon[i-sx];
+
+			float e = diag - px*px - py*py;
+			e -= MIC_TUNING * ( ( y < (mSizeY-2) ? px*px : 0.0f ) + ( x < (mSizeX-2) ? py*py : 0.0f ) );
+
+			if( e < MIC_SAFETY * diag )
+			{
+				e = diag;
+			}
+
+			precon[i] = 1.0f / std::sqrt( e );
+		}
+	}
+
+	return precon;
+}
+
+//------------------------------------------------------------------------------
+float ConjugateGradient::Diagonal( int b, uint x, uint y, float a, float c ) const
+{
+	//A mirrored ghost cell adds a to the diagonal, a copied one removes it
+	const float wall_x = b==1 ? a : -a;
+	const float wall_y = b==2 ? a : -a;
+
+	float diag = c;
+
+	if( x == 1 )			diag += wall_x;
+	if( x == mSizeX-2 )		diag += wall_x;
+	if( y == 1 )			diag += wall_y;
+	if( y == mSizeY-2 )		diag += wall_y;
+
+	return diag;
+}
+
+//------------------------------------------------------------------------------
+double ConjugateGradient::Dot( const float* x, const float* y ) const
+{
+	const uint sx = mStride;
+	double sum = 0.0;
+
+	for( uint row = 1; row < (mSizeY-1); ++row )
+	{
+		float row_sum = 0.0f;
+
+		for( uint i = (row * sx) + 1; i < (row * sx) + mSizeX-1; ++i )
+		{
+			row_sum += x[i] * y[i];
+		}
+
+		sum += row_sum;
+	}
+
+	return sum;
+}
+
+//------------------------------------------------------------------------------
+void ConjugateGradient::RemoveMean( float* x ) const
+{
+	const uint sx = mStride;
+	double sum = 0.0;
+
+	for( uint y = 1; y < (mSizeY-1); ++y )
+	{
+		for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+		{
+			sum += x[i];
+		}
+	}
+
+	const float mean = (float)( sum / ((mSizeX-2) * (mSizeY-2)) );
+
+	for( uint y = 1; y < (mSizeY-1); ++y )
+	{
+		for( uint i = (y * sx) + 1; i < (y * sx) + mSizeX-1; ++i )
+		{
+			x[i] -= mean;
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef CONJUGATEGRADIENT_H
+#define CONJUGATEGRADIENT_H
+
+
+#include <vector>
+#include "Half.h"
+#include "types.h"
+
+
+//Matrix-free preconditioned conjugate gradient solver for the implicit systems
+//in FluidSim::Diffuse and FluidSim::Project, which both have the form
+//c*x - a*(sum of neighbours) = x0 with FluidSim's ghost cell boundaries.
+//Grids have rows stride cells apart, as FluidSim lays them out.
+class ConjugateGradient
+{
+public:
+	enum Preconditioner
+	{
+		PRECONDITIONER_JACOBI,
+		PRECONDITIONER_MIC,
+	};
+
+	ConjugateGradient( uint size_x, uint size_y, uint stride );
+
+	//Iterates until the residual falls below tolerance relative to x0, using x as
+	//the initial guess. A positive time_budget (milliseconds) also stops it once
+	//that much time has passed. Returns the number of iterations used.
+	uint Solve( int b, float* x, const float* x0, float a, float c, float tolerance, uint max_iterations, Preconditioner preconditioner, float time_budget );
+
+	//Solves each channel of a grid with channels interleaved floats per cell in
+	//turn. Returns the total number of iterations used.
+	//The time budget is split evenly between the channels. x0 can be float or
+	//either of the 16 bit formats.
+	template< typename Rhs >
+	uint SolveInterleaved( int b, float* x, const Rhs* x0, uint channels, float a, float c, float tolerance, uint max_iterations, Preconditioner preconditioner, float time_budget );
+
+	//Relative residual at the end of the last Solve
+	float GetLastResidual() const { return mLastResidual; }
+
+private:
+	struct PreconditionerCache
+	{
+		Preconditioner		mType;
+		int					mB;
+		float				mA;
+		float				mC;
+		std::vector<float>	mValues;
+	};
+
+	void Multiply( int b, float* out, float* in, float a, float c );
+	void ApplyPreconditioner( Preconditioner preconditioner, const float* precon, float* out, const float* in, float a );
+	const float* GetPreconditioner( Preconditioner preconditioner, int b, float a, float c );
+	float Diagonal( int b, uint x, uint y, float a, float c ) const;
+	double Dot( const float* x, const float* y ) const;
+	void RemoveMean( float* x ) const;
+
+private:
+	const uint	mSizeX;
+	const uint	mSizeY;
+	const uint	mStride;
+
+	std::vector<float>	mResidual;
+	std::vector<float>	mAuxiliary;
+	std::vector<float>	mSearch;
+	std::vector<float>	mProduct;
+	std::vector<float>	mChannelX;
+	std::vector<float>	mChannelX0;
+
+	std::vector<PreconditionerCache>	mPreconditioners;
+	uint								mNextPreconditioner;
+
+	float	mLastResidual;
+};
+
+
+#endif //CONJUGATEGRADIENT_H
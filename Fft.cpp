@@ -0,0 +1,541 @@
+#include "Fft.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#if defined(SIMD_X86)
+	#include <emmintrin.h>
+#endif
+
+//------------------------------------------------------------------------------
+const static double PI				= 3.14159265358979323846;
+const static uint   BLUESTEIN_CHUNK	= 16;		//Signals per inner transform
+
+//------------------------------------------------------------------------------
+static uint SmallestFactor( uint n )
+{
+	//Radix 4 first, it does two levels of radix 2 for little more than the cost of one
+	if( n % 4 == 0 )
+	{
+		return 4;
+	}
+
+	for( uint f = 2; f * f <= n; ++f )
+	{
+		if( n % f == 0 )
+		{
+			return f;
+		}
+	}
+
+	return n;
+}
+
+#if defined(SIMD_X86)
+//------------------------------------------------------------------------------
+//The butterflies work across the batch, so four signals fill an SSE register whatever the radix.
+//Each of these does the whole multiples of four and returns how many signals that was, the
+//scalar loops in Fft finish the rest.
+SIMD_TARGET_SSE2 static inline void ComplexMulSSE2( __m128 ar, __m128 ai, __m128 wr, __m128 wi, __m128& out_r, __m128& out_i )
+{
+	out_r = _mm_sub_ps( _mm_mul_ps( ar, wr ), _mm_mul_ps( ai, wi ) );
+	out_i = _mm_add_ps( _mm_mul_ps( ar, wi ), _mm_mul_ps( ai, wr ) );
+}
+
+//------------------------------------------------------------------------------
+SIMD_TARGET_SSE2 static uint Butterfly2SSE2( float w1r, float w1i, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch )
+{
+	const __m128 wr = _mm_set1_ps( w1r );
+	const __m128 wi = _mm_set1_ps( w1i );
+	const uint end = batch & ~3u;
+
+	for( uint b = 0; b < end; b += 4 )
+	{
+		__m128 a1r, a1i;
+		ComplexMulSSE2( _mm_loadu_ps( in_re + in_step + b ), _mm_loadu_ps( in_im + in_step + b ), wr, wi, a1r, a1i );
+
+		const __m128 a0r = _mm_loadu_ps( in_re + b );
+		const __m128 a0i = _mm_loadu_ps( in_im + b );
+
+		_mm_storeu_ps( out_re + b,				_mm_add_ps( a0r, a1r ) );
+		_mm_storeu_ps( out_im + b,				_mm_add_ps( a0i, a1i ) );
+		_mm_storeu_ps( out_re + out_step + b,	_mm_sub_ps( a0r, a1r ) );
+		_mm_storeu_ps( out_im + out_step + b,	_mm_sub_ps( a0i, a1i ) );
+	}
+
+	return end;
+}
+
+//------------------------------------------------------------------------------
+SIMD_TARGET_SSE2 static uint Butterfly4SSE2( const float* tw_re, const float* tw_im, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch )
+{
+	const __m128 w1r = _mm_set1_ps( tw_re[1] ), w1i = _mm_set1_ps( tw_im[1] );
+	const __m128 w2r = _mm_set1_ps( tw_re[2] ), w2i = _mm_set1_ps( tw_im[2] );
+	const __m128 w3r = _mm_set1_ps( tw_re[3] ), w3i = _mm_set1_ps( tw_im[3] );
+	const uint end = batch & ~3u;
+
+	for( uint b = 0; b < end; b += 4 )
+	{
+		const __m128 a0r = _mm_loadu_ps( in_re + b );
+		const __m128 a0i = _mm_loadu_ps( in_im + b );
+
+		__m128 a1r, a1i, a2r, a2i, a3r, a3i;
+		ComplexMulSSE2( _mm_loadu_ps( in_re + in_step + b ),	_mm_loadu_ps( in_im + in_step + b ),	w1r, w1i, a1r, a1i );
+		ComplexMulSSE2( _mm_loadu_ps( in_re + 2*in_step + b ),	_mm_loadu_ps( in_im + 2*in_step + b ),	w2r, w2i, a2r, a2i );
+		ComplexMulSSE2( _mm_loadu_ps( in_re + 3*in_step + b ),	_mm_loadu_ps( in_im + 3*in_step + b ),	w3r, w3i, a3r, a3i );
+
+		const __m128 t0r = _mm_add_ps( a0r, a2r ), t0i = _mm_add_ps( a0i, a2i );
+		const __m128 t1r = _mm_sub_ps( a0r, a2r ), t1i = _mm_sub_ps( a0i, a2i );
+		const __m128 t2r = _mm_add_ps( a1r, a3r ), t2i = _mm_add_ps( a1i, a3i );
+		const __m128 t3r = _mm_sub_ps( a1i, a3i ), t3i = _mm_sub_ps( a3r, a1r );
+
+		_mm_storeu_ps( out_re + b,					_mm_add_ps( t0r, t2r ) );
+		_mm_storeu_ps( out_im + b,					_mm_add_ps( t0i, t2i ) );
+		_mm_storeu_ps( out_re + out_step + b,		_mm_add_ps( t1r, t3r ) );
+		_mm_storeu_ps( out_im + out_step + b,		_mm_add_ps( t1i, t3i ) );
+		_mm_storeu_ps( out_re + 2*out_step + b,		_mm_sub_ps( t0r, t2r ) );
+		_mm_storeu_ps( out_im + 2*out_step + b,		_mm_sub_ps( t0i, t2i ) );
+		_mm_storeu_ps( out_re + 3*out_step + b,		_mm_sub_ps( t1r, t3r ) );
+		_mm_storeu_ps( out_im + 3*out_step + b,		_mm_sub_ps( t1i, t3i ) );
+	}
+
+	return end;
+}
+
+//------------------------------------------------------------------------------
+//sum += x w
+SIMD_TARGET_SSE2 static uint MultiplyAddSSE2( float w_re, float w_im, const float* x_re, const float* x_im, float* sum_re, float* sum_im, uint batch )
+{
+	const __m128 wr = _mm_set1_ps( w_re );
+	const __m128 wi = _mm_set1_ps( w_im );
+	const uint end = batch & ~3u;
+
+	for( uint b = 0; b < end; b += 4 )
+	{
+		__m128 pr, pi;
+		ComplexMulSSE2( _mm_loadu_ps( x_re + b ), _mm_loadu_ps( x_im + b ), wr, wi, pr, pi );
+
+		_mm_storeu_ps( sum_re + b, _mm_add_ps( _mm_loadu_ps( sum_re + b ), pr ) );
+		_mm_storeu_ps( sum_im + b, _mm_add_ps( _mm_loadu_ps( sum_im + b ), pi ) );
+	}
+
+	return end;
+}
+#endif
+
+//------------------------------------------------------------------------------
+Fft::Fft( uint n )
+	:	mLength( n )
+	,	mInner( NULL )
+{
+	assert( n > 0 );
+
+	//Factor the length, switching to Bluestein if a prime is too large for a direct pass
+	std::vector<uint> radices;
+	for( uint rest = n; rest > 1; )
+	{
+		const uint radix = SmallestFactor( rest );
+		if( radix > MAX_RADIX )
+		{
+			radices.clear();
+			break;
+		}
+
+		radices.push_back( radix );
+		rest /= radix;
+	}
+
+	if( n > 1 && radices.empty() )
+	{
+		uint inner = 1;
+		while( inner < (2*n - 1) )
+		{
+			inner *= 2;
+		}
+
+		mInner = new Fft( inner );
+
+		mChirpRe.resize( n );
+		mChirpIm.resize( n );
+		mKernelRe.assign( inner, 0.0f );
+		mKernelIm.assign( inner, 0.0f );
+
+		for( uint k = 0; k < n; ++k )
+		{
+			//k^2 taken modulo 2n first keeps the angle accurate for long transforms
+			const double angle = -PI * (double)( ((unsigned long long)k * k) % (2ull * n) ) / n;
+			mChirpRe[k] = (float)cos( angle );
+			mChirpIm[k] = (float)sin( angle );
+
+			mKernelRe[k] = (float)( cos( angle ) / inner );
+			mKernelIm[k] = (float)( -sin( angle ) / inner );
+
+			if( k > 0 )
+			{
+				mKernelRe[ inner-k ] = mKernelRe[k];
+				mKernelIm[ inner-k ] = mKernelIm[k];
+			}
+		}
+
+		mInner->Forward( &mKernelRe[0], &mKernelIm[0], 1 );
+		return;
+	}
+
+	uint span = 1;
+	for( uint r = 0; r < radices.size(); ++r )
+	{
+		Pass pass;
+		pass.mRadix	= radices[r];
+		pass.mSpan	= span;
+
+		pass.mTwiddleRe.resize( span * pass.mRadix );
+		pass.mTwiddleIm.resize( span * pass.mRadix );
+
+		for( uint k = 0; k < span; ++k )
+		{
+			for( uint q = 0; q < pass.mRadix; ++q )
+			{
+				const double angle = -2.0 * PI * (double)( q * k ) / (double)( span * pass.mRadix );
+				pass.mTwiddleRe[ (k * pass.mRadix) + q ] = (float)cos( angle );
+				pass.mTwiddleIm[ (k * pass.mRadix) + q ] = (float)sin( angle );
+			}
+		}
+
+		if( pass.mRadix > 4 )
+		{
+			pass.mRootRe.resize( pass.mRadix );
+			pass.mRootIm.resize( pass.mRadix );
+
+			for( uint q = 0; q < pass.mRadix; ++q )
+			{
+				const double angle = -2.0 * PI * (double)q / (double)pass.mRadix;
+				pass.mRootRe[q] = (float)cos( angle );
+				pass.mRootIm[q] = (float)sin( angle );
+			}
+		}
+
+		mPasses.push_back( pass );
+		span *= pass.mRadix;
+	}
+}
+
+//------------------------------------------------------------------------------
+Fft::~Fft()
+{
+	delete mInner;	mInner = NULL;
+}
+
+//------------------------------------------------------------------------------
+void Fft::Forward( float* re, float* im, uint batch )
+{
+	if( mInner != NULL )
+	{
+		RunBluestein( re, im, batch );
+	}
+	else
+	{
+		RunPasses( re, im, batch );
+	}
+}
+
+//------------------------------------------------------------------------------
+void Fft::Inverse( float* re, float* im, uint batch )
+{
+	//The conjugate of the forward transform of the conjugate
+	const uint count = mLength * batch;
+
+	for( uint i = 0; i < count; ++i )
+	{
+		im[i] = -im[i];
+	}
+
+	Forward( re, im, batch );
+
+	for( uint i = 0; i < count; ++i )
+	{
+		im[i] = -im[i];
+	}
+}
+
+//------------------------------------------------------------------------------
+//Stockham autosort, each pass reads one buffer and writes the other in an order that leaves
+//the result in natural order at the end, so there's no bit reversal
+void Fft::RunPasses( float* re, float* im, uint batch )
+{
+	const uint count = mLength * batch;
+	if( mWorkRe.size() < count )
+	{
+		mWorkRe.resize( count );
+		mWorkIm.resize( count );
+	}
+
+	float* src_re = re;
+	float* src_im = im;
+	float* dst_re = &mWorkRe[0];
+	float* dst_im = &mWorkIm[0];
+
+	for( uint p = 0; p < mPasses.size(); ++p )
+	{
+		const Pass& pass = mPasses[p];
+		const uint radix = pass.mRadix;
+		const uint span = pass.mSpan;
+		const uint groups = mLength / radix;
+
+		for( uint j = 0; j < groups; ++j )
+		{
+			//Input q of butterfly j is element j + q*groups, output q lands span elements apart
+			const uint k = j % span;
+			const uint in = j * batch;
+			const uint out = ((((j / span) * span * radix) + k) * batch);
+
+			switch( radix )
+			{
+			case 2:		Butterfly2( pass, k, src_re + in, src_im + in, groups * batch, dst_re + out, dst_im + out, span * batch, batch );	break;
+			case 3:		Butterfly3( pass, k, src_re + in, src_im + in, groups * batch, dst_re + out, dst_im + out, span * batch, batch );	break;
+			case 4:		Butterfly4( pass, k, src_re + in, src_im + in, groups * batch, dst_re + out, dst_im + out, span * batch, batch );	break;
+			default:	ButterflyN( pass, k, src_re + in, src_im + in, groups * batch, dst_re + out, dst_im + out, span * batch, batch );	break;
+			}
+		}
+
+		std::swap( src_re, dst_re );
+		std::swap( src_im, dst_im );
+	}
+
+	if( src_re != re )
+	{
+		memcpy( re, src_re, count * sizeof(float) );
+		memcpy( im, src_im, count * sizeof(float) );
+	}
+}
+
+//------------------------------------------------------------------------------
+//X_k = c_k (sum of x_j c_j conj(c_(k-j))), a convolution that the power of two inner transform does.
+//The padded signals are more than twice as long as the batch, so they're done a few at a time to stay in cache.
+void Fft::RunBluestein( float* re, float* im, uint batch )
+{
+	const uint inner = mInner->GetLength();
+	const uint chunk = std::min( batch, BLUESTEIN_CHUNK );
+	if( mPaddedRe.size() < (inner * chunk) )
+	{
+		mPaddedRe.resize( inner * chunk );
+		mPaddedIm.resize( inner * chunk );
+	}
+
+	float* padded_re = &mPaddedRe[0];
+	float* padded_im = &mPaddedIm[0];
+
+	for( uint first = 0; first < batch; first += chunk )
+	{
+		const uint count = std::min( chunk, batch - first );
+
+		for( uint k = 0; k < mLength; ++k )
+		{
+			const float cr = mChirpRe[k];
+			const float ci = mChirpIm[k];
+			const float* x_re = re + (k * batch) + first;
+			const float* x_im = im + (k * batch) + first;
+			float* y_re = padded_re + (k * count);
+			float* y_im = padded_im + (k * count);
+
+			for( uint b = 0; b < count; ++b )
+			{
+				y_re[b] = (x_re[b] * cr) - (x_im[b] * ci);
+				y_im[b] = (x_re[b] * ci) + (x_im[b] * cr);
+			}
+		}
+
+		memset( padded_re + (mLength * count), 0, (inner - mLength) * count * sizeof(float) );
+		memset( padded_im + (mLength * count), 0, (inner - mLength) * count * sizeof(float) );
+
+		mInner->Forward( padded_re, padded_im, count );
+
+		for( uint k = 0; k < inner; ++k )
+		{
+			const float kr = mKernelRe[k];
+			const float ki = mKernelIm[k];
+			float* y_re = padded_re + (k * count);
+			float* y_im = padded_im + (k * count);
+
+			for( uint b = 0; b < count; ++b )
+			{
+				const float r = y_re[b];
+				y_re[b] = (r * kr) - (y_im[b] * ki);
+				y_im[b] = (r * ki) + (y_im[b] * kr);
+			}
+		}
+
+		mInner->Inverse( padded_re, padded_im, count );
+
+		for( uint k = 0; k < mLength; ++k )
+		{
+			const float cr = mChirpRe[k];
+			const float ci = mChirpIm[k];
+			const float* y_re = padded_re + (k * count);
+			const float* y_im = padded_im + (k * count);
+			float* x_re = re + (k * batch) + first;
+			float* x_im = im + (k * batch) + first;
+
+			for( uint b = 0; b < count; ++b )
+			{
+				x_re[b] = (y_re[b] * cr) - (y_im[b] * ci);
+				x_im[b] = (y_re[b] * ci) + (y_im[b] * cr);
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void Fft::Butterfly2( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch )
+{
+	const float w1r = pass.mTwiddleRe[ (k * 2) + 1 ];
+	const float w1i = pass.mTwiddleIm[ (k * 2) + 1 ];
+
+	const float* in1_re = in_re + in_step;
+	const float* in1_im = in_im + in_step;
+	float* out1_re = out_re + out_step;
+	float* out1_im = out_im + out_step;
+
+	uint b = 0;
+#if defined(SIMD_X86)
+	b = Butterfly2SSE2( w1r, w1i, in_re, in_im, in_step, out_re, out_im, out_step, batch );
+#endif
+
+	for( ; b < batch; ++b )
+	{
+		const float a1r = (in1_re[b] * w1r) - (in1_im[b] * w1i);
+		const float a1i = (in1_re[b] * w1i) + (in1_im[b] * w1r);
+
+		const float a0r = in_re[b];
+		const float a0i = in_im[b];
+
+		out_re[b]	= a0r + a1r;
+		out_im[b]	= a0i + a1i;
+		out1_re[b]	= a0r - a1r;
+		out1_im[b]	= a0i - a1i;
+	}
+}
+
+//------------------------------------------------------------------------------
+void Fft::Butterfly3( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch )
+{
+	const float* tw_re = &pass.mTwiddleRe[ k * 3 ];
+	const float* tw_im = &pass.mTwiddleIm[ k * 3 ];
+	const float w1r = tw_re[1], w1i = tw_im[1];
+	const float w2r = tw_re[2], w2i = tw_im[2];
+
+	//e^(-2 pi i/3) = -1/2 - i sqrt(3)/2
+	const float s = 0.86602540378443865f;
+
+	for( uint b = 0; b < batch; ++b )
+	{
+		const float a0r = in_re[b];
+		const float a0i = in_im[b];
+		const float a1r = (in_re[b + in_step] * w1r) - (in_im[b + in_step] * w1i);
+		const float a1i = (in_re[b + in_step] * w1i) + (in_im[b + in_step] * w1r);
+		const float a2r = (in_re[b + 2*in_step] * w2r) - (in_im[b + 2*in_step] * w2i);
+		const float a2i = (in_re[b + 2*in_step] * w2i) + (in_im[b + 2*in_step] * w2r);
+
+		const float sum_r = a1r + a2r;
+		const float sum_i = a1i + a2i;
+		const float mid_r = a0r - 0.5f * sum_r;
+		const float mid_i = a0i - 0.5f * sum_i;
+
+		//-i sqrt(3)/2 (a1 - a2)
+		const float rot_r = s * (a1i - a2i);
+		const float rot_i = -s * (a1r - a2r);
+
+		out_re[b]				= a0r + sum_r;
+		out_im[b]				= a0i + sum_i;
+		out_re[b + out_step]	= mid_r + rot_r;
+		out_im[b + out_step]	= mid_i + rot_i;
+		out_re[b + 2*out_step]	= mid_r - rot_r;
+		out_im[b + 2*out_step]	= mid_i - rot_i;
+	}
+}
+
+//------------------------------------------------------------------------------
+void Fft::Butterfly4( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch )
+{
+	const float* tw_re = &pass.mTwiddleRe[ k * 4 ];
+	const float* tw_im = &pass.mTwiddleIm[ k * 4 ];
+	const float w1r = tw_re[1], w1i = tw_im[1];
+	const float w2r = tw_re[2], w2i = tw_im[2];
+	const float w3r = tw_re[3], w3i = tw_im[3];
+
+	uint b = 0;
+#if defined(SIMD_X86)
+	b = Butterfly4SSE2( tw_re, tw_im, in_re, in_im, in_step, out_re, out_im, out_step, batch );
+#endif
+
+	for( ; b < batch; ++b )
+	{
+		const float a0r = in_re[b];
+		const float a0i = in_im[b];
+		const float a1r = (in_re[b + in_step] * w1r) - (in_im[b + in_step] * w1i);
+		const float a1i = (in_re[b + in_step] * w1i) + (in_im[b + in_step] * w1r);
+		const float a2r = (in_re[b + 2*in_step] * w2r) - (in_im[b + 2*in_step] * w2i);
+		const float a2i = (in_re[b + 2*in_step] * w2i) + (in_im[b + 2*in_step] * w2r);
+		const float a3r = (in_re[b + 3*in_step] * w3r) - (in_im[b + 3*in_step] * w3i);
+		const float a3i = (in_re[b + 3*in_step] * w3i) + (in_im[b + 3*in_step] * w3r);
+
+		const float t0r = a0r + a2r, t0i = a0i + a2i;
+		const float t1r = a0r - a2r, t1i = a0i - a2i;
+		const float t2r = a1r + a3r, t2i = a1i + a3i;
+
+		//-i (a1 - a3)
+		const float t3r = a1i - a3i;
+		const float t3i = a3r - a1r;
+
+		out_re[b]				= t0r + t2r;
+		out_im[b]				= t0i + t2i;
+		out_re[b + out_step]	= t1r + t3r;
+		out_im[b + out_step]	= t1i + t3i;
+		out_re[b + 2*out_step]	= t0r - t2r;
+		out_im[b + 2*out_step]	= t0i - t2i;
+		out_re[b + 3*out_step]	= t1r - t3r;
+		out_im[b + 3*out_step]	= t1i - t3i;
+	}
+}
+
+//------------------------------------------------------------------------------
+//A direct DFT for odd primes without their own butterfly. Each twiddle is folded into the DFT
+//weights, so the work across the batch is all multiply-adds by one complex constant.
+void Fft::ButterflyN( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch )
+{
+	const uint radix = pass.mRadix;
+	const float* tw_re = &pass.mTwiddleRe[ k * radix ];
+	const float* tw_im = &pass.mTwiddleIm[ k * radix ];
+
+	for( uint p = 0; p < radix; ++p )
+	{
+		float* sum_re = out_re + (p * out_step);
+		float* sum_im = out_im + (p * out_step);
+
+		for( uint b = 0; b < batch; ++b )
+		{
+			sum_re[b] = 0.0f;
+			sum_im[b] = 0.0f;
+		}
+
+		for( uint q = 0, root = 0; q < radix; ++q, root = (root + p) % radix )
+		{
+			const float wr = (tw_re[q] * pass.mRootRe[root]) - (tw_im[q] * pass.mRootIm[root]);
+			const float wi = (tw_re[q] * pass.mRootIm[root]) + (tw_im[q] * pass.mRootRe[root]);
+			const float* x_re = in_re + (q * in_step);
+			const float* x_im = in_im + (q * in_step);
+
+			uint b = 0;
+#if defined(SIMD_X86)
+			b = MultiplyAddSSE2( wr, wi, x_re, x_im, sum_re, sum_im, batch );
+#endif
+
+			for( ; b < batch; ++b )
+			{
+				sum_re[b] += (x_re[b] * wr) - (x_im[b] * wi);
+				sum_im[b] += (x_re[b] * wi) + (x_im[b] * wr);
+			}
+		}
+	}
+}
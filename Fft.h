@@ -0,0 +1,70 @@
+#ifndef FFT_H
+#define FFT_H
+
+
+#include <vector>
+#include "types.h"
+
+
+//Complex discrete Fourier transforms of one length, on batches of signals.
+//Signals are split into real and imaginary arrays with element k of signal b
+//at [(k * batch) + b], so every butterfly is a loop across the batch that
+//fills SSE registers however long the transform is.
+//Lengths are factored into radix 4, 2 and 3 Stockham passes, other primes up
+//to MAX_RADIX get a direct DFT pass, and any length with a larger prime
+//factor goes through Bluestein's algorithm on a power of two.
+//The twiddles and factorisation are worked out once, in the constructor.
+class Fft
+{
+public:
+	const static uint MAX_RADIX = 31;
+
+	explicit Fft( uint n );
+	~Fft();
+
+	uint GetLength() const { return mLength; }
+
+	//X_k = sum of x_j e^(-2 pi i jk/n), in place
+	void Forward( float* re, float* im, uint batch );
+
+	//The same with e^(+2 pi i jk/n) and unscaled, so Inverse( Forward( x ) ) is n x
+	void Inverse( float* re, float* im, uint batch );
+
+private:
+	struct Pass
+	{
+		uint				mRadix;
+		uint				mSpan;			//Length of the sub-transforms this pass combines
+		std::vector<float>	mTwiddleRe;		//[ (k * mRadix) + q ] for k < mSpan
+		std::vector<float>	mTwiddleIm;
+		std::vector<float>	mRootRe;		//e^(-2 pi i q/mRadix), for the direct DFT passes
+		std::vector<float>	mRootIm;
+	};
+
+	void RunPasses( float* re, float* im, uint batch );
+	void RunBluestein( float* re, float* im, uint batch );
+
+	static void Butterfly2( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch );
+	static void Butterfly3( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch );
+	static void Butterfly4( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch );
+	static void ButterflyN( const Pass& pass, uint k, const float* in_re, const float* in_im, uint in_step, float* out_re, float* out_im, uint out_step, uint batch );
+
+private:
+	uint				mLength;
+	std::vector<Pass>	mPasses;
+	std::vector<float>	mWorkRe;
+	std::vector<float>	mWorkIm;
+
+	//Bluestein: the chirp e^(-pi i k^2/n), and the transform of its conjugate
+	//padded to the inner length and scaled by 1/inner length
+	Fft*				mInner;
+	std::vector<float>	mChirpRe;
+	std::vector<float>	mChirpIm;
+	std::vector<float>	mKernelRe;
+	std::vector<float>	mKernelIm;
+	std::vector<float>	mPaddedRe;
+	std::vector<float>	mPaddedIm;
+};
+
+
+#endif //FFT_H
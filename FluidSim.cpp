@@ -1,81 +1,472 @@
 #include "FluidSim.h"
+#include "Boundary.h"
+#include "ConjugateGradient.h"
+#include "GridArena.h"
+#include "Multigrid.h"
+#include "ProcessGroup.h"
 #include "Profiler.h"
+#include "SpectralPoisson.h"
+#include "TaskGraph.h"
+#include "ThreadPool.h"
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(SIMD_X86)
+	#include <xmmintrin.h>
+#endif
 
 //------------------------------------------------------------------------------
 const static uint  SOLVER_ITERATIONS		= 10;
+const static uint  MULTIGRID_CYCLES		= 2;
+const static float SOLVER_TOLERANCE		= 0.001f;
+const static uint  SOLVER_MAX_ITERATIONS	= 200;
+const static uint  DENSITY_CHANNELS		= AdvectKernels::INTERLEAVED_CHANNELS;
+const static uint  TILE_SIZE				= 16;
+const static float ACTIVITY_THRESHOLD		= 0.0001f;
+const static uint  CACHE_LINE_FLOATS		= 64 / sizeof(float);
+const static uint  ROW_SET_LINES			= 8;
+const static uint  ADVECT_BLOCK_WIDTH		= 32;
+const static uint  PREFETCH_MAX_LINES		= 256;			//16K, a third of a typical L1
+const static float PI						= 3.14159265f;
+const static float CHEBYSHEV_MIN_SPAN		= 2.0f;			//k acosh( 1/rho ), the log of the reduction a solve of k steps aims for
+const static float SOR_MIN_SPAN				= 5.0f;			//The same for over relaxation, whose sweeps start out less effective
+
+//------------------------------------------------------------------------------
+enum Grid
+{
+	GRID_DENSITIES,			//Also holds the 16 bit storage formats
+	GRID_DENSITIES0,
+	GRID_VELOCITIES_U,
+	GRID_VELOCITIES_V,
+	GRID_VELOCITIES_U0,
+	GRID_VELOCITIES_V0,
+	GRID_SOURCES,			//As GRID_DENSITIES
+	GRID_PRESSURES0,
+	GRID_PRESSURES1,
+	GRID_ADVECT_FORWARD,	//Empty unless MacCormack advection is selected
+	GRID_ADVECT_BACKWARD,
+	GRID_JACOBI,			//Empty unless either system uses the Chebyshev Jacobi solver
+	NUM_GRIDS
+};
 
 //------------------------------------------------------------------------------
 #define SWAP(x0,x) {float* tmp = x0; x0 = x; x = tmp;}
 
+//------------------------------------------------------------------------------
+//Rows are a whole number of cache lines. When that's a multiple of ROW_SET_LINES the cells
+//above and below each other fall in only a few cache sets, so those rows get one line more.
+static uint RowStride( uint size_x )
+{
+	uint stride = ((size_x + CACHE_LINE_FLOATS-1) / CACHE_LINE_FLOATS) * CACHE_LINE_FLOATS;
+
+	if( (stride / CACHE_LINE_FLOATS) % ROW_SET_LINES == 0 )
+	{
+		stride += CACHE_LINE_FLOATS;
+	}
+
+	return stride;
+}
+
+//------------------------------------------------------------------------------
+template< typename T > static inline void LoadCell( const T* d, float* out )
+{
+	for( uint ch = 0; ch < DENSITY_CHANNELS; ++ch )
+	{
+		out[ch] = d[ch];
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename T > static inline void StoreCell( T* d, const float* in )
+{
+	for( uint ch = 0; ch < DENSITY_CHANNELS; ++ch )
+	{
+		d[ch] = T( in[ch] );
+	}
+}
+
+//------------------------------------------------------------------------------
+//Multigrid, the spectral solver and the single channel conjugate gradient only take
+//float grids. A float right hand side is passed straight through.
+static inline const float* FloatGrid( const float* d, uint, std::vector<float>& )
+{
+	return d;
+}
+
+//------------------------------------------------------------------------------
+//A 16 bit one is widened into scratch. Nothing sends them one today, 16 bit storage
+//is only used for the interleaved densities, so this costs nothing unless that changes.
+template< typename T > static inline const float* FloatGrid( const T* d, uint num_cells, std::vector<float>& scratch )
+{
+	scratch.resize( num_cells );
+
+	for( uint i = 0; i < num_cells; ++i )
+	{
+		scratch[i] = float( d[i] );
+	}
+
+	return &scratch[0];
+}
+
+//------------------------------------------------------------------------------
+static void ResetStats( FluidSim::SolverStats& stats )
+{
+	stats.mSolves		= 0;
+	stats.mIterations	= 0;
+	stats.mResidual		= -1.0f;
+	stats.mMilliseconds	= 0.0f;
+
+	for( uint i = 0; i < FluidSim::NUM_DIFFUSION_PATHS; ++i )
+	{
+		stats.mPaths[i] = 0;
+	}
+}
+
+//------------------------------------------------------------------------------
+static void MergeStats( FluidSim::SolverStats& stats, const FluidSim::SolverStats& other )
+{
+	stats.mSolves		+= other.mSolves;
+	stats.mIterations	+= other.mIterations;
+	stats.mResidual		= std::max( stats.mResidual, other.mResidual );
+	stats.mMilliseconds	+= other.mMilliseconds;
+
+	for( uint i = 0; i < FluidSim::NUM_DIFFUSION_PATHS; ++i )
+	{
+		stats.mPaths[i] += other.mPaths[i];
+	}
+}
+
+//------------------------------------------------------------------------------
+//Fills rows [y_begin, y_end) of a grid from src, or with zeros if it's NULL. The ghost rows go
+//with the block next to them.
+static void CopyGridRows( char* dst, const char* src, size_t row_bytes, uint size_y, uint y_begin, uint y_end )
+{
+	const uint row_begin	= y_begin == 1 ? 0 : y_begin;
+	const uint row_end		= y_end == size_y-1 ? size_y : y_end;
+
+	if( src != NULL )
+	{
+		memcpy( dst + (row_begin * row_bytes), src + (row_begin * row_bytes), (row_end - row_begin) * row_bytes );
+	}
+	else
+	{
+		memset( dst + (row_begin * row_bytes), 0, (row_end - row_begin) * row_bytes );
+	}
+}
+
+//------------------------------------------------------------------------------
+//ProcessGroup jobs only have what they're passed. The workers' copy of the
+//FluidSim is from when they were forked, and so is any heap memory, so jobs
+//can only point into the group's shared memory.
+struct CopyGridArgs
+{
+	char*		mDst;
+	const char*	mSrc;
+	size_t		mRowBytes;
+	uint		mSizeY;
+};
+
+//------------------------------------------------------------------------------
+static void CopyGridJob( ProcessGroup& group, const void* args, uint rank )
+{
+	const CopyGridArgs& job = *(const CopyGridArgs*)args;
+
+	uint y_begin, y_end;
+	group.GetRange( 1, job.mSizeY-1, rank, y_begin, y_end );
+
+	if( y_begin < y_end )
+	{
+		CopyGridRows( job.mDst, job.mSrc, job.mRowBytes, job.mSizeY, y_begin, y_end );
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Rhs >
+struct RedBlackArgs
+{
+	float*		mD;
+	const Rhs*	mD0;
+	float		mA;
+	float		mC;
+	float		mOmega;
+	uint		mChannels;
+	uint		mIterations;
+	uint		mSizeX;
+	uint		mSizeY;
+	uint		mStride;
+};
+
+//------------------------------------------------------------------------------
+//FluidSim::RedBlackSweep's update over whole rows, each process sweeping its own strip.
+//The strips only meet at their edge rows, which are read in place once every process has
+//finished the half sweep. Only the corners are left, as in RunSweeps.
+template< int B, typename Rhs >
+static void RedBlackJob( ProcessGroup& group, const void* args, uint rank )
+{
+	const RedBlackArgs<Rhs>& job = *(const RedBlackArgs<Rhs>*)args;
+	float* d = job.mD;
+	const Rhs* d0 = job.mD0;
+	const float a = job.mA;
+	const float inv_c = 1.0f / job.mC;
+	const float over = job.mOmega - 1.0f;
+	const uint channels = job.mChannels;
+	const uint row_stride = job.mStride * channels;
+
+	uint y_begin, y_end;
+	group.GetRange( 1, job.mSizeY-1, rank, y_begin, y_end );
+
+	for( uint k = 0; k < job.mIterations; ++k )
+	{
+		for( uint colour = 0; colour < 2; ++colour )
+		{
+			for( uint y = y_begin; y < y_end; ++y )
+			{
+				const uint row = y * job.mStride;
+
+				for( uint x = 1 + ((1 + y + colour) & 1); x < job.mSizeX-1; x += 2 )
+				{
+					for( uint i = (row + x) * channels, end = i + channels; i < end; ++i )
+					{
+						const float gs = (d0[i] + a*(d[i-channels] + d[i+channels] + d[i-row_stride] + d[i+row_stride])) * inv_c;
+						d[i] = gs + over*(gs - d[i]);
+					}
+				}
+
+				if( colour == 1 )
+				{
+					SetBoundaryRow<B>( job.mD, job.mSizeX, job.mSizeY, job.mStride, y, job.mChannels );
+				}
+			}
+
+			group.Barrier();
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//Chebyshev's weight for step k, from the weight of the step before
+static float ChebyshevWeight( uint k, float rho, float omega )
+{
+	return ( k == 0 ) ? 1.0f : ( k == 1 ) ? 1.0f / (1.0f - 0.5f*rho*rho) : 1.0f / (1.0f - 0.25f*rho*rho*omega);
+}
+
+//------------------------------------------------------------------------------
+template< typename Rhs >
+struct ChebyshevArgs
+{
+	typedef void (*Kernel)( float* next, const float* d, const Rhs* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end );
+
+	float*		mD;
+	float*		mOther;
+	const Rhs*	mD0;
+	Kernel		mKernel;		//Code is at the same address in every process
+	float		mA;
+	float		mInvC;
+	float		mRho;
+	uint		mFirst;
+	uint		mIterations;
+	uint		mChannels;
+	uint		mSizeX;
+	uint		mSizeY;
+	uint		mStride;
+};
+
+//------------------------------------------------------------------------------
+//FluidSim::ChebyshevSweeps over whole rows, each process stepping its own strip from one
+//buffer into the other. A step only reads the last one, so the strips just wait for each
+//other between steps.
+template< int B, typename Rhs >
+static void ChebyshevJob( ProcessGroup& group, const void* args, uint rank )
+{
+	const ChebyshevArgs<Rhs>& job = *(const ChebyshevArgs<Rhs>*)args;
+	const uint channels = job.mChannels;
+
+	uint y_begin, y_end;
+	group.GetRange( 1, job.mSizeY-1, rank, y_begin, y_end );
+
+	float* current = job.mD;
+	float* other = job.mOther;
+	float omega = 1.0f;
+
+	for( uint k = 0; k < (job.mFirst + job.mIterations); ++k )
+	{
+		omega = ChebyshevWeight( k, job.mRho, omega );
+		if( k < job.mFirst )
+		{
+			continue;
+		}
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			const uint row = y * job.mStride;
+			job.mKernel( other, current, job.mD0, job.mA, job.mInvC, omega, channels, job.mStride * channels, (row + 1) * channels, (row + job.mSizeX-1) * channels );
+			SetBoundaryRow<B>( other, job.mSizeX, job.mSizeY, job.mStride, y, channels );
+		}
+
+		group.Barrier();
+		std::swap( current, other );
+	}
+}
+
+//------------------------------------------------------------------------------
+FluidSim::SolverPolicy FluidSim::SolverPolicy::Fixed( uint iterations )
+{
+	SolverPolicy policy;
+	policy.mMode			= MODE_FIXED;
+	policy.mIterations		= iterations;
+	policy.mTolerance		= 0.0f;
+	policy.mTimeBudget		= 0.0f;
+	policy.mCheckInterval	= 0;
+	return policy;
+}
+
+//------------------------------------------------------------------------------
+FluidSim::SolverPolicy FluidSim::SolverPolicy::Tolerance( float tolerance, uint max_iterations, uint check_interval )
+{
+	SolverPolicy policy;
+	policy.mMode			= MODE_TOLERANCE;
+	policy.mIterations		= max_iterations;
+	policy.mTolerance		= tolerance;
+	policy.mTimeBudget		= 0.0f;
+	policy.mCheckInterval	= check_interval;
+	return policy;
+}
+
+//------------------------------------------------------------------------------
+FluidSim::SolverPolicy FluidSim::SolverPolicy::TimeBudget( float milliseconds, float tolerance, uint max_iterations, uint check_interval )
+{
+	SolverPolicy policy;
+	policy.mMode			= MODE_TIME_BUDGET;
+	policy.mIterations		= max_iterations;
+	policy.mTolerance		= tolerance;
+	policy.mTimeBudget		= milliseconds;
+	policy.mCheckInterval	= check_interval;
+	return policy;
+}
+
 //------------------------------------------------------------------------------
 FluidSim::FluidSim( uint size_x, uint size_y, float viscosity, float diffusion, float decay )
 	:	mSizeX( size_x )
 	,	mSizeY( size_y )
 	,	mNumPoints( size_x * size_y )
+	,	mStride( RowStride( size_x ) )
+	,	mNumCells( mStride * size_y )
 	,	mViscosity( viscosity )
 	,	mDiffusion( diffusion )
 	,	mDecay( decay )
 	,	mGravityU( 0.0f )
 	,	mGravityV( 0.0f )
+	,	mPressureSolver( SOLVER_GAUSS_SEIDEL )
+	,	mDiffusionSolver( SOLVER_GAUSS_SEIDEL )
+	,	mMultigrid( NULL )
+	,	mConjugateGradient( NULL )
+	,	mSpectralPoisson( NULL )
+	,	mJacobiGrid( NULL )
+	,	mThreadPool( NULL )
+	,	mAdvectKernel( AdvectKernels::Get( Simd::DetectLevel() ) )
+	,	mAdvectDensityKernel( AdvectKernels::GetInterleaved( Simd::DetectLevel() ) )
+	,	mAdvectDensityFloat16Kernel( AdvectKernels::GetInterleavedFloat16( Simd::DetectLevel() ) )
+	,	mAdvectDensityBFloat16Kernel( AdvectKernels::GetInterleavedBFloat16( Simd::DetectLevel() ) )
+	,	mForceKernel( ForceKernels::Get( Simd::DetectLevel() ) )
+	,	mForceFloat16Kernel( ForceKernels::GetFloat16( Simd::DetectLevel() ) )
+	,	mForceBFloat16Kernel( ForceKernels::GetBFloat16( Simd::DetectLevel() ) )
+	,	mCorrectKernel( AdvectKernels::GetCorrect( Simd::DetectLevel() ) )
+	,	mCorrectDensityKernel( AdvectKernels::GetInterleavedCorrect( Simd::DetectLevel() ) )
+	,	mCorrectDensityFloat16Kernel( AdvectKernels::GetInterleavedCorrectFloat16( Simd::DetectLevel() ) )
+	,	mCorrectDensityBFloat16Kernel( AdvectKernels::GetInterleavedCorrectBFloat16( Simd::DetectLevel() ) )
+	,	mJacobiKernel( JacobiKernels::Get( Simd::DetectLevel() ) )
+	,	mJacobiFloat16Kernel( JacobiKernels::GetFloat16( Simd::DetectLevel() ) )
+	,	mJacobiBFloat16Kernel( JacobiKernels::GetBFloat16( Simd::DetectLevel() ) )
+	,	mPressurePolicy( SolverPolicy::Fixed( 0 ) )
+	,	mDiffusionPolicy( SolverPolicy::Fixed( 0 ) )
+	,	mDiffusionError( 0.0f )
+	,	mRelaxation( 0.0f )
+	,	mWarmStartPressure( false )
+	,	mSparseTiles( false )
+	,	mTilesX( (size_x - 2 + TILE_SIZE-1) / TILE_SIZE )
+	,	mTilesY( (size_y - 2 + TILE_SIZE-1) / TILE_SIZE )
+	,	mNumActiveTiles( 0 )
+	,	mPrecision( PRECISION_FLOAT32 )
+	,	mDensitiesHalf( NULL )
+	,	mSourcesHalf( NULL )
+	,	mArena( NULL )
+	,	mHugePages( false )
+	,	mTaskGraph( NULL )
+	,	mRunningGraph( false )
+	,	mAdvectionScheme( ADVECTION_SEMI_LAGRANGIAN )
+	,	mAdvectForward( NULL )
+	,	mAdvectBackward( NULL )
+	,	mBlockedAdvection( false )
+	,	mProcessGroup( NULL )
 {
-	mDensitiesR		= new float[ mNumPoints ];
-	mDensitiesG		= new float[ mNumPoints ];
-	mDensitiesB		= new float[ mNumPoints ];
-	mDensitiesR0	= new float[ mNumPoints ];
-	mDensitiesG0	= new float[ mNumPoints ];
-	mDensitiesB0	= new float[ mNumPoints ];
-	mVelocitiesU	= new float[ mNumPoints ];
-	mVelocitiesV	= new float[ mNumPoints ];
-	mVelocitiesU0	= new float[ mNumPoints ];
-	mVelocitiesV0	= new float[ mNumPoints ];
-	mSourcesR		= new float[ mNumPoints ];
-	mSourcesG		= new float[ mNumPoints ];
-	mSourcesB		= new float[ mNumPoints ];
-
-	memset( mDensitiesR, 0, mNumPoints * sizeof(float) );
-	memset( mDensitiesG, 0, mNumPoints * sizeof(float) );
-	memset( mDensitiesB, 0, mNumPoints * sizeof(float) );
-	memset( mDensitiesR0, 0, mNumPoints * sizeof(float) );
-	memset( mDensitiesG0, 0, mNumPoints * sizeof(float) );
-	memset( mDensitiesB0, 0, mNumPoints * sizeof(float) );
-	memset( mVelocitiesU, 0, mNumPoints * sizeof(float) );
-	memset( mVelocitiesV, 0, mNumPoints * sizeof(float) );
-	memset( mVelocitiesU0, 0, mNumPoints * sizeof(float) );
-	memset( mVelocitiesV0, 0, mNumPoints * sizeof(float) );
-	memset( mSourcesR, 0, mNumPoints * sizeof(float) );
-	memset( mSourcesG, 0, mNumPoints * sizeof(float) );
-	memset( mSourcesB, 0, mNumPoints * sizeof(float) );
+	ResetStats( mPressureStats );
+	ResetStats( mDiffusionStats );
+
+	for( uint i = 0; i < NUM_PROJECT_CALLS; ++i )
+	{
+		mPressureIterations[i] = 0;
+	}
+
+	PlaceGrids( false );
+
+	//Everything is active until sparse tiles are turned on
+	mTileActive.resize( mTilesX * mTilesY, 1 );
+	mTileOccupied.resize( mTilesX * mTilesY, 0 );
+	BuildSpans();
 }
 
 //------------------------------------------------------------------------------
 FluidSim::~FluidSim()
 {
-	delete [] mDensitiesR;		mDensitiesR = NULL;
-	delete [] mDensitiesG;		mDensitiesG = NULL;
-	delete [] mDensitiesB;		mDensitiesB = NULL;
-	delete [] mDensitiesR0;		mDensitiesR0 = NULL;
-	delete [] mDensitiesG0;		mDensitiesG0 = NULL;
-	delete [] mDensitiesB0;		mDensitiesB0 = NULL;
-	delete [] mVelocitiesU;		mVelocitiesU = NULL;
-	delete [] mVelocitiesV;		mVelocitiesV = NULL;
-	delete [] mVelocitiesU0;	mVelocitiesU0 = NULL;
-	delete [] mVelocitiesV0;	mVelocitiesV0 = NULL;
-	delete [] mSourcesR;		mSourcesR = NULL;
-	delete [] mSourcesG;		mSourcesG = NULL;
-	delete [] mSourcesB;		mSourcesB = NULL;
+	delete mArena;				mArena = NULL;
+	delete mProcessGroup;		mProcessGroup = NULL;
+	delete mTaskGraph;			mTaskGraph = NULL;
+	delete mMultigrid;			mMultigrid = NULL;
+	delete mConjugateGradient;	mConjugateGradient = NULL;
+	delete mSpectralPoisson;	mSpectralPoisson = NULL;
+	delete mThreadPool;			mThreadPool = NULL;
 }
 
 //------------------------------------------------------------------------------
 void FluidSim::Update( float dt )
 {
-	DensityStep( mSourcesR, mDensitiesR, mDensitiesR0, mVelocitiesU, mVelocitiesV, mDiffusion, dt );
-	DensityStep( mSourcesG, mDensitiesG, mDensitiesG0, mVelocitiesU, mVelocitiesV, mDiffusion, dt );
-	DensityStep( mSourcesB, mDensitiesB, mDensitiesB0, mVelocitiesU, mVelocitiesV, mDiffusion, dt );
+	ResetStats( mPressureStats );
+	ResetStats( mDiffusionStats );
+
+	if( mSparseTiles )
+	{
+		UpdateActiveTiles( dt );
+	}
+
+	if( mTaskGraph != NULL )
+	{
+		switch( mPrecision )
+		{
+		case PRECISION_FLOAT32:		UpdateGraph( mDensities, mSources, dt, mAdvectDensityKernel, mCorrectDensityKernel );																break;
+		case PRECISION_FLOAT16:		UpdateGraph( (Half::Float16*)mDensitiesHalf, (const Half::Float16*)mSourcesHalf, dt, mAdvectDensityFloat16Kernel, mCorrectDensityFloat16Kernel );		break;
+		case PRECISION_BFLOAT16:	UpdateGraph( (Half::BFloat16*)mDensitiesHalf, (const Half::BFloat16*)mSourcesHalf, dt, mAdvectDensityBFloat16Kernel, mCorrectDensityBFloat16Kernel );	break;
+		}
+
+		return;
+	}
+
+	switch( mPrecision )
+	{
+	case PRECISION_FLOAT32:
+		DensityStep( mDensities, mDensities0, mSources, mVelocitiesU, mVelocitiesV, mDiffusion, mDecay, dt, mAdvectDensityKernel, mCorrectDensityKernel );
+		break;
+
+	case PRECISION_FLOAT16:
+		DensityStep( (Half::Float16*)mDensitiesHalf, mDensities0, (const Half::Float16*)mSourcesHalf, mVelocitiesU, mVelocitiesV, mDiffusion, mDecay, dt, mAdvectDensityFloat16Kernel, mCorrectDensityFloat16Kernel );
+		break;
+
+	case PRECISION_BFLOAT16:
+		DensityStep( (Half::BFloat16*)mDensitiesHalf, mDensities0, (const Half::BFloat16*)mSourcesHalf, mVelocitiesU, mVelocitiesV, mDiffusion, mDecay, dt, mAdvectDensityBFloat16Kernel, mCorrectDensityBFloat16Kernel );
+		break;
+	}
+
 	VelocityStep( mVelocitiesU, mVelocitiesV, mVelocitiesU0, mVelocitiesV0, mViscosity, dt );
-	Decay( mDensitiesR, mDecay, dt );
-	Decay( mDensitiesG, mDecay, dt );
-	Decay( mDensitiesB, mDecay, dt );
 }
 
 //------------------------------------------------------------------------------
@@ -89,23 +480,20 @@ void FluidSim::PlaceSource( uint x, uint y, float r, float g, float b )
 	}
 
 	const uint index = IDX( x, y );
+	const uint cells[] = { index, index-1, index+1, index-mStride, index+mStride };
 
 	//Create a source
-	mSourcesR[ index ]			= r;
-	mSourcesR[ index-1 ]		= r;
-	mSourcesR[ index+1 ]		= r;
-	mSourcesR[ index-mSizeX ]	= r;
-	mSourcesR[ index+mSizeX ]	= r;
-	mSourcesG[ index ]			= g;
-	mSourcesG[ index-1 ]		= g;
-	mSourcesG[ index+1 ]		= g;
-	mSourcesG[ index-mSizeX ]	= g;
-	mSourcesG[ index+mSizeX ]	= g;
-	mSourcesB[ index ]			= b;
-	mSourcesB[ index-1 ]		= b;
-	mSourcesB[ index+1 ]		= b;
-	mSourcesB[ index-mSizeX ]	= b;
-	mSourcesB[ index+mSizeX ]	= b;
+	for( uint c = 0; c < 5; ++c )
+	{
+		float source[ DENSITY_CHANNELS ];
+		LoadSource( cells[c], source );
+		source[0] = r;
+		source[1] = g;
+		source[2] = b;
+		StoreSource( cells[c], source );
+	}
+
+	ActivateTilesAround( x, y );
 }
 
 //------------------------------------------------------------------------------
@@ -119,48 +507,26 @@ void FluidSim::EraseSource( uint x, uint y )
 	}
 
 	const uint index = IDX( x, y );
+	const uint cells[] = { index, index-1, index+1, index-mStride, index+mStride };
 
 	//Erase nearby sources
-	mSourcesR[ index ]			= 0.0f;
-	mSourcesR[ index-1 ]		= 0.0f;
-	mSourcesR[ index+1 ]		= 0.0f;
-	mSourcesR[ index-mSizeX ]	= 0.0f;
-	mSourcesR[ index+mSizeX ]	= 0.0f;
-	mSourcesG[ index ]			= 0.0f;
-	mSourcesG[ index-1 ]		= 0.0f;
-	mSourcesG[ index+1 ]		= 0.0f;
-	mSourcesG[ index-mSizeX ]	= 0.0f;
-	mSourcesG[ index+mSizeX ]	= 0.0f;
-	mSourcesB[ index ]			= 0.0f;
-	mSourcesB[ index-1 ]		= 0.0f;
-	mSourcesB[ index+1 ]		= 0.0f;
-	mSourcesB[ index-mSizeX ]	= 0.0f;
-	mSourcesB[ index+mSizeX ]	= 0.0f;
+	for( uint c = 0; c < 5; ++c )
+	{
+		ClearSourceCells( cells[c], 1 );
+	}
 }
 
 //------------------------------------------------------------------------------
 void FluidSim::ClearSources()
 {
-	for( uint i = 0; i < mNumPoints; ++i )
-	{
-		mSourcesR[ i ] = 0.0f;
-		mSourcesG[ i ] = 0.0f;
-		mSourcesB[ i ] = 0.0f;
-	}
+	ClearSourceCells( 0, mNumCells );
 }
 
 //------------------------------------------------------------------------------
 void FluidSim::ClearDensity()
 {
-	for( uint i = 0; i < mNumPoints; ++i )
-	{
-		mDensitiesR[ i ] = 0.0f;
-		mDensitiesG[ i ] = 0.0f;
-		mDensitiesB[ i ] = 0.0f;
-		mDensitiesR0[ i ] = 0.0f;
-		mDensitiesG0[ i ] = 0.0f;
-		mDensitiesB0[ i ] = 0.0f;
-	}
+	ClearDensityCells( 0, mNumCells );
+	memset( mDensities0, 0, mNumCells * DENSITY_CHANNELS * sizeof(float) );
 }
 
 //------------------------------------------------------------------------------
@@ -186,6 +552,8 @@ void FluidSim::ApplyForce( uint x, uint y, float amount )
 	mVelocitiesV[IDX(x-1,y+1)]	+= amount;
 	mVelocitiesV[IDX(x  ,y+1)]	+= amount;
 	mVelocitiesV[IDX(x+1,y+1)]	+= amount;
+
+	ActivateTilesAround( x, y );
 }
 
 //------------------------------------------------------------------------------
@@ -196,248 +564,1927 @@ void FluidSim::SetGravity( float gu, float gv )
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::Draw( PixelToaster::vector<PixelToaster::Pixel>& out_pixels, bool clamp_colours, bool show_sources, bool show_velocity ) const
+void FluidSim::SetPressureSolver( Solver solver )
 {
-	if( out_pixels.size() != mNumPoints )
+	mPressureSolver = solver;
+
+	//Solver workspaces are only allocated when they're first needed
+	if( ( solver == SOLVER_MULTIGRID_V || solver == SOLVER_MULTIGRID_F ) && mMultigrid == NULL )
 	{
-		out_pixels.resize( mNumPoints );
+		mMultigrid = new Multigrid( mSizeX, mSizeY, mStride );
 	}
 
-	for( uint i = 0; i < mNumPoints; ++i )
+	if( ( solver == SOLVER_CONJUGATE_GRADIENT_JACOBI || solver == SOLVER_CONJUGATE_GRADIENT_MIC ) && mConjugateGradient == NULL )
 	{
-		float cr = mDensitiesR[ i ];
-		float cg = mDensitiesG[ i ];
-		float cb = mDensitiesB[ i ];
-
-		if( clamp_colours )
-		{
-			const float cmax = std::max( cr, std::max( cg, cb ) );
+		mConjugateGradient = new ConjugateGradient( mSizeX, mSizeY, mStride );
+	}
 
-			if( cmax > 1.0f )
-			{
-				cr /= cmax;
-				cb /= cmax;
-				cg /= cmax;
-			}
-		}
+	if( solver == SOLVER_SPECTRAL && mSpectralPoisson == NULL )
+	{
+		mSpectralPoisson = new SpectralPoisson( mSizeX, mSizeY, mStride );
+	}
 
-		out_pixels[ i ].r = cr;
-		out_pixels[ i ].g = cg;
-		out_pixels[ i ].b = cb;
+	//The arena only has room for the Jacobi solver's second buffer while one of the systems uses it
+	if( UsesJacobiGrid() != ( mJacobiGrid != NULL ) )
+	{
+		PlaceGrids( mHugePages );
+	}
+}
 
-		if( show_velocity )
-		{
-			const float v = abs( mVelocitiesU[ i ] ) + abs( mVelocitiesV[ i ] ) / 2.0f;
-			out_pixels[ i ].r = v;
-			out_pixels[ i ].g = v;
-			out_pixels[ i ].b = v;
-		}
+//------------------------------------------------------------------------------
+void FluidSim::SetDiffusionSolver( Solver solver )
+{
+	//Multigrid and the spectral solver only handle the pressure equation
+	assert( solver != SOLVER_MULTIGRID_V && solver != SOLVER_MULTIGRID_F && solver != SOLVER_SPECTRAL );
 
-		if( show_sources )
-		{
-			float r = mSourcesR[ i ];
-			float g = mSourcesG[ i ];
-			float b = mSourcesB[ i ];
+	mDiffusionSolver = solver;
 
-			const float max = std::max( r, std::max( g, b ) );
-			
-			if( max > 0.0f )
-			{
-				//Scale back to 0..1
-				r /= max;
-				g /= max;
-				b /= max;
+	if( ( solver == SOLVER_CONJUGATE_GRADIENT_JACOBI || solver == SOLVER_CONJUGATE_GRADIENT_MIC ) && mConjugateGradient == NULL )
+	{
+		mConjugateGradient = new ConjugateGradient( mSizeX, mSizeY, mStride );
+	}
 
-				out_pixels[ i ].r = r;
-				out_pixels[ i ].g = g;
-				out_pixels[ i ].b = b;
-			}
-		}
+	//The arena only has room for the Jacobi solver's second buffer while one of the systems uses it
+	if( UsesJacobiGrid() != ( mJacobiGrid != NULL ) )
+	{
+		PlaceGrids( mHugePages );
 	}
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::DensityStep( float* s, float* x, float* x0, float* u, float* v, float diff, float dt )
+void FluidSim::SetPressurePolicy( const SolverPolicy& policy )
 {
-	AddSources( x, s, dt );
-	SWAP( x0, x ); Diffuse( 0, x, x0, diff, dt );
-	SWAP( x0, x ); Advect( 0, x, x0, u, v, dt );
+	mPressurePolicy = policy;
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::VelocityStep( float* u, float* v, float* u0, float* v0, float visc, float dt )
+void FluidSim::SetDiffusionPolicy( const SolverPolicy& policy )
 {
-	AddSources( u, u0, dt );
-	AddSources( v, v0, dt );
-	ApplyGravity( dt );
-	SWAP( u0, u ); Diffuse( 1, u, u0, visc, dt );
-	SWAP( v0, v ); Diffuse( 2, v, v0, visc, dt );
-	Project( u, v, u0, v0 );
-	SWAP( u0, u ); SWAP( v0, v );
-	Advect( 1, u, u0, u0, v0, dt ); Advect( 2, v, v0, u0, v0, dt );
-	Project( u, v, u0, v0 );
+	mDiffusionPolicy = policy;
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::AddSources( float* x, float* s, float dt )
+void FluidSim::SetDiffusionError( float error )
 {
-	for( uint i = 0; i < mNumPoints; ++i )
-	{
-		x[ i ] += dt * s[ i ];
-	}
+	assert( error >= 0.0f );
+	mDiffusionError = error;
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::ApplyGravity( float dt )
+void FluidSim::SetRelaxation( float omega )
 {
-	const float gu = mGravityU * dt;
-	const float gv = mGravityV * dt;
+	assert( omega >= 0.0f && omega < 2.0f );
+	mRelaxation = omega;
+}
 
-	for( uint y = 1; y < (mSizeY-1); ++y )
+//------------------------------------------------------------------------------
+void FluidSim::SetWarmStartPressure( bool enable )
+{
+	if( enable && ! mWarmStartPressure )
 	{
-		for( uint x = 1; x < (mSizeX-1); ++x )
-		{
-			const uint i = IDX(x,y);
-
-			float d = ( mDensitiesR[ i ] + mDensitiesG[ i ] + mDensitiesB[ i ] ) / 3.0f;
-
-			mVelocitiesU[ i ] += d * gu;
-			mVelocitiesV[ i ] += d * gv;
-		}
+		//Whatever's left from before warm starting was turned off is stale
+		memset( mPressures[0], 0, mNumCells * sizeof(float) );
+		memset( mPressures[1], 0, mNumCells * sizeof(float) );
 	}
+
+	mWarmStartPressure = enable;
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::Decay( float* d, float rate, float dt )
+void FluidSim::SetSparseTiles( bool enable )
 {
-	const float amount = rate * dt;
-
-	for( uint y = 1; y < (mSizeY-1); ++y )
-	{
-		for( uint x = 1; x < (mSizeX-1); ++x )
-		{
-			const uint index = IDX(x,y);
+	mSparseTiles = enable;
 
-			d[index] -= amount;
-			if( d[index] < 0.0f )
-			{
-				d[index] = 0.0f;
-			}
-		}
-	}
+	//Start from everything active, the next Update works out what can be skipped.
+	//Inactive tiles are all zero, so turning it off needs nothing else.
+	std::fill( mTileActive.begin(), mTileActive.end(), 1 );
+	BuildSpans();
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::Diffuse( int b, float* d, float* d0, float diff, float dt )
+void FluidSim::SetStoragePrecision( Precision precision )
 {
-	const float a = dt * diff * mSizeX * mSizeY;
+	if( precision == mPrecision )
+	{
+		return;
+	}
+
+	std::vector<float> densities( mNumCells * DENSITY_CHANNELS );
+	std::vector<float> sources( mNumCells * DENSITY_CHANNELS );
 
-	for( uint k = 0; k < SOLVER_ITERATIONS; ++k )
+	for( uint i = 0; i < mNumCells; ++i )
 	{
-		for( uint y = 1; y < (mSizeY-1); ++y )
-		{
-			for( uint x = 1; x < (mSizeX-1); ++x )
-			{
-				d[IDX(x,y)] = (d0[IDX(x,y)] + a*(d[IDX(x-1,y)]+d[IDX(x+1,y)]+d[IDX(x,y-1)]+d[IDX(x,y+1)]))/(1+4.0f*a);
-			}
-		}
+		LoadDensity( i, &densities[ i * DENSITY_CHANNELS ] );
+		LoadSource( i, &sources[ i * DENSITY_CHANNELS ] );
+	}
+
+	//The grids are sized for float, so the 16 bit formats reuse them
+	mPrecision = precision;
+	AssignGrids();
 
-		SetBnd( b, d );
+	for( uint i = 0; i < mNumCells; ++i )
+	{
+		StoreDensity( i, &densities[ i * DENSITY_CHANNELS ] );
+		StoreSource( i, &sources[ i * DENSITY_CHANNELS ] );
 	}
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::Advect( int b, float* d, float* d0, float* u, float* v, float dt )
+void FluidSim::SetAdvectionScheme( AdvectionScheme scheme )
 {
-	const float dt0 = dt * mSizeX;
-
-	for( uint y = 1; y < (mSizeY-1); ++y )
+	if( scheme != mAdvectionScheme )
 	{
-		for( uint x = 1; x < (mSizeX-1); ++x )
-		{
-			float x1 = x - dt0 * u[IDX(x,y)];
-			float y1 = y - dt0 * v[IDX(x,y)];
+		//The arena only has room for MacCormack's grids while it's selected
+		mAdvectionScheme = scheme;
+		PlaceGrids( mHugePages );
+	}
+}
 
-			x1 = std::min( std::max( x1, 0.5f ), mSizeX - 1.501f );
-			y1 = std::min( std::max( y1, 0.5f ), mSizeY - 1.501f );
+//------------------------------------------------------------------------------
+void FluidSim::SetBlockedAdvection( bool enable )
+{
+	mBlockedAdvection = enable;
+}
 
-			const int i0 = (int)x1;
-			const int i1 = i0+1;
-			const int j0 = (int)y1;
-			const int j1 = j0+1;
+//------------------------------------------------------------------------------
+void FluidSim::SetThreadCount( uint num_threads )
+{
+	delete mThreadPool;
+	mThreadPool = NULL;
 
-			const float s1 = x1-i0;
-			const float s0 = 1-s1;
-			const float t1 = y1-j0;
-			const float t0 = 1-t1;
+	if( num_threads > 1 )
+	{
+		mThreadPool = new ThreadPool( num_threads );
 
-			d[IDX(x,y)] = s0*(t0*d0[IDX(i0,j0)]+t1*d0[IDX(i0,j1)])+s1*(t0*d0[IDX(i1,j0)]+t1*d0[IDX(i1,j1)]);
-		}
+		//Move the grids so each thread's rows are first touched, and so placed, by that thread
+		PlaceGrids( mHugePages );
 	}
-
-	SetBnd( b, d );
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::Project( float* u, float* v, float* p, float* div )
+void FluidSim::SetProcessCount( uint num_processes )
 {
-	const float h = 1.0f / mSizeX;
-
-	for( uint y = 1; y < (mSizeY-1); ++y )
+	if( ! ProcessGroup::IsSupported() )
 	{
-		for( uint x = 1; x < (mSizeX-1); ++x )
-		{
-			div[IDX(x,y)] = -0.5f * h * ( u[IDX(x+1,y)] - u[IDX(x-1,y)] + v[IDX(x,y+1)] - v[IDX(x, y-1)] );
-			p[IDX(x,y)] = 0;
-		}
+		num_processes = 1;
 	}
 
-	SetBnd( 0, div );
-	SetBnd( 0, p );
+	num_processes = std::max( num_processes, 1u );
 
-	for( uint k = 0; k < SOLVER_ITERATIONS; ++k )
+	if( num_processes == GetProcessCount() )
 	{
-		for( uint y = 1; y < (mSizeY-1); ++y )
+		return;
+	}
+
+	//Bring the grids back out of the old group's memory before it's unmapped
+	if( mProcessGroup != NULL )
+	{
+		ProcessGroup* old_group = mProcessGroup;
+		mProcessGroup = NULL;
+		PlaceGrids( mHugePages );
+		delete old_group;
+	}
+
+	if( num_processes > 1 )
+	{
+		//Fork while this is the only thread, the pool is started again afterwards
+		const uint num_threads = mThreadPool != NULL ? mThreadPool->GetNumThreads() : 1;
+		delete mThreadPool;
+		mThreadPool = NULL;
+
+		//The shared memory is reserved once, with room for the largest arena twice over so
+		//it can be rebuilt without forking again
+		GridArena largest;
+		AddGrids( largest, true );
+
+		mProcessGroup = new ProcessGroup( num_processes, 2 * largest.GetBlockSize( true ) );
+
+		if( num_threads > 1 )
+		{
+			mThreadPool = new ThreadPool( num_threads );
+		}
+
+		if( mProcessGroup->GetNumProcesses() > 1 )
+		{
+			PlaceGrids( mHugePages );
+		}
+		else
+		{
+			delete mProcessGroup;
+			mProcessGroup = NULL;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::SetTaskGraph( bool enable )
+{
+	if( enable && mTaskGraph == NULL )
+	{
+		mTaskGraph = new TaskGraph();
+	}
+	else if( ! enable )
+	{
+		delete mTaskGraph;
+		mTaskGraph = NULL;
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::SetHugePages( bool enable )
+{
+	if( enable != mHugePages )
+	{
+		mHugePages = enable;
+		PlaceGrids( enable );
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::SetSimdLevel( Simd::Level level )
+{
+	//Never pick something the CPU can't run, the scalar kernels are always available as a reference
+	mAdvectKernel = AdvectKernels::Get( std::min( level, Simd::DetectLevel() ) );
+	mAdvectDensityKernel = AdvectKernels::GetInterleaved( std::min( level, Simd::DetectLevel() ) );
+	mAdvectDensityFloat16Kernel = AdvectKernels::GetInterleavedFloat16( std::min( level, Simd::DetectLevel() ) );
+	mAdvectDensityBFloat16Kernel = AdvectKernels::GetInterleavedBFloat16( std::min( level, Simd::DetectLevel() ) );
+	mForceKernel = ForceKernels::Get( std::min( level, Simd::DetectLevel() ) );
+	mForceFloat16Kernel = ForceKernels::GetFloat16( std::min( level, Simd::DetectLevel() ) );
+	mForceBFloat16Kernel = ForceKernels::GetBFloat16( std::min( level, Simd::DetectLevel() ) );
+	mCorrectKernel = AdvectKernels::GetCorrect( std::min( level, Simd::DetectLevel() ) );
+	mCorrectDensityKernel = AdvectKernels::GetInterleavedCorrect( std::min( level, Simd::DetectLevel() ) );
+	mCorrectDensityFloat16Kernel = AdvectKernels::GetInterleavedCorrectFloat16( std::min( level, Simd::DetectLevel() ) );
+	mCorrectDensityBFloat16Kernel = AdvectKernels::GetInterleavedCorrectBFloat16( std::min( level, Simd::DetectLevel() ) );
+	mJacobiKernel = JacobiKernels::Get( std::min( level, Simd::DetectLevel() ) );
+	mJacobiFloat16Kernel = JacobiKernels::GetFloat16( std::min( level, Simd::DetectLevel() ) );
+	mJacobiBFloat16Kernel = JacobiKernels::GetBFloat16( std::min( level, Simd::DetectLevel() ) );
+}
+
+//------------------------------------------------------------------------------
+const FluidSim::SolverStats& FluidSim::GetPressureStats() const
+{
+	return mPressureStats;
+}
+
+//------------------------------------------------------------------------------
+const FluidSim::SolverStats& FluidSim::GetDiffusionStats() const
+{
+	return mDiffusionStats;
+}
+
+//------------------------------------------------------------------------------
+uint FluidSim::GetNumActiveTiles() const
+{
+	return mNumActiveTiles;
+}
+
+//------------------------------------------------------------------------------
+uint FluidSim::GetProcessCount() const
+{
+	return mProcessGroup != NULL ? mProcessGroup->GetNumProcesses() : 1;
+}
+
+//------------------------------------------------------------------------------
+const TaskGraph* FluidSim::GetTaskGraph() const
+{
+	return mTaskGraph;
+}
+
+//------------------------------------------------------------------------------
+uint FluidSim::GetStride() const
+{
+	return mStride;
+}
+
+//------------------------------------------------------------------------------
+const GridArena& FluidSim::GetArena() const
+{
+	return *mArena;
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::Draw( PixelToaster::vector<PixelToaster::Pixel>& out_pixels, bool clamp_colours, bool show_sources, bool show_velocity ) const
+{
+	if( out_pixels.size() != mNumPoints )
+	{
+		out_pixels.resize( mNumPoints );
+	}
+
+	for( uint pixel = 0; pixel < mNumPoints; ++pixel )
+	{
+		//Pixels are packed, the grids have padded rows
+		const uint i = IDX( pixel % mSizeX, pixel / mSizeX );
+
+		float density[ DENSITY_CHANNELS ];
+		LoadDensity( i, density );
+
+		float cr = density[0];
+		float cg = density[1];
+		float cb = density[2];
+
+		if( clamp_colours )
+		{
+			const float cmax = std::max( cr, std::max( cg, cb ) );
+
+			if( cmax > 1.0f )
+			{
+				cr /= cmax;
+				cb /= cmax;
+				cg /= cmax;
+			}
+		}
+
+		out_pixels[ pixel ].r = cr;
+		out_pixels[ pixel ].g = cg;
+		out_pixels[ pixel ].b = cb;
+
+		if( show_velocity )
+		{
+			const float v = abs( mVelocitiesU[ i ] ) + abs( mVelocitiesV[ i ] ) / 2.0f;
+			out_pixels[ pixel ].r = v;
+			out_pixels[ pixel ].g = v;
+			out_pixels[ pixel ].b = v;
+		}
+
+		if( show_sources )
+		{
+			float source[ DENSITY_CHANNELS ];
+			LoadSource( i, source );
+
+			float r = source[0];
+			float g = source[1];
+			float b = source[2];
+
+			const float max = std::max( r, std::max( g, b ) );
+			
+			if( max > 0.0f )
+			{
+				//Scale back to 0..1
+				r /= max;
+				g /= max;
+				b /= max;
+
+				out_pixels[ pixel ].r = r;
+				out_pixels[ pixel ].g = g;
+				out_pixels[ pixel ].b = b;
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename T, typename Kernel, typename Correct >
+void FluidSim::DensityStep( T* x, float* x0, const T* s, float* u, float* v, float diff, float decay, float dt, Kernel kernel, Correct correct )
+{
+	//All channels of a cell sit together, so each pass below handles every channel in one sweep.
+	//x is the stored precision, diffusion reads it as its right hand side and advection writes it.
+	AddSources( x, s, dt, DENSITY_CHANNELS, 1, mSizeY-1 );
+	Diffuse( 0, x0, x, diff, dt, mDiffusionStats, DENSITY_CHANNELS );
+	AdvectDensity( x, x0, u, v, decay * dt, dt, kernel, correct );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::VelocityStep( float* u, float* v, float* u0, float* v0, float visc, float dt )
+{
+	AddForces( u, v, u0, v0, dt, 1, mSizeY-1 );
+	SWAP( u0, u ); Diffuse( 1, u, u0, visc, dt, mDiffusionStats );
+	SWAP( v0, v ); Diffuse( 2, v, v0, visc, dt, mDiffusionStats );
+	Project( u, v, u0, v0, 0 );
+	SWAP( u0, u ); SWAP( v0, v );
+	const int b[]			= { 1, 2 };
+	float* const d[]		= { u, v };
+	float* const d0[]		= { u0, v0 };
+	Advect( b, d, d0, 2, u0, v0, dt );
+	Project( u, v, u0, v0, 1 );
+}
+
+//------------------------------------------------------------------------------
+template< typename T, typename Kernel, typename Correct >
+void FluidSim::UpdateGraph( T* x, const T* s, float dt, Kernel kernel, Correct correct )
+{
+	//The same passes as DensityStep and VelocityStep. The per cell passes are split into tasks of a
+	//tile row each, which only wait for the tasks that wrote the cells they read. Solves and
+	//projections need the whole grid, so they're single tasks that wait for a whole pass, as is
+	//MacCormack advection, whose backward pass reads anywhere in the forward one.
+	float* x0 = mDensities0;
+	float* u = mVelocitiesU;
+	float* v = mVelocitiesV;
+	float* u0 = mVelocitiesU0;
+	float* v0 = mVelocitiesV0;
+
+	const float diff = mDiffusion;
+	const float visc = mViscosity;
+	const float decay = mDecay * dt;
+	const float dt0 = dt * mSizeX;
+	const uint num_blocks = mTilesY;
+	const bool maccormack = mAdvectionScheme == ADVECTION_MACCORMACK;
+
+	TaskGraph& graph = *mTaskGraph;
+	graph.Clear();
+
+	std::vector<TaskGraph::Task> add_density( num_blocks );
+	std::vector<TaskGraph::Task> advect_density( num_blocks );
+	std::vector<TaskGraph::Task> add_velocity( num_blocks );
+	std::vector<TaskGraph::Task> advect_velocity( num_blocks );
+
+	//Densities
+	for( uint block = 0; block < num_blocks; ++block )
+	{
+		const uint y_begin	= 1 + (block * TILE_SIZE);
+		const uint y_end	= std::min( y_begin + TILE_SIZE, mSizeY-1 );
+
+		add_density[ block ] = graph.Add( [=]()
+		{
+			AddSources( x, s, dt, DENSITY_CHANNELS, y_begin, y_end );
+		} );
+	}
+
+	const TaskGraph::Task diffuse_density = graph.Add( [=]()
+	{
+		Diffuse( 0, x0, x, diff, dt, mDiffusionStats, DENSITY_CHANNELS );
+	} );
+
+	if( maccormack )
+	{
+		const TaskGraph::Task advect = graph.Add( [=]()
+		{
+			AdvectDensity( x, x0, u, v, decay, dt, kernel, correct );
+		} );
+		graph.Depend( advect, diffuse_density );
+
+		std::fill( advect_density.begin(), advect_density.end(), advect );
+	}
+
+	for( uint block = 0; block < num_blocks; ++block )
+	{
+		const uint y_begin	= 1 + (block * TILE_SIZE);
+		const uint y_end	= std::min( y_begin + TILE_SIZE, mSizeY-1 );
+
+		graph.Depend( diffuse_density, add_density[ block ] );
+
+		if( ! maccormack )
+		{
+			advect_density[ block ] = graph.Add( [=]()
+			{
+				ForEachAdvectSpan( y_begin, y_end, &x0, 1, DENSITY_CHANNELS, u, v, dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+				{
+					kernel( x, x0, u, v, dt0, decay, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+				} );
+			} );
+			graph.Depend( advect_density[ block ], diffuse_density );
+		}
+
+		//Advection only reads the velocity of the cell it's tracing back from, and gravity only the
+		//density just advected into it, so each block of forces only waits for its own block
+		add_velocity[ block ] = graph.Add( [=]()
+		{
+			AddForces( u, v, u0, v0, dt, y_begin, y_end );
+		} );
+		graph.Depend( add_velocity[ block ], advect_density[ block ] );
+	}
+
+	if( ! maccormack )
+	{
+		const TaskGraph::Task density_boundary = graph.Add( [=]()
+		{
+			SetBnd( 0, x, DENSITY_CHANNELS );
+		} );
+
+		for( uint block = 0; block < num_blocks; ++block )
+		{
+			graph.Depend( density_boundary, advect_density[ block ] );
+		}
+	}
+
+	//Velocities. The two diffusions are independent, apart from sharing the conjugate gradient or
+	//Jacobi workspace.
+	SolverStats u_stats;
+	SolverStats v_stats;
+	ResetStats( u_stats );
+	ResetStats( v_stats );
+
+	SWAP( u0, u );
+	const TaskGraph::Task diffuse_u = graph.Add( [=, &u_stats]()
+	{
+		Diffuse( 1, u, u0, visc, dt, u_stats );
+	} );
+
+	SWAP( v0, v );
+	const TaskGraph::Task diffuse_v = graph.Add( [=, &v_stats]()
+	{
+		Diffuse( 2, v, v0, visc, dt, v_stats );
+	} );
+
+	for( uint block = 0; block < num_blocks; ++block )
+	{
+		graph.Depend( diffuse_u, add_velocity[ block ] );
+		graph.Depend( diffuse_v, add_velocity[ block ] );
+	}
+
+	if( mDiffusionSolver != SOLVER_GAUSS_SEIDEL && mDiffusionSolver != SOLVER_GAUSS_SEIDEL_WAVEFRONT && mDiffusionSolver != SOLVER_RED_BLACK_GAUSS_SEIDEL && mDiffusionSolver != SOLVER_SUCCESSIVE_OVER_RELAXATION )
+	{
+		graph.Depend( diffuse_v, diffuse_u );
+	}
+
+	const TaskGraph::Task project0 = graph.Add( [=]()
+	{
+		Project( u, v, u0, v0, 0 );
+	} );
+	graph.Depend( project0, diffuse_u );
+	graph.Depend( project0, diffuse_v );
+
+	SWAP( u0, u ); SWAP( v0, v );
+	TaskGraph::Task velocity_boundary;
+
+	if( maccormack )
+	{
+		velocity_boundary = graph.Add( [=]()
+		{
+			const int b[]			= { 1, 2 };
+			float* const d[]		= { u, v };
+			float* const d0[]		= { u0, v0 };
+			Advect( b, d, d0, 2, u0, v0, dt );
+		} );
+		graph.Depend( velocity_boundary, project0 );
+	}
+	else
+	{
+		velocity_boundary = graph.Add( [=]()
+		{
+			SetBnd( 1, u );
+			SetBnd( 2, v );
+		} );
+
+		for( uint block = 0; block < num_blocks; ++block )
+		{
+			const uint y_begin	= 1 + (block * TILE_SIZE);
+			const uint y_end	= std::min( y_begin + TILE_SIZE, mSizeY-1 );
+
+			advect_velocity[ block ] = graph.Add( [=]()
+			{
+				float* const d[]		= { u, v };
+				float* const d0[]		= { u0, v0 };
+
+				ForEachAdvectSpan( y_begin, y_end, d0, 2, 1, u0, v0, dt0, [&]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+				{
+					mAdvectKernel( d, d0, 2, u0, v0, dt0, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+				} );
+			} );
+			graph.Depend( advect_velocity[ block ], project0 );
+			graph.Depend( velocity_boundary, advect_velocity[ block ] );
+		}
+	}
+
+	const TaskGraph::Task project1 = graph.Add( [=]()
+	{
+		Project( u, v, u0, v0, 1 );
+	} );
+	graph.Depend( project1, velocity_boundary );
+
+	//The kernels' own row splitting would need the pool the graph is already running on
+	mRunningGraph = true;
+	graph.Run( mThreadPool );
+	mRunningGraph = false;
+
+	MergeStats( mDiffusionStats, u_stats );
+	MergeStats( mDiffusionStats, v_stats );
+}
+
+//------------------------------------------------------------------------------
+template< typename T >
+void FluidSim::AddSources( T* x, const T* s, float dt, uint channels, uint y_begin, uint y_end )
+{
+	//Ghost cells are left alone, the next SetBnd overwrites them before anything reads them
+	ForEachSpan( y_begin, y_end, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+	{
+		for( uint y = span_y_begin; y < span_y_end; ++y )
+		{
+			for( uint i = IDX(x_begin,y) * channels, end = IDX(x_end,y) * channels; i < end; ++i )
+			{
+				x[ i ] = T( x[ i ] + dt * s[ i ] );
+			}
+		}
+	} );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::AddForces( float* u, float* v, const float* u0, const float* v0, float dt, uint y_begin, uint y_end )
+{
+	//Velocity sources and gravity in one pass, so each cell's velocities are only loaded and stored once
+	const float gu = mGravityU * dt;
+	const float gv = mGravityV * dt;
+
+	ForEachSpan( y_begin, y_end, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+	{
+		switch( mPrecision )
+		{
+		case PRECISION_FLOAT32:		mForceKernel( u, v, u0, v0, mDensities, dt, gu, gv, mStride, x_begin, x_end, span_y_begin, span_y_end );									break;
+		case PRECISION_FLOAT16:		mForceFloat16Kernel( u, v, u0, v0, (const Half::Float16*)mDensitiesHalf, dt, gu, gv, mStride, x_begin, x_end, span_y_begin, span_y_end );		break;
+		case PRECISION_BFLOAT16:	mForceBFloat16Kernel( u, v, u0, v0, (const Half::BFloat16*)mDensitiesHalf, dt, gu, gv, mStride, x_begin, x_end, span_y_begin, span_y_end );	break;
+		}
+	} );
+}
+
+//------------------------------------------------------------------------------
+template< typename Rhs >
+void FluidSim::Diffuse( int b, float* d, const Rhs* d0, float diff, float dt, SolverStats& stats, uint channels )
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const float a = dt * diff * mSizeX * mSizeY;
+	const float c = 1+4.0f*a;
+
+	if( mDiffusionError <= 0.0f )
+	{
+		LinearSolve( b, d, d0, a, c, mDiffusionSolver, mDiffusionPolicy, stats, channels );
+		stats.mPaths[ DIFFUSION_SOLVE ] += 1;
+		return;
+	}
+
+	//Bounds on the relative error of each shortcut come from the mode diffusion changes most, the
+	//checkerboard. The Laplacian scales it by -8, so the implicit step keeps 1/(1+8a) of it, an
+	//explicit step 1-8a and a copy all of it.
+	const float skip_error		= (8.0f*a) / (1.0f + 8.0f*a);
+	const float explicit_error	= (64.0f*a*a) / (1.0f + 8.0f*a);
+
+	DiffusionPath path = DIFFUSION_SOLVE;
+	uint sweeps = 0;
+
+	if( skip_error <= mDiffusionError )
+	{
+		path = DIFFUSION_SKIP;
+	}
+	else if( explicit_error <= mDiffusionError )
+	{
+		path = DIFFUSION_EXPLICIT;
+	}
+	else
+	{
+		//A red-black half sweep shrinks the error by the Jacobi radius. The second half of every sweep
+		//does it again for the cells the first half just updated, so k sweeps give rho^(2k - 1).
+		const float rho = JacobiRadius( a, c );
+		const float half_sweeps = logf( mDiffusionError / std::min( skip_error, explicit_error ) ) / logf( rho );
+		sweeps = (uint)ceilf( 0.5f * (half_sweeps + 1.0f) );
+
+		//Gauss-Seidel in row order converges at the same rate, the square of the Jacobi radius
+		//per sweep. Other solvers converge differently, so they always get the full solve.
+		const bool gauss_seidel = ( mDiffusionSolver == SOLVER_GAUSS_SEIDEL || mDiffusionSolver == SOLVER_GAUSS_SEIDEL_WAVEFRONT || mDiffusionSolver == SOLVER_RED_BLACK_GAUSS_SEIDEL );
+
+		if( gauss_seidel && sweeps <= SOLVER_ITERATIONS )
+		{
+			path = DIFFUSION_SWEEPS;
+		}
+	}
+
+	stats.mPaths[ path ] += 1;
+
+	if( path == DIFFUSION_SOLVE )
+	{
+		//A fixed count can't promise the error, so the default runs to it instead
+		SolverPolicy policy = mDiffusionPolicy;
+		if( policy.mMode == SolverPolicy::MODE_FIXED && policy.mIterations == 0 )
+		{
+			policy = SolverPolicy::Tolerance( mDiffusionError, SOLVER_MAX_ITERATIONS, SOLVER_ITERATIONS );
+		}
+
+		LinearSolve( b, d, d0, a, c, mDiffusionSolver, policy, stats, channels );
+		return;
+	}
+
+	const Clock::time_point start = Clock::now();
+	ExplicitDiffuse( b, d, d0, ( path == DIFFUSION_SKIP || skip_error < explicit_error ) ? 0.0f : a, channels );
+	stats.mMilliseconds += std::chrono::duration<float, std::milli>( Clock::now() - start ).count();
+
+	if( path == DIFFUSION_SWEEPS )
+	{
+		LinearSolve( b, d, d0, a, c, mDiffusionSolver, SolverPolicy::Fixed( sweeps ), stats, channels );
+	}
+	else
+	{
+		stats.mSolves += 1;
+	}
+}
+
+//------------------------------------------------------------------------------
+//d = d0 + a (sum of neighbours - 4 d0), or a copy of d0 with a zero, with d's ghost cells filled.
+//d0's ghost cells are from before the sources or forces were added, which only touch the interior.
+template< typename Rhs >
+void FluidSim::ExplicitDiffuse( int b, float* d, const Rhs* d0, float a, uint channels )
+{
+	const uint row_stride = mStride * channels;
+
+	ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			uint num_spans;
+			const Span* spans = GetRowSpans( y, num_spans );
+
+			for( uint s = 0; s < num_spans; ++s )
+			{
+				for( uint i = IDX(spans[s].mBegin,y) * channels, end = IDX(spans[s].mEnd,y) * channels; i < end; ++i )
+				{
+					const float centre = d0[i];
+					d[i] = centre + a*((float( d0[i-channels] ) + float( d0[i+channels] ) + float( d0[i-row_stride] ) + float( d0[i+row_stride] )) - 4.0f*centre);
+				}
+			}
+
+			SetBoundaryRow( b, d, mSizeX, mSizeY, mStride, y, channels );
+		}
+	} );
+
+	SetBoundaryCorners( d, mSizeX, mSizeY, mStride, channels );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::Advect( const int* b, float* const* d, float* const* d0, uint num_fields, float* u, float* v, float dt )
+{
+	const float dt0 = dt * mSizeX;
+
+	ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+	{
+		ForEachAdvectSpan( y_begin, y_end, d0, num_fields, 1, u, v, dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+		{
+			mAdvectKernel( d, d0, num_fields, u, v, dt0, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+		} );
+	} );
+
+	for( uint f = 0; f < num_fields; ++f )
+	{
+		SetBnd( b[f], d[f] );
+	}
+
+	if( mAdvectionScheme == ADVECTION_MACCORMACK )
+	{
+		//Trace d back along the same velocities, then correct it in place
+		assert( num_fields <= DENSITY_CHANNELS );
+
+		float* back[ DENSITY_CHANNELS ];
+		for( uint f = 0; f < num_fields; ++f )
+		{
+			back[f] = mAdvectBackward + (f * mNumCells);
+		}
+
+		ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+		{
+			ForEachAdvectSpan( y_begin, y_end, d, num_fields, 1, u, v, -dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+			{
+				mAdvectKernel( back, d, num_fields, u, v, -dt0, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+			} );
+		} );
+
+		ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+		{
+			ForEachAdvectSpan( y_begin, y_end, d0, num_fields, 1, u, v, dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+			{
+				mCorrectKernel( d, d0, back, num_fields, u, v, dt0, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+			} );
+		} );
+
+		for( uint f = 0; f < num_fields; ++f )
+		{
+			SetBnd( b[f], d[f] );
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename T, typename Kernel, typename Correct >
+void FluidSim::AdvectDensity( T* d, float* d0, float* u, float* v, float decay, float dt, Kernel kernel, Correct correct )
+{
+	const float dt0 = dt * mSizeX;
+
+	if( mAdvectionScheme == ADVECTION_MACCORMACK )
+	{
+		//Forward and back in float without decay, the correction applies it and rounds to storage
+		float* hat = mAdvectForward;
+		float* back = mAdvectBackward;
+
+		ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+		{
+			ForEachAdvectSpan( y_begin, y_end, &d0, 1, DENSITY_CHANNELS, u, v, dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+			{
+				mAdvectDensityKernel( hat, d0, u, v, dt0, 0.0f, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+			} );
+		} );
+
+		//The backward pass samples hat anywhere, so it needs the same zeros and ghost cells as d0
+		if( ! AllTilesActive() )
+		{
+			ClearInactiveTiles( hat, DENSITY_CHANNELS );
+		}
+		SetBnd( 0, hat, DENSITY_CHANNELS );
+
+		ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+		{
+			ForEachAdvectSpan( y_begin, y_end, &hat, 1, DENSITY_CHANNELS, u, v, -dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+			{
+				mAdvectDensityKernel( back, hat, u, v, -dt0, 0.0f, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+			} );
+		} );
+
+		ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+		{
+			ForEachAdvectSpan( y_begin, y_end, &d0, 1, DENSITY_CHANNELS, u, v, dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+			{
+				correct( d, hat, d0, back, u, v, dt0, decay, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+			} );
+		} );
+
+		SetBnd( 0, d, DENSITY_CHANNELS );
+		return;
+	}
+
+	//Decay is applied as each cell is written rather than in a separate pass
+	ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+	{
+		ForEachAdvectSpan( y_begin, y_end, &d0, 1, DENSITY_CHANNELS, u, v, dt0, [=]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+		{
+			kernel( d, d0, u, v, dt0, decay, mSizeX, mSizeY, mStride, x_begin, x_end, span_y_begin, span_y_end );
+		} );
+	} );
+
+	SetBnd( 0, d, DENSITY_CHANNELS );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::Project( float* u, float* v, float* p, float* div, uint call_site )
+{
+	const float h = 1.0f / mSizeX;
+
+	ForEachSpan( 1, mSizeY-1, [=]( uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			for( uint x = x_begin; x < x_end; ++x )
+			{
+				div[IDX(x,y)] = -0.5f * h * ( u[IDX(x+1,y)] - u[IDX(x-1,y)] + v[IDX(x,y+1)] - v[IDX(x, y-1)] );
+			}
+		}
+	} );
+
+	//The last pressure solved at this call site is a far better first guess than zero. It's copied
+	//through p rather than solved in place because VelocityStep leaves p behind in u0 for the next step.
+	if( mWarmStartPressure )
+	{
+		assert( call_site < NUM_PROJECT_CALLS );
+		memcpy( p, mPressures[ call_site ], mNumCells * sizeof(float) );
+	}
+	else
+	{
+		memset( p, 0, mNumCells * sizeof(float) );
+	}
+
+	SetBnd( 0, div );
+	SetBnd( 0, p );
+
+	LinearSolve<true>( 0, p, div, 1, 4, mPressureSolver, mPressurePolicy, mPressureStats, 1, &mPressureIterations[ call_site ] );
+
+	if( mWarmStartPressure )
+	{
+		//Only the gradient is used, but the constant part isn't controlled by the solve and would drift from
+		//frame to frame. With some tiles inactive the zero pressure around them already pins it.
+		if( AllTilesActive() )
+		{
+			RemoveMean( p );
+		}
+
+		memcpy( mPressures[ call_site ], p, mNumCells * sizeof(float) );
+	}
+
+	ForEachSpan( 1, mSizeY-1, [=]( uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			for( uint x = x_begin; x < x_end; ++x )
+			{
+				u[IDX(x,y)] -= 0.5f*(p[IDX(x+1,y)]-p[IDX(x-1,y)])/h;
+				v[IDX(x,y)] -= 0.5f*(p[IDX(x,y+1)]-p[IDX(x,y-1)])/h;
+			}
+		}
+	} );
+
+	SetBnd( 1, u );
+	SetBnd( 2, v );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::RemoveMean( float* d )
+{
+	double sum = 0.0;
+	for( uint y = 1; y < (mSizeY-1); ++y )
+	{
+		for( uint x = 1; x < (mSizeX-1); ++x )
+		{
+			sum += d[IDX(x,y)];
+		}
+	}
+
+	const float mean = (float)( sum / ((mSizeX-2) * (mSizeY-2)) );
+	for( uint y = 0; y < mSizeY; ++y )
+	{
+		for( uint x = 0; x < mSizeX; ++x )
+		{
+			d[IDX(x,y)] -= mean;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< bool Pressure, typename Rhs >
+void FluidSim::LinearSolve( int b, float* d, const Rhs* d0, float a, float c, Solver solver, const SolverPolicy& policy, SolverStats& stats, uint channels, uint* expected_iterations )
+{
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point start = Clock::now();
+
+	uint iterations = 0;
+	float residual = -1.0f;
+
+	if( solver == SOLVER_CONJUGATE_GRADIENT_JACOBI || solver == SOLVER_CONJUGATE_GRADIENT_MIC )
+	{
+		const ConjugateGradient::Preconditioner preconditioner = solver == SOLVER_CONJUGATE_GRADIENT_JACOBI ? ConjugateGradient::PRECONDITIONER_JACOBI : ConjugateGradient::PRECONDITIONER_MIC;
+
+		//Conjugate gradient's default is to converge rather than run a fixed count
+		float tolerance = policy.mTolerance;
+		uint max_iterations = policy.mIterations;
+		float time_budget = policy.mMode == SolverPolicy::MODE_TIME_BUDGET ? policy.mTimeBudget : 0.0f;
+
+		if( policy.mMode == SolverPolicy::MODE_FIXED )
+		{
+			tolerance		= policy.mIterations == 0 ? SOLVER_TOLERANCE : 0.0f;
+			max_iterations	= policy.mIterations == 0 ? SOLVER_MAX_ITERATIONS : policy.mIterations;
+		}
+
+		if( channels > 1 )
+		{
+			iterations = mConjugateGradient->SolveInterleaved( b, d, d0, channels, a, c, tolerance, max_iterations, preconditioner, time_budget );
+		}
+		else
+		{
+			std::vector<float> scratch;
+			iterations = mConjugateGradient->Solve( b, d, FloatGrid( d0, mNumCells, scratch ), a, c, tolerance, max_iterations, preconditioner, time_budget );
+		}
+
+		residual = mConjugateGradient->GetLastResidual();
+
+		//Conjugate gradient works on the whole grid, keep the inactive tiles at zero
+		if( ! AllTilesActive() )
+		{
+			ClearInactiveTiles( d, channels );
+		}
+	}
+	else if( solver == SOLVER_SPECTRAL )
+	{
+		//A direct solve, so there's nothing for the policy to control beyond whether to report the residual
+		assert( b == 0 && a == 1 && c == 4 && channels == 1 );
+
+		std::vector<float> scratch;
+		mSpectralPoisson->Solve( d, FloatGrid( d0, mNumCells, scratch ) );
+		iterations = 1;
+
+		if( ! AllTilesActive() )
+		{
+			ClearInactiveTiles( d, channels );
+		}
+
+		if( policy.mMode != SolverPolicy::MODE_FIXED )
+		{
+			residual = RelativeResidual( b, d, d0, a, c, channels );
+		}
+	}
+	else
+	{
+		const bool multigrid = ( solver == SOLVER_MULTIGRID_V || solver == SOLVER_MULTIGRID_F );
+
+		uint max_iterations = policy.mIterations;
+		uint interval = std::max( policy.mCheckInterval, 1u );
+
+		if( policy.mMode == SolverPolicy::MODE_FIXED )
+		{
+			if( max_iterations == 0 )
+			{
+				max_iterations = multigrid ? MULTIGRID_CYCLES : SOLVER_ITERATIONS;
+			}
+
+			interval = max_iterations;
+		}
+
+		const bool check_residual = ( policy.mMode == SolverPolicy::MODE_TOLERANCE || ( policy.mMode == SolverPolicy::MODE_TIME_BUDGET && policy.mTolerance > 0.0f ) );
+
+		//The accelerated solvers are tuned for the number of iterations they'll get. When the policy stops
+		//early that isn't known up front, so the caller can pass in the count from its last solve of the same
+		//system. The two feed back into each other and settle, a solve that runs long raises the next one's
+		//acceleration and a short one lowers it.
+		uint expected = max_iterations;
+		if( policy.mMode != SolverPolicy::MODE_FIXED && expected_iterations != NULL && *expected_iterations > 0 )
+		{
+			expected = std::min( *expected_iterations, max_iterations );
+		}
+
+		while( iterations < max_iterations )
+		{
+			const uint count = std::min( interval, max_iterations - iterations );
+			RunIterations<Pressure>( b, d, d0, a, c, solver, iterations, count, expected, channels );
+			iterations += count;
+
+			//As does multigrid
+			if( multigrid && ! AllTilesActive() )
+			{
+				ClearInactiveTiles( d, channels );
+			}
+
+			if( check_residual )
+			{
+				residual = RelativeResidual( b, d, d0, a, c, channels );
+				if( residual <= policy.mTolerance )
+				{
+					break;
+				}
+			}
+
+			if( policy.mMode == SolverPolicy::MODE_TIME_BUDGET && std::chrono::duration<float, std::milli>( Clock::now() - start ).count() >= policy.mTimeBudget )
+			{
+				break;
+			}
+		}
+	}
+
+	//Averaged with the last estimate, a solve that happened to stop early would otherwise make the next run long
+	if( expected_iterations != NULL )
+	{
+		*expected_iterations = ( *expected_iterations > 0 ) ? (*expected_iterations + iterations + 1) / 2 : iterations;
+	}
+
+	stats.mSolves		+= 1;
+	stats.mIterations	+= iterations;
+	stats.mResidual		= std::max( stats.mResidual, residual );
+	stats.mMilliseconds	+= std::chrono::duration<float, std::milli>( Clock::now() - start ).count();
+}
+
+//------------------------------------------------------------------------------
+template< typename Rhs >
+float FluidSim::RelativeResidual( int b, const float* d, const Rhs* d0, float a, float c, uint channels ) const
+{
+	const uint row_stride = mStride * channels;
+
+	double rr = 0.0;
+	double bb = 0.0;
+	double sum = 0.0;
+
+	for( uint y = 1; y < (mSizeY-1); ++y )
+	{
+		uint num_spans;
+		const Span* spans = GetRowSpans( y, num_spans );
+
+		for( uint s = 0; s < num_spans; ++s )
+		{
+			for( uint i = IDX(spans[s].mBegin,y) * channels, end = IDX(spans[s].mEnd,y) * channels; i < end; ++i )
+			{
+				const float rhs = d0[i];
+				const float r = rhs - (c*d[i] - a*(d[i-channels] + d[i+channels] + d[i-row_stride] + d[i+row_stride]));
+				rr	+= r * r;
+				bb	+= rhs * rhs;
+				sum	+= r;
+			}
+		}
+	}
+
+	//As in ConjugateGradient, the pressure system can only remove the zero mean part of the residual.
+	//Inactive tiles hold it at zero around the edges of the active ones, which removes the null space.
+	if( b != 1 && b != 2 && c == 4.0f*a && channels == 1 && AllTilesActive() )
+	{
+		rr -= (sum * sum) / ((mSizeX-2) * (mSizeY-2));
+	}
+
+	return bb > 0.0 ? (float)std::sqrt( std::max( rr, 0.0 ) / bb ) : 0.0f;
+}
+
+//------------------------------------------------------------------------------
+template< bool Pressure, typename Rhs >
+void FluidSim::RunIterations( int b, float* d, const Rhs* d0, float a, float c, Solver solver, uint first, uint iterations, uint expected_iterations, uint channels )
+{
+	switch( solver )
+	{
+	case SOLVER_GAUSS_SEIDEL:
+	case SOLVER_GAUSS_SEIDEL_WAVEFRONT:
+	case SOLVER_RED_BLACK_GAUSS_SEIDEL:
+	case SOLVER_JACOBI_CHEBYSHEV:
+	case SOLVER_SUCCESSIVE_OVER_RELAXATION:
+		//The boundary type is fixed for the whole solve, so pick the sweeps for it once
+		switch( b )
+		{
+		case 1:		RunSweeps<1, Pressure>( d, d0, a, c, solver, first, iterations, expected_iterations, channels );	break;
+		case 2:		RunSweeps<2, Pressure>( d, d0, a, c, solver, first, iterations, expected_iterations, channels );	break;
+		default:	RunSweeps<0, Pressure>( d, d0, a, c, solver, first, iterations, expected_iterations, channels );	break;
+		}
+		break;
+
+	case SOLVER_MULTIGRID_V:
+	case SOLVER_MULTIGRID_F:
+		{
+			assert( b == 0 && a == 1 && c == 4 && channels == 1 );
+
+			std::vector<float> scratch;
+			mMultigrid->Solve( d, FloatGrid( d0, mNumCells, scratch ), iterations, solver == SOLVER_MULTIGRID_V ? Multigrid::CYCLE_V : Multigrid::CYCLE_F );
+		}
+		break;
+
+	default:
+		//Conjugate gradient keeps state between iterations, so LinearSolve runs it directly
+		assert( false );
+		break;
+	}
+}
+
+//------------------------------------------------------------------------------
+template< int B, bool Pressure, typename Rhs >
+void FluidSim::RunSweeps( float* d, const Rhs* d0, float a, float c, Solver solver, uint first, uint iterations, uint expected_iterations, uint channels )
+{
+	//Every row refreshes its own ghost cells as soon as it's updated, see SetBoundaryRow, so none of
+	//the sweeps need a separate boundary pass. Only the corners are left for the end.
+	switch( solver )
+	{
+	case SOLVER_GAUSS_SEIDEL:
+		for( uint k = 0; k < iterations; ++k )
+		{
+			for( uint y = 1; y < (mSizeY-1); ++y )
+			{
+				GaussSeidelRow<B, Pressure>( d, d0, a, c, channels, y );
+			}
+		}
+		break;
+
+	case SOLVER_GAUSS_SEIDEL_WAVEFRONT:
+		{
+			//Sweep k trails sweep k-1 by one row, so row y-1 sees sweep k's new values and row y+1
+			//still holds sweep k-1's, exactly as in separate sweeps. Only the iterations+2 rows
+			//around the wavefront are touched at a time, so they stay in cache.
+			const uint num_rows = mSizeY-2;
+
+			for( uint t = 0; t < num_rows + iterations - 1; ++t )
+			{
+				for( uint k = 0; k < iterations && k <= t; ++k )
+				{
+					const uint y = t - k + 1;
+					if( y > num_rows )
+					{
+						continue;
+					}
+
+					GaussSeidelRow<B, Pressure>( d, d0, a, c, channels, y );
+				}
+			}
+		}
+		break;
+
+	case SOLVER_RED_BLACK_GAUSS_SEIDEL:
+	case SOLVER_SUCCESSIVE_OVER_RELAXATION:
+		{
+			const float omega = ( solver == SOLVER_SUCCESSIVE_OVER_RELAXATION ) ? RelaxationFactor( a, c, expected_iterations ) : 1.0f;
+
+			//Every grid a solve works on is in the shared arena. The workers have no spans, so they sweep whole rows.
+			if( mProcessGroup != NULL && ! mRunningGraph && AllTilesActive() )
+			{
+				const RedBlackArgs<Rhs> args = { d, d0, a, c, omega, channels, iterations, mSizeX, mSizeY, mStride };
+				mProcessGroup->Run( RedBlackJob<B, Rhs>, &args, sizeof(args) );
+				break;
+			}
+
+			for( uint k = 0; k < iterations; ++k )
+			{
+				//Cells of one colour only depend on the other colour, so each half sweep splits into row blocks
+				for( uint colour = 0; colour < 2; ++colour )
+				{
+					ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+					{
+						RedBlackSweep<B>( d, d0, a, c, omega, colour, channels, y_begin, y_end );
+					} );
+				}
+			}
+		}
+		break;
+
+	case SOLVER_JACOBI_CHEBYSHEV:
+		ChebyshevSweeps<B>( d, d0, a, c, first, iterations, expected_iterations, channels );
+		break;
+
+	default:
+		assert( false );
+		break;
+	}
+
+	SetBoundaryCorners( d, mSizeX, mSizeY, mStride, channels );
+}
+
+//------------------------------------------------------------------------------
+//Project's pressure solve sums the divergence in first, as FluidSim always has, so the
+//default solver's results don't depend on it sharing this loop with Diffuse
+template< int B, bool Pressure, typename Rhs >
+void FluidSim::GaussSeidelRow( float* d, const Rhs* d0, float a, float c, uint channels, uint y )
+{
+	const uint row_stride = mStride * channels;
+
+	uint num_spans;
+	const Span* spans = GetRowSpans( y, num_spans );
+
+	for( uint s = 0; s < num_spans; ++s )
+	{
+		for( uint x = spans[s].mBegin; x < spans[s].mEnd; ++x )
+		{
+			//Channels are independent, so the cell's channels update together
+			for( uint i = IDX(x,y) * channels, end = i + channels; i < end; ++i )
+			{
+				if( Pressure )
+				{
+					d[i] = (d0[i]+d[i-channels]+d[i+channels]+d[i-row_stride]+d[i+row_stride])/c;
+				}
+				else
+				{
+					d[i] = (d0[i] + a*(d[i-channels]+d[i+channels]+d[i-row_stride]+d[i+row_stride]))/c;
+				}
+			}
+		}
+	}
+
+	SetBoundaryRow<B>( d, mSizeX, mSizeY, mStride, y, channels );
+}
+
+//------------------------------------------------------------------------------
+template< int B, typename Rhs >
+void FluidSim::RedBlackSweep( float* d, const Rhs* d0, float a, float c, float omega, uint colour, uint channels, uint y_begin, uint y_end )
+{
+	const float inv_c = 1.0f / c;
+	const float over = omega - 1.0f;		//d + omega (gs - d) is gs + over (gs - d), which adds exactly nothing for plain Gauss-Seidel
+	const uint row_stride = mStride * channels;
+
+	for( uint y = y_begin; y < y_end; ++y )
+	{
+		const uint row = IDX(0,y);
+
+		uint num_spans;
+		const Span* spans = GetRowSpans( y, num_spans );
+
+		for( uint s = 0; s < num_spans; ++s )
+		{
+			//Updates the cells where (x + y) & 1 == colour
+			const uint x_begin = spans[s].mBegin + ((spans[s].mBegin + y + colour) & 1);
+
+			for( uint x = x_begin; x < spans[s].mEnd; x += 2 )
+			{
+				for( uint i = (row + x) * channels, end = i + channels; i < end; ++i )
+				{
+					const float gs = (d0[i] + a*(d[i-channels] + d[i+channels] + d[i-row_stride] + d[i+row_stride])) * inv_c;
+					d[i] = gs + over*(gs - d[i]);
+				}
+			}
+		}
+
+		//The row is finished once both colours are done. Its ghost cells belong to this block alone.
+		if( colour == 1 )
+		{
+			SetBoundaryRow<B>( d, mSizeX, mSizeY, mStride, y, channels );
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//Jacobi reads only the last iterate, so a step is a pass over independent cells from one buffer
+//into the other. Chebyshev acceleration weights each step with the previous iterate,
+//	x(k+1) = x(k-1) + omega(k+1) (Jacobi( x(k) ) - x(k-1))
+//which is written over x(k-1) in place, so two buffers still do. The weights only need a bound rho
+//on the spectrum of the Jacobi iteration. first is the number of steps the solve has already run,
+//LinearSolve stops between calls to check the residual and the sequence carries on from there.
+template< int B, typename Rhs >
+void FluidSim::ChebyshevSweeps( float* d, const Rhs* d0, float a, float c, uint first, uint iterations, uint expected_iterations, uint channels )
+{
+	float rho = JacobiRadius( a, c );
+
+	//k steps shrink every mode inside the bound by T_k( 1/rho ), so with rho near 1 and a short solve
+	//that's next to nothing for any of them. Modes beyond the bound still converge, more slowly, so
+	//it's lowered until the solve's steps can give the rest a factor of cosh( 2 ), about 3.8.
+	rho = std::min( rho, 1.0f / coshf( CHEBYSHEV_MIN_SPAN / expected_iterations ) );
+	const float inv_c = 1.0f / c;
+
+	float* other = mJacobiGrid;
+	if( first == 0 )
+	{
+		//x(-1) = x(0) makes the first step plain Jacobi, and gives the second buffer the inactive cells
+		memcpy( other, d, mNumCells * channels * sizeof(float) );
+	}
+
+	//Both buffers are in the shared arena. The workers have no spans, so they step whole rows.
+	if( mProcessGroup != NULL && ! mRunningGraph && AllTilesActive() )
+	{
+		const ChebyshevArgs<Rhs> args = { d, other, d0, ChebyshevKernel( d0 ), a, inv_c, rho, first, iterations, channels, mSizeX, mSizeY, mStride };
+		mProcessGroup->Run( ChebyshevJob<B, Rhs>, &args, sizeof(args) );
+
+		//An odd number of steps leaves the newest iterate in the second buffer
+		if( (iterations % 2) != 0 )
+		{
+			std::swap_ranges( d, d + (mNumCells * channels), other );
+		}
+		return;
+	}
+
+	const typename ChebyshevArgs<Rhs>::Kernel kernel = ChebyshevKernel( d0 );
+	float* current = d;
+	float omega = 1.0f;
+
+	for( uint k = 0; k < (first + iterations); ++k )
+	{
+		omega = ChebyshevWeight( k, rho, omega );
+		if( k < first )
+		{
+			continue;
+		}
+
+		float* next = other;
+		const float step_omega = omega;
+
+		ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+		{
+			for( uint y = y_begin; y < y_end; ++y )
+			{
+				uint num_spans;
+				const Span* spans = GetRowSpans( y, num_spans );
+
+				for( uint s = 0; s < num_spans; ++s )
+				{
+					kernel( next, current, d0, a, inv_c, step_omega, channels, mStride * channels, IDX(spans[s].mBegin,y) * channels, IDX(spans[s].mEnd,y) * channels );
+				}
+
+				SetBoundaryRow<B>( next, mSizeX, mSizeY, mStride, y, channels );
+			}
+		} );
+
+		other = current;
+		current = next;
+	}
+
+	//The caller's grid has to end up with the newest iterate, and the next call needs the one before it
+	if( current != d )
+	{
+		std::swap_ranges( d, d + (mNumCells * channels), current );
+	}
+}
+
+//------------------------------------------------------------------------------
+//A bound on the spectral radius of the Jacobi iteration for c d - a (sum of neighbours) = d0
+float FluidSim::JacobiRadius( float a, float c ) const
+{
+	//The iteration matrix is a/c times the sum of the four neighbours, whose eigenvalues on this grid
+	//are 2cos( pi kx/nx ) + 2cos( pi ky/ny ). Diffusion's largest is the constant mode's 4. The pressure
+	//system (c == 4a) can't change its constant mode, so the bound is the slowest mode left.
+	//Inactive tiles only pull the spectrum in.
+	const uint longest = std::max( mSizeX, mSizeY ) - 2;
+	return ( c == 4.0f*a ) ? (a * (2.0f + 2.0f*cosf( PI / longest ))) / c : (4.0f*a) / c;
+}
+
+//------------------------------------------------------------------------------
+//The relaxation factor for SOLVER_SUCCESSIVE_OVER_RELAXATION. The red-black ordering makes the
+//system consistently ordered, so Young's optimum follows from the Jacobi radius alone. Above the
+//optimum every mode converges at omega - 1 per sweep, below it the slowest mode's rate climbs
+//steeply towards 1, so an overestimate of rho is the cheap side to be wrong on.
+float FluidSim::RelaxationFactor( float a, float c, uint expected_iterations ) const
+{
+	if( mRelaxation > 0.0f )
+	{
+		return mRelaxation;
+	}
+
+	//The optimum only wins once the error has settled into the slowest modes. Until then the over
+	//relaxation stirs up the rest, so a short solve does better with a lower factor. As for Chebyshev,
+	//rho is capped by the iterations the solve is expected to run.
+	const float rho = std::min( JacobiRadius( a, c ), 1.0f / coshf( SOR_MIN_SPAN / expected_iterations ) );
+	return 2.0f / (1.0f + sqrtf( std::max( 1.0f - rho*rho, 0.0f ) ));
+}
+
+//------------------------------------------------------------------------------
+JacobiKernels::Kernel FluidSim::ChebyshevKernel( const float* ) const
+{
+	return mJacobiKernel;
+}
+
+//------------------------------------------------------------------------------
+JacobiKernels::Float16Kernel FluidSim::ChebyshevKernel( const Half::Float16* ) const
+{
+	return mJacobiFloat16Kernel;
+}
+
+//------------------------------------------------------------------------------
+JacobiKernels::BFloat16Kernel FluidSim::ChebyshevKernel( const Half::BFloat16* ) const
+{
+	return mJacobiBFloat16Kernel;
+}
+
+//------------------------------------------------------------------------------
+bool FluidSim::UsesJacobiGrid() const
+{
+	return mPressureSolver == SOLVER_JACOBI_CHEBYSHEV || mDiffusionSolver == SOLVER_JACOBI_CHEBYSHEV;
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::ParallelRows( uint y_begin, uint y_end, const std::function<void( uint, uint )>& func )
+{
+	if( mThreadPool != NULL && ! mRunningGraph )
+	{
+		mThreadPool->ParallelFor( y_begin, y_end, func );
+	}
+	else
+	{
+		func( y_begin, y_end );
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename T >
+void FluidSim::SetBnd( int b, T* d, uint channels )
+{
+	SetBoundary( b, d, mSizeX, mSizeY, mStride, channels );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::UpdateActiveTiles( float dt )
+{
+	const float dt0 = dt * mSizeX;
+	float max_speed = 0.0f;
+
+	//Inactive tiles are known to be zero, and anything that adds to one activates it straight away
+	for( uint ty = 0; ty < mTilesY; ++ty )
+	{
+		for( uint tx = 0; tx < mTilesX; ++tx )
 		{
-			for( uint x = 1; x < (mSizeX-1); ++x )
+			const uint tile = (ty * mTilesX) + tx;
+			bool occupied = false;
+
+			if( mTileActive[ tile ] )
 			{
-				p[IDX(x,y)] = (div[IDX(x,y)]+p[IDX(x-1,y)]+p[IDX(x+1,y)]+p[IDX(x,y-1)]+p[IDX(x,y+1)])/4;
+				const uint x_begin	= 1 + (tx * TILE_SIZE);
+				const uint x_end	= std::min( x_begin + TILE_SIZE, mSizeX-1 );
+				const uint y_begin	= 1 + (ty * TILE_SIZE);
+				const uint y_end	= std::min( y_begin + TILE_SIZE, mSizeY-1 );
+
+				for( uint y = y_begin; y < y_end; ++y )
+				{
+					for( uint x = x_begin; x < x_end; ++x )
+					{
+						const uint i = IDX(x,y);
+						const float speed = std::max( fabs( mVelocitiesU[i] ), fabs( mVelocitiesV[i] ) );
+						max_speed = std::max( max_speed, speed );
+
+						float density[ DENSITY_CHANNELS ];
+						float source[ DENSITY_CHANNELS ];
+						LoadDensity( i, density );
+						LoadSource( i, source );
+
+						occupied = occupied || speed > ACTIVITY_THRESHOLD;
+						for( uint ch = 0; ch < DENSITY_CHANNELS; ++ch )
+						{
+							occupied = occupied || density[ch] > ACTIVITY_THRESHOLD || source[ch] != 0.0f;
+						}
+					}
+				}
 			}
+
+			mTileOccupied[ tile ] = occupied ? 1 : 0;
 		}
+	}
+
+	//Anything within a step's travel of an occupied tile may be reached this step, plus a tile
+	//of margin for what diffusion and the pressure solve spread
+	const uint radius = (uint)ceil( (max_speed * dt0) / TILE_SIZE ) + 1;
+
+	mNumActiveTiles = 0;
+	for( uint ty = 0; ty < mTilesY; ++ty )
+	{
+		for( uint tx = 0; tx < mTilesX; ++tx )
+		{
+			const uint tile = (ty * mTilesX) + tx;
+			const uint tx_begin	= tx > radius ? tx - radius : 0;
+			const uint tx_end	= std::min( tx + radius + 1, mTilesX );
+			const uint ty_begin	= ty > radius ? ty - radius : 0;
+			const uint ty_end	= std::min( ty + radius + 1, mTilesY );
 
-		SetBnd( 0, p );
+			bool active = false;
+			for( uint ny = ty_begin; ny < ty_end && ! active; ++ny )
+			{
+				for( uint nx = tx_begin; nx < tx_end && ! active; ++nx )
+				{
+					active = mTileOccupied[ (ny * mTilesX) + nx ] != 0;
+				}
+			}
+
+			if( ! active && mTileActive[ tile ] )
+			{
+				//Whatever's left below the threshold is dropped so the tile can be skipped
+				ClearTile( tx, ty );
+			}
+
+			mTileActive[ tile ] = active ? 1 : 0;
+			mNumActiveTiles += active ? 1 : 0;
+		}
 	}
 
-	for( uint y = 1; y < (mSizeY-1); ++y )
+	BuildSpans();
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::ActivateTilesAround( uint x, uint y )
+{
+	//Covers the 3x3 block of cells that PlaceSource and ApplyForce touch
+	const uint tx_begin	= (std::max( x-1, 1u ) - 1) / TILE_SIZE;
+	const uint tx_end	= std::min( (x + 1 - 1) / TILE_SIZE + 1, mTilesX );
+	const uint ty_begin	= (std::max( y-1, 1u ) - 1) / TILE_SIZE;
+	const uint ty_end	= std::min( (y + 1 - 1) / TILE_SIZE + 1, mTilesY );
+
+	bool changed = false;
+	for( uint ty = ty_begin; ty < ty_end; ++ty )
 	{
-		for( uint x = 1; x < (mSizeX-1); ++x )
+		for( uint tx = tx_begin; tx < tx_end; ++tx )
 		{
-			u[IDX(x,y)] -= 0.5f*(p[IDX(x+1,y)]-p[IDX(x-1,y)])/h;
-			v[IDX(x,y)] -= 0.5f*(p[IDX(x,y+1)]-p[IDX(x,y-1)])/h;
+			changed = changed || ! mTileActive[ (ty * mTilesX) + tx ];
+			mTileActive[ (ty * mTilesX) + tx ] = 1;
 		}
 	}
 
-	SetBnd( 1, u );
-	SetBnd( 2, v );
+	if( changed )
+	{
+		BuildSpans();
+	}
 }
 
 //------------------------------------------------------------------------------
-void FluidSim::SetBnd( int b, float* d )
+void FluidSim::ClearTile( uint tx, uint ty )
 {
-	for( uint x = 1; x < (mSizeX-1); ++x )
+	const uint x_begin	= 1 + (tx * TILE_SIZE);
+	const uint x_end	= std::min( x_begin + TILE_SIZE, mSizeX-1 );
+	const uint y_begin	= 1 + (ty * TILE_SIZE);
+	const uint y_end	= std::min( y_begin + TILE_SIZE, mSizeY-1 );
+	const uint width	= x_end - x_begin;
+
+	for( uint y = y_begin; y < y_end; ++y )
 	{
-		d[IDX(x,0 )]		= b==2 ? -d[IDX(x,1)]			: d[IDX(x,1)];
-		d[IDX(x,mSizeY-1)]	= b==2 ? -d[IDX(x,mSizeY-2)]	: d[IDX(x,mSizeY-2)];
+		const uint i = IDX(x_begin,y);
+
+		ClearDensityCells( i, width );
+		memset( mDensities0 + (i * DENSITY_CHANNELS), 0, width * DENSITY_CHANNELS * sizeof(float) );
+		memset( mVelocitiesU + i, 0, width * sizeof(float) );
+		memset( mVelocitiesV + i, 0, width * sizeof(float) );
+		memset( mVelocitiesU0 + i, 0, width * sizeof(float) );
+		memset( mVelocitiesV0 + i, 0, width * sizeof(float) );
+		memset( mPressures[0] + i, 0, width * sizeof(float) );
+		memset( mPressures[1] + i, 0, width * sizeof(float) );
 	}
+}
 
-	for( uint y = 1; y < (mSizeY-1); ++y )
+//------------------------------------------------------------------------------
+void FluidSim::ClearInactiveTiles( float* d, uint channels )
+{
+	for( uint ty = 0; ty < mTilesY; ++ty )
+	{
+		for( uint tx = 0; tx < mTilesX; ++tx )
+		{
+			if( mTileActive[ (ty * mTilesX) + tx ] )
+			{
+				continue;
+			}
+
+			const uint x_begin	= 1 + (tx * TILE_SIZE);
+			const uint x_end	= std::min( x_begin + TILE_SIZE, mSizeX-1 );
+			const uint y_begin	= 1 + (ty * TILE_SIZE);
+			const uint y_end	= std::min( y_begin + TILE_SIZE, mSizeY-1 );
+
+			for( uint y = y_begin; y < y_end; ++y )
+			{
+				memset( d + (IDX(x_begin,y) * channels), 0, (x_end - x_begin) * channels * sizeof(float) );
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::BuildSpans()
+{
+	mSpans.clear();
+	mTileRowSpans.clear();
+	mNumActiveTiles = 0;
+
+	for( uint ty = 0; ty < mTilesY; ++ty )
+	{
+		mTileRowSpans.push_back( (uint)mSpans.size() );
+
+		for( uint tx = 0; tx < mTilesX; ++tx )
+		{
+			if( ! mTileActive[ (ty * mTilesX) + tx ] )
+			{
+				continue;
+			}
+
+			++mNumActiveTiles;
+
+			//Neighbouring active tiles merge into one span
+			const uint x_begin = 1 + (tx * TILE_SIZE);
+			if( mTileRowSpans.back() < mSpans.size() && mSpans.back().mEnd == x_begin )
+			{
+				mSpans.back().mEnd = std::min( x_begin + TILE_SIZE, mSizeX-1 );
+			}
+			else
+			{
+				Span span;
+				span.mBegin	= x_begin;
+				span.mEnd	= std::min( x_begin + TILE_SIZE, mSizeX-1 );
+				mSpans.push_back( span );
+			}
+		}
+	}
+
+	mTileRowSpans.push_back( (uint)mSpans.size() );
+}
+
+//------------------------------------------------------------------------------
+bool FluidSim::AllTilesActive() const
+{
+	return mNumActiveTiles == mTilesX * mTilesY;
+}
+
+//------------------------------------------------------------------------------
+const FluidSim::Span* FluidSim::GetRowSpans( uint y, uint& num_spans ) const
+{
+	assert( y >= 1 && y < (mSizeY-1) );
+
+	const uint ty = (y-1) / TILE_SIZE;
+	num_spans = mTileRowSpans[ ty+1 ] - mTileRowSpans[ ty ];
+
+	return num_spans > 0 ? &mSpans[ mTileRowSpans[ ty ] ] : NULL;
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::ForEachSpan( uint y_begin, uint y_end, const SpanFunc& func ) const
+{
+	//Splits the rows at tile boundaries, since each tile row has its own spans
+	for( uint y = y_begin; y < y_end; )
+	{
+		const uint ty = (y-1) / TILE_SIZE;
+		const uint tile_y_end = std::min( 1 + ((ty+1) * TILE_SIZE), y_end );
+
+		for( uint s = mTileRowSpans[ ty ]; s < mTileRowSpans[ ty+1 ]; ++s )
+		{
+			func( mSpans[s].mBegin, mSpans[s].mEnd, y, tile_y_end );
+		}
+
+		y = tile_y_end;
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::ForEachAdvectSpan( uint y_begin, uint y_end, const float* const* d0, uint num_fields, uint channels, const float* u, const float* v, float dt0, const SpanFunc& func ) const
+{
+	if( ! mBlockedAdvection )
+	{
+		ForEachSpan( y_begin, y_end, func );
+		return;
+	}
+
+	//A tile row of a span at a time, neighbouring cells mostly trace back to neighbouring cells
+	ForEachSpan( y_begin, y_end, [&]( uint x_begin, uint x_end, uint span_y_begin, uint span_y_end )
+	{
+		for( uint x = x_begin; x < x_end; x += ADVECT_BLOCK_WIDTH )
+		{
+			const uint block_end = std::min( x + ADVECT_BLOCK_WIDTH, x_end );
+
+			//The next block's sources load while this one is worked on
+			if( block_end < x_end )
+			{
+				PrefetchFootprint( d0, num_fields, channels, u, v, dt0, block_end, std::min( block_end + ADVECT_BLOCK_WIDTH, x_end ), span_y_begin, span_y_end );
+			}
+
+			func( x, block_end, span_y_begin, span_y_end );
+		}
+	} );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::PrefetchFootprint( const float* const* d0, uint num_fields, uint channels, const float* u, const float* v, float dt0, uint x_begin, uint x_end, uint y_begin, uint y_end ) const
+{
+#if defined(SIMD_X86)
+	//Bounds the departure points of the block's corners, which covers the block unless the flow
+	//inside it is far from smooth
+	float lo_x = (float)mSizeX, hi_x = 0.0f;
+	float lo_y = (float)mSizeY, hi_y = 0.0f;
+
+	const uint xs[] = { x_begin, x_end-1 };
+	const uint ys[] = { y_begin, y_end-1 };
+	for( uint j = 0; j < 2; ++j )
+	{
+		for( uint i = 0; i < 2; ++i )
+		{
+			const uint cell = IDX( xs[i], ys[j] );
+			const float x1 = std::min( std::max( xs[i] - dt0 * u[cell], 0.5f ), mSizeX - 1.501f );
+			const float y1 = std::min( std::max( ys[j] - dt0 * v[cell], 0.5f ), mSizeY - 1.501f );
+
+			lo_x = std::min( lo_x, x1 );	hi_x = std::max( hi_x, x1 );
+			lo_y = std::min( lo_y, y1 );	hi_y = std::max( hi_y, y1 );
+		}
+	}
+
+	//Bilinear sampling reads one cell past the departure point in each direction
+	const uint i0 = (uint)lo_x, i1 = (uint)hi_x + 1;
+	const uint j0 = (uint)lo_y, j1 = (uint)hi_y + 1;
+
+	const uint row_floats = (i1 - i0 + 1) * channels;
+	const uint row_lines = (row_floats + CACHE_LINE_FLOATS-1) / CACHE_LINE_FLOATS + 1;
+
+	//A scattered footprint would only evict what the current block needs
+	if( row_lines * (j1 - j0 + 1) * num_fields > PREFETCH_MAX_LINES )
+	{
+		return;
+	}
+
+	for( uint f = 0; f < num_fields; ++f )
+	{
+		for( uint j = j0; j <= j1; ++j )
+		{
+			const float* row = d0[f] + IDX( i0, j ) * channels;
+			for( uint line = 0; line < row_lines; ++line )
+			{
+				_mm_prefetch( (const char*)(row + line * CACHE_LINE_FLOATS), _MM_HINT_T0 );
+			}
+		}
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+//With every_grid the optional grids get their full size whether or not they're
+//in use, for the most the arena can ever need
+void FluidSim::AddGrids( GridArena& arena, bool every_grid ) const
+{
+	const size_t cells = mNumCells;
+
+	arena.Add( "densities",			cells * DENSITY_CHANNELS * sizeof(float) );
+	arena.Add( "densities0",		cells * DENSITY_CHANNELS * sizeof(float) );
+	arena.Add( "velocities u",		cells * sizeof(float) );
+	arena.Add( "velocities v",		cells * sizeof(float) );
+	arena.Add( "velocities u0",		cells * sizeof(float) );
+	arena.Add( "velocities v0",		cells * sizeof(float) );
+	arena.Add( "sources",			cells * DENSITY_CHANNELS * sizeof(float) );
+	arena.Add( "pressures 0",		cells * sizeof(float) );
+	arena.Add( "pressures 1",		cells * sizeof(float) );
+
+	//MacCormack's grids hold the densities or both velocity components
+	const size_t advect_cells = ( every_grid || mAdvectionScheme == ADVECTION_MACCORMACK ) ? cells : 0;
+	arena.Add( "advect forward",	advect_cells * DENSITY_CHANNELS * sizeof(float) );
+	arena.Add( "advect backward",	advect_cells * DENSITY_CHANNELS * sizeof(float) );
+
+	//With room for the interleaved densities
+	const size_t jacobi_cells = ( every_grid || UsesJacobiGrid() ) ? cells : 0;
+	arena.Add( "jacobi",			jacobi_cells * DENSITY_CHANNELS * sizeof(float) );
+	assert( arena.GetNumGrids() == NUM_GRIDS );
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::PlaceGrids( bool huge_pages )
+{
+	GridArena* arena = new GridArena();
+	AddGrids( *arena, false );
+
+	const GridArena* old_arena = mArena;
+
+	if( mProcessGroup != NULL )
+	{
+		//The workers only see the group's shared memory. It has room for two of the largest
+		//arena, so the new one goes in whichever half the old one isn't using.
+		char* shared = (char*)mProcessGroup->GetSharedMemory();
+		const size_t half = mProcessGroup->GetSharedSize() / 2;
+		const bool in_first_half = old_arena != NULL && old_arena->IsShared() && (const char*)old_arena->GetBase() < shared + half;
+
+		arena->Allocate( huge_pages, in_first_half ? shared + half : shared, half );
+	}
+	else
+	{
+		arena->Allocate( huge_pages );
+	}
+
+	//Pages are placed on the NUMA node of the thread that first writes them, so fill each grid in
+	//the same row blocks the kernels use. The workers can only copy from an old arena they share.
+	const uint size_y = mSizeY;
+
+	for( uint g = 0; g < NUM_GRIDS; ++g )
+	{
+		char* dst = (char*)arena->Get( g );
+		const char* src = ( old_arena != NULL && old_arena->GetSize( g ) == arena->GetSize( g ) ) ? (const char*)old_arena->Get( g ) : NULL;
+		const size_t row_bytes = arena->GetSize( g ) / size_y;
+
+		if( mProcessGroup != NULL && ( old_arena == NULL || old_arena->IsShared() ) )
+		{
+			CopyGridArgs args = { dst, src, row_bytes, size_y };
+			mProcessGroup->Run( CopyGridJob, &args, sizeof(args) );
+		}
+		else
+		{
+			ParallelRows( 1, mSizeY-1, [=]( uint y_begin, uint y_end )
+			{
+				CopyGridRows( dst, src, row_bytes, size_y, y_begin, y_end );
+			} );
+		}
+	}
+
+	delete mArena;
+	mArena = arena;
+
+	AssignGrids();
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::AssignGrids()
+{
+	const bool half = mPrecision != PRECISION_FLOAT32;
+
+	mDensities		= half ? NULL : (float*)mArena->Get( GRID_DENSITIES );
+	mDensities0		= (float*)mArena->Get( GRID_DENSITIES0 );
+	mVelocitiesU	= (float*)mArena->Get( GRID_VELOCITIES_U );
+	mVelocitiesV	= (float*)mArena->Get( GRID_VELOCITIES_V );
+	mVelocitiesU0	= (float*)mArena->Get( GRID_VELOCITIES_U0 );
+	mVelocitiesV0	= (float*)mArena->Get( GRID_VELOCITIES_V0 );
+	mSources		= half ? NULL : (float*)mArena->Get( GRID_SOURCES );
+	mPressures[0]	= (float*)mArena->Get( GRID_PRESSURES0 );
+	mPressures[1]	= (float*)mArena->Get( GRID_PRESSURES1 );
+	mDensitiesHalf	= half ? (unsigned short*)mArena->Get( GRID_DENSITIES ) : NULL;
+	mSourcesHalf	= half ? (unsigned short*)mArena->Get( GRID_SOURCES ) : NULL;
+
+	const bool maccormack = mAdvectionScheme == ADVECTION_MACCORMACK;
+	mAdvectForward	= maccormack ? (float*)mArena->Get( GRID_ADVECT_FORWARD ) : NULL;
+	mAdvectBackward	= maccormack ? (float*)mArena->Get( GRID_ADVECT_BACKWARD ) : NULL;
+	mJacobiGrid		= UsesJacobiGrid() ? (float*)mArena->Get( GRID_JACOBI ) : NULL;
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::LoadDensity( uint i, float* out ) const
+{
+	switch( mPrecision )
+	{
+	case PRECISION_FLOAT32:		LoadCell( mDensities + (i * DENSITY_CHANNELS), out );							break;
+	case PRECISION_FLOAT16:		LoadCell( (const Half::Float16*)mDensitiesHalf + (i * DENSITY_CHANNELS), out );	break;
+	case PRECISION_BFLOAT16:	LoadCell( (const Half::BFloat16*)mDensitiesHalf + (i * DENSITY_CHANNELS), out );	break;
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::LoadSource( uint i, float* out ) const
+{
+	switch( mPrecision )
+	{
+	case PRECISION_FLOAT32:		LoadCell( mSources + (i * DENSITY_CHANNELS), out );							break;
+	case PRECISION_FLOAT16:		LoadCell( (const Half::Float16*)mSourcesHalf + (i * DENSITY_CHANNELS), out );	break;
+	case PRECISION_BFLOAT16:	LoadCell( (const Half::BFloat16*)mSourcesHalf + (i * DENSITY_CHANNELS), out );	break;
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::StoreDensity( uint i, const float* in )
+{
+	switch( mPrecision )
+	{
+	case PRECISION_FLOAT32:		StoreCell( mDensities + (i * DENSITY_CHANNELS), in );						break;
+	case PRECISION_FLOAT16:		StoreCell( (Half::Float16*)mDensitiesHalf + (i * DENSITY_CHANNELS), in );	break;
+	case PRECISION_BFLOAT16:	StoreCell( (Half::BFloat16*)mDensitiesHalf + (i * DENSITY_CHANNELS), in );	break;
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::StoreSource( uint i, const float* in )
+{
+	switch( mPrecision )
+	{
+	case PRECISION_FLOAT32:		StoreCell( mSources + (i * DENSITY_CHANNELS), in );						break;
+	case PRECISION_FLOAT16:		StoreCell( (Half::Float16*)mSourcesHalf + (i * DENSITY_CHANNELS), in );	break;
+	case PRECISION_BFLOAT16:	StoreCell( (Half::BFloat16*)mSourcesHalf + (i * DENSITY_CHANNELS), in );	break;
+	}
+}
+
+//------------------------------------------------------------------------------
+void FluidSim::ClearDensityCells( uint i, uint count )
+{
+	//Zero is all bits clear in every format
+	if( mPrecision == PRECISION_FLOAT32 )
+	{
+		memset( mDensities + (i * DENSITY_CHANNELS), 0, count * DENSITY_CHANNELS * sizeof(float) );
+	}
+	else
 	{
-		d[IDX(0 ,y)]		= b==1 ? -d[IDX(1,y)]			: d[IDX(1,y)];
-		d[IDX(mSizeX-1,y)]	= b==1 ? -d[IDX(mSizeX-2,y)]	: d[IDX(mSizeX-2,y)];
+		memset( mDensitiesHalf + (i * DENSITY_CHANNELS), 0, count * DENSITY_CHANNELS * sizeof(unsigned short) );
 	}
+}
 
-	d[IDX(0,0 )]				= 0.5f*(d[IDX(1,0)]					+ d[IDX(0,1)]);
-	d[IDX(0,mSizeY-1)]			= 0.5f*(d[IDX(1,mSizeY-1)]			+ d[IDX(0,mSizeY-2)]);
-	d[IDX(mSizeX-1,0)]			= 0.5f*(d[IDX(mSizeX-2,0)]			+ d[IDX(mSizeX-1,1)]);
-	d[IDX(mSizeX-1,mSizeY-1)]	= 0.5f*(d[IDX(mSizeX-2,mSizeY-1)]	+ d[IDX(mSizeX-1,mSizeY-2)]);
+//------------------------------------------------------------------------------
+void FluidSim::ClearSourceCells( uint i, uint count )
+{
+	if( mPrecision == PRECISION_FLOAT32 )
+	{
+		memset( mSources + (i * DENSITY_CHANNELS), 0, count * DENSITY_CHANNELS * sizeof(float) );
+	}
+	else
+	{
+		memset( mSourcesHalf + (i * DENSITY_CHANNELS), 0, count * DENSITY_CHANNELS * sizeof(unsigned short) );
+	}
 }
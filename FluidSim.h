@@ -3,13 +3,110 @@
 
 
 #include <vector>
+#include <functional>
 #include <cassert>
 #include "PixelToaster.h"
+#include "AdvectKernels.h"
+#include "ForceKernels.h"
+#include "JacobiKernels.h"
+#include "Simd.h"
 #include "types.h"
 
 
+class ConjugateGradient;
+class GridArena;
+class Multigrid;
+class ProcessGroup;
+class SpectralPoisson;
+class TaskGraph;
+class ThreadPool;
+
+namespace Benchmark
+{
+	class KernelTimer;
+}
+
+
 class FluidSim
 {
+public:
+	enum Solver
+	{
+		SOLVER_GAUSS_SEIDEL,
+		SOLVER_GAUSS_SEIDEL_WAVEFRONT,		//Same result as SOLVER_GAUSS_SEIDEL in one pass over memory
+		SOLVER_RED_BLACK_GAUSS_SEIDEL,		//Runs on the thread pool
+		SOLVER_MULTIGRID_V,					//Pressure only
+		SOLVER_MULTIGRID_F,					//Pressure only
+		SOLVER_CONJUGATE_GRADIENT_JACOBI,
+		SOLVER_CONJUGATE_GRADIENT_MIC,
+		SOLVER_SPECTRAL,					//Pressure only, exact in one pass
+		SOLVER_JACOBI_CHEBYSHEV,			//Every cell independent, runs on the thread pool
+		SOLVER_SUCCESSIVE_OVER_RELAXATION,	//Over relaxed red-black Gauss-Seidel, runs on the thread pool
+	};
+
+	//Controls how long a linear solve iterates. An iteration is a sweep for the
+	//Gauss-Seidel and Jacobi solvers, a cycle for multigrid and one step of
+	//conjugate gradient.
+	struct SolverPolicy
+	{
+		enum Mode
+		{
+			MODE_FIXED,			//Always runs mIterations, 0 keeps each solver's own default
+			MODE_TOLERANCE,		//Stops once the relative residual reaches mTolerance
+			MODE_TIME_BUDGET,	//Stops after mTimeBudget milliseconds, or at mTolerance if that's positive and comes first
+		};
+
+		Mode	mMode;
+		uint	mIterations;		//The count for MODE_FIXED, otherwise the most that will be run
+		float	mTolerance;
+		float	mTimeBudget;
+		uint	mCheckInterval;		//Iterations between residual and clock checks, conjugate gradient checks every iteration
+
+		static SolverPolicy Fixed( uint iterations );
+		static SolverPolicy Tolerance( float tolerance, uint max_iterations, uint check_interval );
+		static SolverPolicy TimeBudget( float milliseconds, float tolerance, uint max_iterations, uint check_interval );
+	};
+
+	//How Diffuse handled a call. With a target error set, see SetDiffusionError,
+	//it takes the cheapest path whose bound on the error is within it. Only the
+	//Gauss-Seidel solvers, red-black included, take DIFFUSION_SWEEPS.
+	enum DiffusionPath
+	{
+		DIFFUSION_SKIP,			//Copied, diffusing would change the field by less than the error
+		DIFFUSION_EXPLICIT,		//One explicit step
+		DIFFUSION_SWEEPS,		//A few sweeps of a Gauss-Seidel diffusion solver, from the better of those two
+		DIFFUSION_SOLVE,		//The diffusion solver under its policy
+		NUM_DIFFUSION_PATHS,
+	};
+
+	//What the solves of one system did during the last Update
+	struct SolverStats
+	{
+		uint	mSolves;
+		uint	mIterations;		//Summed over the solves
+		float	mResidual;			//Worst final relative residual, or -1 if none of the solves measured it
+		float	mMilliseconds;
+		uint	mPaths[ NUM_DIFFUSION_PATHS ];	//Diffusion only, the solves that took each path
+	};
+
+	//How the densities and sources are stored between passes. The 16 bit formats
+	//halve their memory and bandwidth, kernels still do their arithmetic in float.
+	enum Precision
+	{
+		PRECISION_FLOAT32,
+		PRECISION_FLOAT16,
+		PRECISION_BFLOAT16,
+	};
+
+	//How Advect moves densities and velocities. MacCormack advects forward, back
+	//again and corrects by half the round trip error, keeping detail that the
+	//bilinear semi-Lagrangian step smears for about three times the work.
+	enum AdvectionScheme
+	{
+		ADVECTION_SEMI_LAGRANGIAN,
+		ADVECTION_MACCORMACK,
+	};
+
 public:
 	FluidSim( uint size_x, uint size_y, float viscosity, float diffusion, float decay );
 	~FluidSim();
@@ -21,55 +118,212 @@ public:
 	void ClearDensity();
 	void ApplyForce( uint x, uint y, float amount );
 	void SetGravity( float gu, float gv );
+	void SetPressureSolver( Solver solver );
+	void SetDiffusionSolver( Solver solver );
+	void SetPressurePolicy( const SolverPolicy& policy );
+	void SetDiffusionPolicy( const SolverPolicy& policy );
+	void SetDiffusionError( float error );	//Lets Diffuse take shortcuts that stay within this relative error, 0 always solves
+	void SetRelaxation( float omega );		//For SOLVER_SUCCESSIVE_OVER_RELAXATION, 0 works it out from the grid and the length of each solve
+	void SetWarmStartPressure( bool enable );	//Starts each pressure solve from the last one at its call site, off by default
+	void SetSparseTiles( bool enable );
+	void SetStoragePrecision( Precision precision );
+	void SetAdvectionScheme( AdvectionScheme scheme );
+	void SetBlockedAdvection( bool enable );	//Advects in blocks, prefetching the next block's sources
+	void SetThreadCount( uint num_threads );
+	void SetProcessCount( uint num_processes );	//Splits red-black, SOR and Chebyshev sweeps across worker processes, Linux only
+	void SetHugePages( bool enable );
+	void SetTaskGraph( bool enable );		//Runs Update as a graph of tasks on the thread pool
+	void SetSimdLevel( Simd::Level level );
+	const SolverStats& GetPressureStats() const;
+	const SolverStats& GetDiffusionStats() const;
+	uint GetNumActiveTiles() const;
+	uint GetProcessCount() const;
+	uint GetStride() const;
+	const GridArena& GetArena() const;		//Where each grid lives, for benchmarks
+	const TaskGraph* GetTaskGraph() const;	//The last Update's graph and timings, or NULL
 	void Draw( PixelToaster::vector<PixelToaster::Pixel>& out_pixels, bool clamp_colours, bool show_sources, bool show_velocity ) const;
 
 private:
+	friend class Benchmark::KernelTimer;	//Times solves and kernels on their own
+
 	//Array index helper
 	inline uint IDX( uint x, uint y ) const
 	{
 		assert( x >= 0 && x < mSizeX && y >= 0 && y < mSizeY );
 
-		return (y * mSizeX) + x;
+		return (y * mStride) + x;
 	}
 
-	void DensityStep( float* s, float* x, float* x0, float* u, float* v, float diff, float dt );
+	//A run of active cells [mBegin, mEnd) along x
+	struct Span
+	{
+		uint	mBegin;
+		uint	mEnd;
+	};
+
+	typedef std::function<void( uint x_begin, uint x_end, uint y_begin, uint y_end )> SpanFunc;
+
+	template< typename T, typename Kernel, typename Correct > void DensityStep( T* x, float* x0, const T* s, float* u, float* v, float diff, float decay, float dt, Kernel kernel, Correct correct );
+	template< typename T, typename Kernel, typename Correct > void UpdateGraph( T* x, const T* s, float dt, Kernel kernel, Correct correct );
 	void VelocityStep( float* u, float* v, float* u0, float* v0, float visc, float dt );
 
-	void AddSources( float* x, float* s, float dt );
-	void ApplyGravity( float dt );
-	void Decay( float* d, float rate, float dt );
-	void Diffuse( int b, float* x, float* x0, float diff, float dt );
-	void Advect( int b, float* d, float* d0, float* u, float* v, float dt );
-	void Project( float* u, float* v, float* p, float* div );
-	void SetBnd( int b, float* d );
+	template< typename T > void AddSources( T* x, const T* s, float dt, uint channels, uint y_begin, uint y_end );
+	void AddForces( float* u, float* v, const float* u0, const float* v0, float dt, uint y_begin, uint y_end );
+	template< typename Rhs > void Diffuse( int b, float* x, const Rhs* x0, float diff, float dt, SolverStats& stats, uint channels = 1 );
+	template< typename Rhs > void ExplicitDiffuse( int b, float* x, const Rhs* x0, float a, uint channels );
+	void Advect( const int* b, float* const* d, float* const* d0, uint num_fields, float* u, float* v, float dt );
+	template< typename T, typename Kernel, typename Correct > void AdvectDensity( T* d, float* d0, float* u, float* v, float decay, float dt, Kernel kernel, Correct correct );
+	void Project( float* u, float* v, float* p, float* div, uint call_site );
+	void RemoveMean( float* d );
+	//Pressure is Project's solve, which Gauss-Seidel sums as (d0 + neighbours)/c rather than (d0 + a*neighbours)/c
+	template< bool Pressure = false, typename Rhs > void LinearSolve( int b, float* d, const Rhs* d0, float a, float c, Solver solver, const SolverPolicy& policy, SolverStats& stats, uint channels = 1, uint* expected_iterations = NULL );
+	template< bool Pressure, typename Rhs > void RunIterations( int b, float* d, const Rhs* d0, float a, float c, Solver solver, uint first, uint iterations, uint expected_iterations, uint channels );
+	template< int B, bool Pressure, typename Rhs > void RunSweeps( float* d, const Rhs* d0, float a, float c, Solver solver, uint first, uint iterations, uint expected_iterations, uint channels );
+	template< typename Rhs > float RelativeResidual( int b, const float* d, const Rhs* d0, float a, float c, uint channels ) const;
+	template< int B, bool Pressure, typename Rhs > void GaussSeidelRow( float* d, const Rhs* d0, float a, float c, uint channels, uint y );
+	template< int B, typename Rhs > void RedBlackSweep( float* d, const Rhs* d0, float a, float c, float omega, uint colour, uint channels, uint y_begin, uint y_end );
+	template< int B, typename Rhs > void ChebyshevSweeps( float* d, const Rhs* d0, float a, float c, uint first, uint iterations, uint expected_iterations, uint channels );
+	float JacobiRadius( float a, float c ) const;
+	float RelaxationFactor( float a, float c, uint expected_iterations ) const;
+	JacobiKernels::Kernel ChebyshevKernel( const float* d0 ) const;
+	JacobiKernels::Float16Kernel ChebyshevKernel( const Half::Float16* d0 ) const;
+	JacobiKernels::BFloat16Kernel ChebyshevKernel( const Half::BFloat16* d0 ) const;
+	bool UsesJacobiGrid() const;
+	void ParallelRows( uint y_begin, uint y_end, const std::function<void( uint, uint )>& func );
+	template< typename T > void SetBnd( int b, T* d, uint channels = 1 );
+
+	void UpdateActiveTiles( float dt );
+	void ActivateTilesAround( uint x, uint y );
+	void ClearTile( uint tx, uint ty );
+	void ClearInactiveTiles( float* d, uint channels );
+	void BuildSpans();
+	bool AllTilesActive() const;
+	const Span* GetRowSpans( uint y, uint& num_spans ) const;
+	void ForEachSpan( uint y_begin, uint y_end, const SpanFunc& func ) const;
+	void ForEachAdvectSpan( uint y_begin, uint y_end, const float* const* d0, uint num_fields, uint channels, const float* u, const float* v, float dt0, const SpanFunc& func ) const;
+	void PrefetchFootprint( const float* const* d0, uint num_fields, uint channels, const float* u, const float* v, float dt0, uint x_begin, uint x_end, uint y_begin, uint y_end ) const;
+
+	void AddGrids( GridArena& arena, bool every_grid ) const;
+	void PlaceGrids( bool huge_pages );
+	void AssignGrids();
+
+	void LoadDensity( uint i, float* out ) const;
+	void LoadSource( uint i, float* out ) const;
+	void StoreDensity( uint i, const float* in );
+	void StoreSource( uint i, const float* in );
+	void ClearDensityCells( uint i, uint count );
+	void ClearSourceCells( uint i, uint count );
 
 private:
 	const uint mSizeX;
 	const uint mSizeY;
 	const uint mNumPoints;
 
+	//Rows are padded out to mStride cells so each one starts on a cache line,
+	//and, see RowStride, so the rows of a column don't crowd into a few cache sets
+	const uint mStride;
+	const uint mNumCells;
+
 	const float mViscosity;
 	const float mDiffusion;
 	const float mDecay;
 
-	float* mDensitiesR;
-	float* mDensitiesG;
-	float* mDensitiesB;
-	float* mDensitiesR0;
-	float* mDensitiesG0;
-	float* mDensitiesB0;
+	//Densities and sources are interleaved RGBX, DENSITY_CHANNELS floats per cell
+	float* mDensities;
+	float* mDensities0;
 
 	float* mVelocitiesU;
 	float* mVelocitiesV;
 	float* mVelocitiesU0;
 	float* mVelocitiesV0;
 
-	float* mSourcesR;
-	float* mSourcesG;
-	float* mSourcesB;
+	float* mSources;
 
 	float mGravityU;
 	float mGravityV;
+
+	Solver				mPressureSolver;
+	Solver				mDiffusionSolver;
+	Multigrid*			mMultigrid;
+	ConjugateGradient*	mConjugateGradient;
+	SpectralPoisson*	mSpectralPoisson;
+	float*				mJacobiGrid;			//The Chebyshev Jacobi solver's second buffer, in the arena while it's selected
+	ThreadPool*			mThreadPool;
+
+	AdvectKernels::Kernel						mAdvectKernel;
+	AdvectKernels::InterleavedKernel			mAdvectDensityKernel;
+	AdvectKernels::InterleavedFloat16Kernel		mAdvectDensityFloat16Kernel;
+	AdvectKernels::InterleavedBFloat16Kernel	mAdvectDensityBFloat16Kernel;
+	ForceKernels::Kernel						mForceKernel;
+	ForceKernels::Float16Kernel					mForceFloat16Kernel;
+	ForceKernels::BFloat16Kernel				mForceBFloat16Kernel;
+	AdvectKernels::CorrectKernel					mCorrectKernel;
+	AdvectKernels::InterleavedCorrectKernel			mCorrectDensityKernel;
+	AdvectKernels::InterleavedCorrectFloat16Kernel	mCorrectDensityFloat16Kernel;
+	AdvectKernels::InterleavedCorrectBFloat16Kernel	mCorrectDensityBFloat16Kernel;
+	JacobiKernels::Kernel						mJacobiKernel;
+	JacobiKernels::Float16Kernel				mJacobiFloat16Kernel;
+	JacobiKernels::BFloat16Kernel				mJacobiBFloat16Kernel;
+
+	SolverPolicy	mPressurePolicy;
+	SolverPolicy	mDiffusionPolicy;
+	float			mDiffusionError;
+	float			mRelaxation;
+	SolverStats		mPressureStats;
+	SolverStats		mDiffusionStats;
+
+	//Pressure from the last solve at each of VelocityStep's two Project calls
+	static const uint NUM_PROJECT_CALLS = 2;
+	float* mPressures[ NUM_PROJECT_CALLS ];
+	uint mPressureIterations[ NUM_PROJECT_CALLS ];	//How long each solve ran, the next one's acceleration is sized for it
+	bool mWarmStartPressure;
+
+	//Tiles that are empty and far enough from anything moving are skipped by every kernel
+	//and kept at zero. Kernels walk the spans of active tiles in each tile row.
+	bool						mSparseTiles;
+	const uint					mTilesX;
+	const uint					mTilesY;
+	uint						mNumActiveTiles;
+	std::vector<unsigned char>	mTileActive;
+	std::vector<unsigned char>	mTileOccupied;
+	std::vector<Span>			mSpans;
+	std::vector<uint>			mTileRowSpans;		//First span of each tile row in mSpans, plus the end
+
+	//With 16 bit storage mDensities and mSources are NULL, and these hold them
+	//as Half::Float16 or Half::BFloat16. mDensities0 stays float, it's the
+	//diffusion result that advection samples from.
+	Precision		mPrecision;
+	unsigned short*	mDensitiesHalf;
+	unsigned short*	mSourcesHalf;
+
+	//Every grid above is carved from the one arena. It's rebuilt, keeping the
+	//contents, when huge pages are toggled, the thread pool or the process group
+	//changes, or an advection scheme needs more grids.
+	GridArena*	mArena;
+	bool		mHugePages;
+
+	//Update's passes as tasks, while it's running ParallelRows stays on the calling thread
+	TaskGraph*	mTaskGraph;
+	bool		mRunningGraph;
+
+	//MacCormack's forward and backward advections, interleaved like the densities.
+	//They're empty in the arena unless that scheme is selected.
+	AdvectionScheme	mAdvectionScheme;
+	float*			mAdvectForward;
+	float*			mAdvectBackward;
+
+	//Advection splits each span into blocks ADVECT_BLOCK_WIDTH cells wide, and
+	//while one block runs the source cells the next one traces back to are
+	//prefetched. Gathers stay within a few pages when velocities are large.
+	bool			mBlockedAdvection;
+
+	//With more than one process the group is forked once and the arena is placed
+	//in its shared memory, which has room to rebuild it without forking again.
+	//Only the red-black, SOR and Chebyshev Jacobi solves are split across the
+	//processes, one strip of rows each, reading each other's edge rows in place
+	//between half sweeps or steps. Every other pass runs in this process, on its
+	//thread pool.
+	ProcessGroup*	mProcessGroup;
 };
 
 
@@ -0,0 +1,727 @@
+#ifndef FLUIDSIMENSEMBLE_H
+#define FLUIDSIMENSEMBLE_H
+
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "GridLayout.h"
+#include "types.h"
+
+
+//N independent FluidSimT simulations on one grid, for parameter sweeps. Each
+//member has its own viscosity, diffusion, decay, gravity, sources and forces.
+//Every grid stores cell i of all N members together, member m of cell i at
+//(i * N) + m, and the interleaved densities keep each channel's N members
+//together. So every step of every kernel is the same operation on N
+//consecutive values, and with N a compile time constant the compiler turns
+//those loops into vector instructions, 4 or 8 members per instruction for
+//float with SSE2 or AVX2. Only advection reads each member from a different
+//place, its interpolation weights are worked out across members and the four
+//source cells gathered.
+//Members run FluidSimT's arithmetic in FluidSimT's order, so member m gives
+//the same results bit for bit as a FluidSimT with its parameters.
+template< typename Real, uint N, uint W = DYNAMIC_SIZE, uint H = DYNAMIC_SIZE, template< uint, uint > class Layout = RowMajorLayout >
+class FluidSimEnsemble
+{
+public:
+	//Every member starts out with the same parameters
+	FluidSimEnsemble( uint size_x, uint size_y, Real viscosity, Real diffusion, Real decay );
+	~FluidSimEnsemble();
+
+	void Update( Real dt );
+
+	void SetViscosity( uint member, Real viscosity );
+	void SetDiffusion( uint member, Real diffusion );
+	void SetDecay( uint member, Real decay );
+	void SetGravity( uint member, Real gu, Real gv );
+	void PlaceSource( uint member, uint x, uint y, Real r, Real g, Real b );
+	void EraseSource( uint member, uint x, uint y );
+	void ApplyForce( uint member, uint x, uint y, Real amount );
+
+	Real GetDensity( uint member, uint x, uint y, uint channel ) const	{ return mDensities[ (((IDX(x,y) * CHANNELS) + channel) * N) + member ]; }
+	Real GetVelocityU( uint member, uint x, uint y ) const				{ return mVelocitiesU[ (IDX(x,y) * N) + member ]; }
+	Real GetVelocityV( uint member, uint x, uint y ) const				{ return mVelocitiesV[ (IDX(x,y) * N) + member ]; }
+
+	//Copies one member out in FluidSimT's layout, densities with CHANNELS values
+	//per cell and velocities with one, NumCells() cells each. Any can be NULL.
+	void ExtractMember( uint member, Real* densities, Real* velocities_u, Real* velocities_v ) const;
+
+	uint GetNumCells() const { return NumCells(); }
+
+private:
+	const static uint CHANNELS			= 4;
+	const static uint SOLVER_ITERATIONS	= 10;
+
+	inline uint SizeX() const { return mLayout.SizeX(); }
+	inline uint SizeY() const { return mLayout.SizeY(); }
+	inline uint NumCells() const { return mLayout.NumCells(); }
+
+	//Array index helper, the cell. Its values for each member start at IDX * values per cell * N.
+	inline uint IDX( uint x, uint y ) const
+	{
+		assert( x < SizeX() && y < SizeY() );
+
+		return mLayout.Index( x, y );
+	}
+
+	void DensityStep( Real dt );
+	void VelocityStep( Real dt );
+	void AddSources( Real* d, const Real* s, Real dt, uint channels );
+	void AddForces( Real* u, Real* v, const Real* u0, const Real* v0, Real dt );
+	void Diffuse( int b, Real* d, const Real* d0, const Real* diff, Real dt, uint channels );
+	void AdvectDensity( Real* d, const Real* d0, const Real* u, const Real* v, Real dt );
+	void AdvectVelocity( Real* u, Real* v, const Real* u0, const Real* v0, Real dt );
+	void Project( Real* u, Real* v, Real* p, Real* div );
+	template< bool Pressure > void LinearSolve( int b, Real* d, const Real* d0, const Real* a, const Real* c, uint channels );	//Pressure for Project's solve, as FluidSimT
+	template< bool Pressure > inline void SolveMembers( Real* d, const Real* d0, const Real* left, const Real* right, const Real* up, const Real* down, const Real* a, const Real* c );
+	void Backtrace( const Real* u, const Real* v, Real dt0, uint x, uint y, uint cell, uint* i0, uint* j0, Real* s1, Real* t1 ) const;
+
+	//FluidSimT's boundaries, for all members at once
+	template< int B > void SetBoundaryRow( Real* d, uint y, uint channels );
+	template< int B > void SetBoundaryGhostRow( Real* d, uint ghost_y, uint y, uint channels );
+	void SetBoundaryRow( int b, Real* d, uint y, uint channels );
+	void SetBoundaryCorners( Real* d, uint channels );
+	void SetBoundary( int b, Real* d, uint channels = 1 );
+
+private:
+	const Layout< W, H > mLayout;
+
+	Real mViscosity[ N ];
+	Real mDiffusion[ N ];
+	Real mDecay[ N ];
+	Real mGravityU[ N ];
+	Real mGravityV[ N ];
+
+	//CHANNELS * N values per cell
+	Real* mDensities;
+	Real* mDensities0;
+	Real* mSources;
+
+	//N values per cell
+	Real* mVelocitiesU;
+	Real* mVelocitiesV;
+	Real* mVelocitiesU0;
+	Real* mVelocitiesV0;
+};
+
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+FluidSimEnsemble< Real, N, W, H, Layout >::FluidSimEnsemble( uint size_x, uint size_y, Real viscosity, Real diffusion, Real decay )
+	:	mLayout( size_x, size_y )
+{
+	for( uint m = 0; m < N; ++m )
+	{
+		mViscosity[m]	= viscosity;
+		mDiffusion[m]	= diffusion;
+		mDecay[m]		= decay;
+		mGravityU[m]	= 0;
+		mGravityV[m]	= 0;
+	}
+
+	mDensities		= new Real[ NumCells() * CHANNELS * N ];
+	mDensities0		= new Real[ NumCells() * CHANNELS * N ];
+	mSources		= new Real[ NumCells() * CHANNELS * N ];
+	mVelocitiesU	= new Real[ NumCells() * N ];
+	mVelocitiesV	= new Real[ NumCells() * N ];
+	mVelocitiesU0	= new Real[ NumCells() * N ];
+	mVelocitiesV0	= new Real[ NumCells() * N ];
+
+	memset( mDensities, 0, NumCells() * CHANNELS * N * sizeof(Real) );
+	memset( mDensities0, 0, NumCells() * CHANNELS * N * sizeof(Real) );
+	memset( mSources, 0, NumCells() * CHANNELS * N * sizeof(Real) );
+	memset( mVelocitiesU, 0, NumCells() * N * sizeof(Real) );
+	memset( mVelocitiesV, 0, NumCells() * N * sizeof(Real) );
+	memset( mVelocitiesU0, 0, NumCells() * N * sizeof(Real) );
+	memset( mVelocitiesV0, 0, NumCells() * N * sizeof(Real) );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+FluidSimEnsemble< Real, N, W, H, Layout >::~FluidSimEnsemble()
+{
+	delete [] mDensities;		mDensities = NULL;
+	delete [] mDensities0;		mDensities0 = NULL;
+	delete [] mSources;			mSources = NULL;
+	delete [] mVelocitiesU;		mVelocitiesU = NULL;
+	delete [] mVelocitiesV;		mVelocitiesV = NULL;
+	delete [] mVelocitiesU0;	mVelocitiesU0 = NULL;
+	delete [] mVelocitiesV0;	mVelocitiesV0 = NULL;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::Update( Real dt )
+{
+	DensityStep( dt );
+	VelocityStep( dt );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetViscosity( uint member, Real viscosity )
+{
+	assert( member < N );
+	mViscosity[ member ] = viscosity;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetDiffusion( uint member, Real diffusion )
+{
+	assert( member < N );
+	mDiffusion[ member ] = diffusion;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetDecay( uint member, Real decay )
+{
+	assert( member < N );
+	mDecay[ member ] = decay;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetGravity( uint member, Real gu, Real gv )
+{
+	assert( member < N );
+
+	//Screen space has y pointing down, as in FluidSim
+	mGravityU[ member ] = gu;
+	mGravityV[ member ] = -gv;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::PlaceSource( uint member, uint x, uint y, Real r, Real g, Real b )
+{
+	assert( member < N );
+
+	if( x == 0 || x >= (SizeX()-1) ||
+		y == 0 || y >= (SizeY()-1) )
+	{
+		//We don't allow manipulation of the edge regions
+		return;
+	}
+
+	const uint cells[] = { IDX(x,y), IDX(x-1,y), IDX(x+1,y), IDX(x,y-1), IDX(x,y+1) };
+
+	for( uint c = 0; c < 5; ++c )
+	{
+		Real* source = mSources + (cells[c] * CHANNELS * N) + member;
+		source[0]	= r;
+		source[N]	= g;
+		source[2*N]	= b;
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::EraseSource( uint member, uint x, uint y )
+{
+	assert( member < N );
+
+	if( x == 0 || x >= (SizeX()-1) ||
+		y == 0 || y >= (SizeY()-1) )
+	{
+		//We don't allow manipulation of the edge regions
+		return;
+	}
+
+	const uint cells[] = { IDX(x,y), IDX(x-1,y), IDX(x+1,y), IDX(x,y-1), IDX(x,y+1) };
+
+	for( uint c = 0; c < 5; ++c )
+	{
+		for( uint ch = 0; ch < CHANNELS; ++ch )
+		{
+			mSources[ (((cells[c] * CHANNELS) + ch) * N) + member ] = 0;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::ApplyForce( uint member, uint x, uint y, Real amount )
+{
+	assert( member < N );
+
+	if( x == 0 || x >= (SizeX()-1) ||
+		y == 0 || y >= (SizeY()-1) )
+	{
+		//We don't allow manipulation of the edge regions
+		return;
+	}
+
+	Real* u = mVelocitiesU + member;
+	Real* v = mVelocitiesV + member;
+
+	//Create a splash velocity
+	u[IDX(x-1,y-1) * N]	-= amount;
+	u[IDX(x-1,y  ) * N]	-= amount;
+	u[IDX(x-1,y+1) * N]	-= amount;
+	u[IDX(x+1,y-1) * N]	+= amount;
+	u[IDX(x+1,y  ) * N]	+= amount;
+	u[IDX(x+1,y+1) * N]	+= amount;
+	v[IDX(x-1,y-1) * N]	-= amount;
+	v[IDX(x  ,y-1) * N]	-= amount;
+	v[IDX(x+1,y-1) * N]	-= amount;
+	v[IDX(x-1,y+1) * N]	+= amount;
+	v[IDX(x  ,y+1) * N]	+= amount;
+	v[IDX(x+1,y+1) * N]	+= amount;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::ExtractMember( uint member, Real* densities, Real* velocities_u, Real* velocities_v ) const
+{
+	assert( member < N );
+
+	for( uint i = 0; i < NumCells(); ++i )
+	{
+		if( densities != NULL )
+		{
+			for( uint ch = 0; ch < CHANNELS; ++ch )
+			{
+				densities[ (i * CHANNELS) + ch ] = mDensities[ (((i * CHANNELS) + ch) * N) + member ];
+			}
+		}
+
+		if( velocities_u != NULL )
+		{
+			velocities_u[i] = mVelocitiesU[ (i * N) + member ];
+		}
+
+		if( velocities_v != NULL )
+		{
+			velocities_v[i] = mVelocitiesV[ (i * N) + member ];
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::DensityStep( Real dt )
+{
+	AddSources( mDensities, mSources, dt, CHANNELS );
+	Diffuse( 0, mDensities0, mDensities, mDiffusion, dt, CHANNELS );
+	AdvectDensity( mDensities, mDensities0, mVelocitiesU, mVelocitiesV, dt );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::VelocityStep( Real dt )
+{
+	//FluidSimT::VelocityStep's buffer rotation
+	Real* u		= mVelocitiesU;
+	Real* v		= mVelocitiesV;
+	Real* u0	= mVelocitiesU0;
+	Real* v0	= mVelocitiesV0;
+
+	AddForces( u, v, u0, v0, dt );
+	Diffuse( 1, u0, u, mViscosity, dt, 1 );
+	Diffuse( 2, v0, v, mViscosity, dt, 1 );
+	Project( u0, v0, u, v );
+	AdvectVelocity( u, v, u0, v0, dt );
+	Project( u, v, u0, v0 );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::AddSources( Real* d, const Real* s, Real dt, uint channels )
+{
+	const uint values = channels * N;
+
+	mLayout.ForEachInterior( [&]( uint, uint, uint i )
+	{
+		for( uint j = i * values, end = (i+1) * values; j < end; ++j )
+		{
+			d[ j ] += dt * s[ j ];
+		}
+	} );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::AddForces( Real* u, Real* v, const Real* u0, const Real* v0, Real dt )
+{
+	Real gu[ N ];
+	Real gv[ N ];
+	for( uint m = 0; m < N; ++m )
+	{
+		gu[m] = mGravityU[m] * dt;
+		gv[m] = mGravityV[m] * dt;
+	}
+
+	mLayout.ForEachInterior( [&]( uint, uint, uint i )
+	{
+		const Real* density = mDensities + (i * CHANNELS * N);
+		Real next_u[ N ], next_v[ N ];
+
+		for( uint m = 0; m < N; ++m )
+		{
+			const uint j = (i * N) + m;
+			Real d = ( density[m] + density[N+m] + density[2*N+m] ) / Real( 3 );
+
+			next_u[m] = ( u[ j ] + dt * u0[ j ] ) + d * gu[m];
+			next_v[m] = ( v[ j ] + dt * v0[ j ] ) + d * gv[m];
+		}
+
+		for( uint m = 0; m < N; ++m )
+		{
+			u[(i * N) + m] = next_u[m];
+			v[(i * N) + m] = next_v[m];
+		}
+	} );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::Diffuse( int b, Real* d, const Real* d0, const Real* diff, Real dt, uint channels )
+{
+	Real a[ N ];
+	Real c[ N ];
+	for( uint m = 0; m < N; ++m )
+	{
+		a[m] = dt * diff[m] * SizeX() * SizeY();
+		c[m] = 1+4*a[m];
+	}
+
+	LinearSolve<false>( b, d, d0, a, c, channels );
+}
+
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::Backtrace( const Real* u, const Real* v, Real dt0, uint x, uint y, uint cell, uint* i0, uint* j0, Real* s1, Real* t1 ) const
+{
+	const Real* cell_u = u + (cell * N);
+	const Real* cell_v = v + (cell * N);
+
+	for( uint m = 0; m < N; ++m )
+	{
+		Real x1 = x - dt0 * cell_u[m];
+		Real y1 = y - dt0 * cell_v[m];
+
+		x1 = std::min( std::max( x1, Real( 0.5 ) ), SizeX() - Real( 1.501 ) );
+		y1 = std::min( std::max( y1, Real( 0.5 ) ), SizeY() - Real( 1.501 ) );
+
+		i0[m]	= (int)x1;
+		j0[m]	= (int)y1;
+		s1[m]	= x1-i0[m];
+		t1[m]	= y1-j0[m];
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::AdvectDensity( Real* d, const Real* d0, const Real* u, const Real* v, Real dt )
+{
+	const Real dt0 = dt * SizeX();
+
+	Real decay[ N ];
+	for( uint m = 0; m < N; ++m )
+	{
+		decay[m] = mDecay[m] * dt;
+	}
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		uint i0[ N ], j0[ N ];
+		Real s1[ N ], t1[ N ];
+		Backtrace( u, v, dt0, x, y, i, i0, j0, s1, t1 );
+
+		//Where each member's four source cells start, the channels are N apart from there
+		uint i00[ N ], i01[ N ], i10[ N ], i11[ N ];
+		for( uint m = 0; m < N; ++m )
+		{
+			i00[m] = (IDX(i0[m],j0[m]) * CHANNELS * N) + m;
+			i01[m] = (IDX(i0[m],j0[m]+1) * CHANNELS * N) + m;
+			i10[m] = (IDX(i0[m]+1,j0[m]) * CHANNELS * N) + m;
+			i11[m] = (IDX(i0[m]+1,j0[m]+1) * CHANNELS * N) + m;
+		}
+
+		Real* dst = d + (i * CHANNELS * N);
+
+		for( uint ch = 0; ch < CHANNELS * N; ch += N )
+		{
+			for( uint m = 0; m < N; ++m )
+			{
+				const Real s0 = 1-s1[m];
+				const Real t0 = 1-t1[m];
+				Real value = s0*(t0*d0[i00[m]+ch]+t1[m]*d0[i01[m]+ch])+s1[m]*(t0*d0[i10[m]+ch]+t1[m]*d0[i11[m]+ch]);
+
+				value -= decay[m];
+				if( value < 0 )
+				{
+					value = 0;
+				}
+
+				dst[ch+m] = value;
+			}
+		}
+	} );
+
+	SetBoundary( 0, d, CHANNELS );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::AdvectVelocity( Real* u, Real* v, const Real* u0, const Real* v0, Real dt )
+{
+	const Real dt0 = dt * SizeX();
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		uint i0[ N ], j0[ N ];
+		Real s1[ N ], t1[ N ];
+		Backtrace( u0, v0, dt0, x, y, i, i0, j0, s1, t1 );
+
+		for( uint m = 0; m < N; ++m )
+		{
+			const Real s0 = 1-s1[m];
+			const Real t0 = 1-t1[m];
+			const uint i00 = (IDX(i0[m],j0[m]) * N) + m;
+			const uint i01 = (IDX(i0[m],j0[m]+1) * N) + m;
+			const uint i10 = (IDX(i0[m]+1,j0[m]) * N) + m;
+			const uint i11 = (IDX(i0[m]+1,j0[m]+1) * N) + m;
+			const uint j = (i * N) + m;
+
+			u[j] = s0*(t0*u0[i00]+t1[m]*u0[i01])+s1[m]*(t0*u0[i10]+t1[m]*u0[i11]);
+			v[j] = s0*(t0*v0[i00]+t1[m]*v0[i01])+s1[m]*(t0*v0[i10]+t1[m]*v0[i11]);
+		}
+	} );
+
+	SetBoundary( 1, u );
+	SetBoundary( 2, v );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::Project( Real* u, Real* v, Real* p, Real* div )
+{
+	const Real h = Real( 1 ) / SizeX();
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		const Real* right	= u + (IDX(x+1,y) * N);
+		const Real* left	= u + (IDX(x-1,y) * N);
+		const Real* down	= v + (IDX(x,y+1) * N);
+		const Real* up		= v + (IDX(x,y-1) * N);
+		Real next[ N ];
+
+		for( uint m = 0; m < N; ++m )
+		{
+			next[m] = Real( -0.5 ) * h * ( right[m] - left[m] + down[m] - up[m] );
+		}
+
+		for( uint m = 0; m < N; ++m )
+		{
+			div[(i * N) + m] = next[m];
+		}
+	} );
+
+	memset( p, 0, NumCells() * N * sizeof(Real) );
+
+	SetBoundary( 0, div );
+	SetBoundary( 0, p );
+
+	Real a[ N ];
+	Real c[ N ];
+	for( uint m = 0; m < N; ++m )
+	{
+		a[m] = 1;
+		c[m] = 4;
+	}
+
+	LinearSolve<true>( 0, p, div, a, c, 1 );
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		const Real* right	= p + (IDX(x+1,y) * N);
+		const Real* left	= p + (IDX(x-1,y) * N);
+		const Real* down	= p + (IDX(x,y+1) * N);
+		const Real* up		= p + (IDX(x,y-1) * N);
+		Real next_u[ N ], next_v[ N ];
+
+		for( uint m = 0; m < N; ++m )
+		{
+			next_u[m] = u[(i * N) + m] - Real( 0.5 )*(right[m]-left[m])/h;
+			next_v[m] = v[(i * N) + m] - Real( 0.5 )*(down[m]-up[m])/h;
+		}
+
+		for( uint m = 0; m < N; ++m )
+		{
+			u[(i * N) + m] = next_u[m];
+			v[(i * N) + m] = next_v[m];
+		}
+	} );
+
+	SetBoundary( 1, u );
+	SetBoundary( 2, v );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+template< bool Pressure >
+void FluidSimEnsemble< Real, N, W, H, Layout >::LinearSolve( int b, Real* d, const Real* d0, const Real* a, const Real* c, uint channels )
+{
+	const uint values = channels * N;
+
+	//Row by row whatever the layout, Gauss-Seidel's result depends on the order.
+	//Members don't read each other, so each cell updates all of them at once.
+	for( uint k = 0; k < SOLVER_ITERATIONS; ++k )
+	{
+		for( uint y = 1; y < (SizeY()-1); ++y )
+		{
+			for( uint x = 1; x < (SizeX()-1); ++x )
+			{
+				const uint i		= IDX(x,y) * values;
+				const uint left		= IDX(x-1,y) * values;
+				const uint right	= IDX(x+1,y) * values;
+				const uint up		= IDX(x,y-1) * values;
+				const uint down		= IDX(x,y+1) * values;
+
+				for( uint ch = 0; ch < values; ch += N )
+				{
+					SolveMembers<Pressure>( d + i + ch, d0 + i + ch, d + left + ch, d + right + ch, d + up + ch, d + down + ch, a, c );
+				}
+			}
+
+			//Ghost cells are only read by the cell they copy, so the row's can be refreshed straight away
+			SetBoundaryRow( b, d, y, channels );
+		}
+	}
+
+	SetBoundaryCorners( d, channels );
+}
+
+//------------------------------------------------------------------------------
+//One Gauss-Seidel update of a value in every member. The results go through a
+//local, written straight to d the compiler would have to allow for them
+//overlapping the neighbours and wouldn't vectorise. Project's solve sums the
+//divergence in first, as FluidSimT does.
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+template< bool Pressure >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SolveMembers( Real* d, const Real* d0, const Real* left, const Real* right, const Real* up, const Real* down, const Real* a, const Real* c )
+{
+	Real next[ N ];
+
+	for( uint m = 0; m < N; ++m )
+	{
+		if( Pressure )
+		{
+			next[m] = (d0[m]+left[m]+right[m]+up[m]+down[m])/c[m];
+		}
+		else
+		{
+			next[m] = (d0[m] + a[m]*(left[m]+right[m]+up[m]+down[m]))/c[m];
+		}
+	}
+
+	for( uint m = 0; m < N; ++m )
+	{
+		d[m] = next[m];
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+template< int B >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetBoundaryRow( Real* d, uint y, uint channels )
+{
+	const uint values		= channels * N;
+	const uint left_ghost	= IDX(0,y) * values;
+	const uint left			= IDX(1,y) * values;
+	const uint right_ghost	= IDX(SizeX()-1,y) * values;
+	const uint right		= IDX(SizeX()-2,y) * values;
+
+	for( uint j = 0; j < values; ++j )
+	{
+		d[left_ghost + j]	= B==1 ? -d[left + j]	: d[left + j];
+		d[right_ghost + j]	= B==1 ? -d[right + j]	: d[right + j];
+	}
+
+	//The top and bottom ghost rows copy the first and last interior rows
+	if( y == 1 )
+	{
+		SetBoundaryGhostRow<B>( d, 0, y, channels );
+	}
+
+	if( y == SizeY()-2 )
+	{
+		SetBoundaryGhostRow<B>( d, SizeY()-1, y, channels );
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+template< int B >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetBoundaryGhostRow( Real* d, uint ghost_y, uint y, uint channels )
+{
+	const uint values = channels * N;
+
+	for( uint x = 1; x < (SizeX()-1); ++x )
+	{
+		const uint ghost	= IDX(x,ghost_y) * values;
+		const uint inside	= IDX(x,y) * values;
+
+		for( uint j = 0; j < values; ++j )
+		{
+			d[ghost + j] = B==2 ? -d[inside + j] : d[inside + j];
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetBoundaryRow( int b, Real* d, uint y, uint channels )
+{
+	switch( b )
+	{
+	case 1:		SetBoundaryRow<1>( d, y, channels );	break;
+	case 2:		SetBoundaryRow<2>( d, y, channels );	break;
+	default:	SetBoundaryRow<0>( d, y, channels );	break;
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetBoundaryCorners( Real* d, uint channels )
+{
+	const uint values = channels * N;
+	const uint last_x = SizeX()-1;
+	const uint last_y = SizeY()-1;
+
+	const uint corners[][3] =
+	{
+		{ IDX(0,0),				IDX(1,0),				IDX(0,1) },
+		{ IDX(0,last_y),		IDX(1,last_y),			IDX(0,last_y-1) },
+		{ IDX(last_x,0),		IDX(last_x-1,0),		IDX(last_x,1) },
+		{ IDX(last_x,last_y),	IDX(last_x-1,last_y),	IDX(last_x,last_y-1) },
+	};
+
+	for( uint j = 0; j < values; ++j )
+	{
+		for( uint c = 0; c < 4; ++c )
+		{
+			d[(corners[c][0] * values) + j] = Real( 0.5f*(d[(corners[c][1] * values) + j] + d[(corners[c][2] * values) + j]) );
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint N, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimEnsemble< Real, N, W, H, Layout >::SetBoundary( int b, Real* d, uint channels )
+{
+	for( uint y = 1; y < (SizeY()-1); ++y )
+	{
+		SetBoundaryRow( b, d, y, channels );
+	}
+
+	SetBoundaryCorners( d, channels );
+}
+
+
+#endif //FLUIDSIMENSEMBLE_H
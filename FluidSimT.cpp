@@ -0,0 +1,19 @@
+#include "FluidSimT.h"
+#include "FluidSimEnsemble.h"
+
+
+//The header is all templates, so nothing else would build them. Instantiating
+//the sizes and types the benchmarks compare here means a change to FluidSimT,
+//or to the layouts it goes through, has to compile.
+template class FluidSimT< float, 60, 100 >;
+template class FluidSimT< float >;
+template class FluidSimT< double, 60, 100 >;
+
+//The tiled and Morton layouts, as the benchmark checks and times them
+template class FluidSimT< float, 60, 100, TiledLayout >;
+template class FluidSimT< float, 60, 100, MortonLayout >;
+template class FluidSimT< float, DYNAMIC_SIZE, DYNAMIC_SIZE, TiledLayout >;
+template class FluidSimT< float, DYNAMIC_SIZE, DYNAMIC_SIZE, MortonLayout >;
+
+//The ensemble the benchmark checks against FluidSimT
+template class FluidSimEnsemble< float, 8, 60, 100 >;
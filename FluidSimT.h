@@ -0,0 +1,535 @@
+#ifndef FLUIDSIMT_H
+#define FLUIDSIMT_H
+
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "GridLayout.h"
+#include "types.h"
+
+
+namespace Benchmark
+{
+	class KernelTimer;
+}
+
+
+//The simulation FluidSim runs with its defaults (fixed Gauss-Seidel sweeps for
+//every solve, pressure solved from zero, float RGBX densities), as a template on
+//the scalar type and grid size. With W and H fixed, every stride, loop bound
+//and index is a constant the compiler can unroll and vectorise around.
+//FluidSimT<float, W, H> gives the same results as FluidSim bit for bit, and
+//FluidSimT<double, W, H> is a higher precision reference for validating it.
+//Layout decides how each grid is ordered in memory, see GridLayout.h. Only the
+//addresses change, every layout gives the same results.
+template< typename Real, uint W = DYNAMIC_SIZE, uint H = DYNAMIC_SIZE, template< uint, uint > class Layout = RowMajorLayout >
+class FluidSimT
+{
+public:
+	FluidSimT( uint size_x, uint size_y, Real viscosity, Real diffusion, Real decay );
+	~FluidSimT();
+
+	void Update( Real dt );
+	void PlaceSource( uint x, uint y, Real r, Real g, Real b );
+	void EraseSource( uint x, uint y );
+	void ApplyForce( uint x, uint y, Real amount );
+	void SetGravity( Real gu, Real gv );
+
+	Real GetDensity( uint x, uint y, uint channel ) const	{ return mDensities[ (IDX(x,y) * CHANNELS) + channel ]; }
+	Real GetVelocityU( uint x, uint y ) const				{ return mVelocitiesU[ IDX(x,y) ]; }
+	Real GetVelocityV( uint x, uint y ) const				{ return mVelocitiesV[ IDX(x,y) ]; }
+
+private:
+	friend class Benchmark::KernelTimer;	//Times each kernel on its own, to compare layouts
+
+	const static uint CHANNELS			= 4;
+	const static uint SOLVER_ITERATIONS	= 10;
+
+	inline uint SizeX() const { return mLayout.SizeX(); }
+	inline uint SizeY() const { return mLayout.SizeY(); }
+	inline uint NumCells() const { return mLayout.NumCells(); }
+
+	//Array index helper
+	inline uint IDX( uint x, uint y ) const
+	{
+		assert( x < SizeX() && y < SizeY() );
+
+		return mLayout.Index( x, y );
+	}
+
+	void DensityStep( Real dt );
+	void VelocityStep( Real dt );
+	void AddSources( Real* d, const Real* s, Real dt, uint channels );
+	void AddForces( Real* u, Real* v, const Real* u0, const Real* v0, Real dt );
+	void Diffuse( int b, Real* d, const Real* d0, Real diff, Real dt, uint channels );
+	void AdvectDensity( Real* d, const Real* d0, const Real* u, const Real* v, Real decay, Real dt );
+	void AdvectVelocity( Real* u, Real* v, const Real* u0, const Real* v0, Real dt );
+	void Project( Real* u, Real* v, Real* p, Real* div );
+	template< bool Pressure > void LinearSolve( int b, Real* d, const Real* d0, Real a, Real c, uint channels );	//Pressure for Project's solve, see FluidSim::GaussSeidelRow
+	void Backtrace( const Real* u, const Real* v, Real dt0, uint x, uint y, uint cell, uint& i0, uint& j0, Real& s1, Real& t1 ) const;
+
+	//Boundary.h's SetBoundary, going through the layout
+	template< int B > void SetBoundaryRow( Real* d, uint y, uint channels );
+	template< int B > void SetBoundaryGhostRow( Real* d, uint ghost_y, uint y, uint channels );
+	void SetBoundaryRow( int b, Real* d, uint y, uint channels );
+	void SetBoundaryCorners( Real* d, uint channels );
+	void SetBoundary( int b, Real* d, uint channels = 1 );
+
+private:
+	const Layout< W, H > mLayout;
+
+	const Real mViscosity;
+	const Real mDiffusion;
+	const Real mDecay;
+
+	//Densities and sources are interleaved RGBX, CHANNELS values per cell
+	Real* mDensities;
+	Real* mDensities0;
+	Real* mSources;
+
+	Real* mVelocitiesU;
+	Real* mVelocitiesV;
+	Real* mVelocitiesU0;
+	Real* mVelocitiesV0;
+
+	Real mGravityU;
+	Real mGravityV;
+};
+
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+FluidSimT< Real, W, H, Layout >::FluidSimT( uint size_x, uint size_y, Real viscosity, Real diffusion, Real decay )
+	:	mLayout( size_x, size_y )
+	,	mViscosity( viscosity )
+	,	mDiffusion( diffusion )
+	,	mDecay( decay )
+	,	mGravityU( 0 )
+	,	mGravityV( 0 )
+{
+	mDensities		= new Real[ NumCells() * CHANNELS ];
+	mDensities0		= new Real[ NumCells() * CHANNELS ];
+	mSources		= new Real[ NumCells() * CHANNELS ];
+	mVelocitiesU	= new Real[ NumCells() ];
+	mVelocitiesV	= new Real[ NumCells() ];
+	mVelocitiesU0	= new Real[ NumCells() ];
+	mVelocitiesV0	= new Real[ NumCells() ];
+
+	memset( mDensities, 0, NumCells() * CHANNELS * sizeof(Real) );
+	memset( mDensities0, 0, NumCells() * CHANNELS * sizeof(Real) );
+	memset( mSources, 0, NumCells() * CHANNELS * sizeof(Real) );
+	memset( mVelocitiesU, 0, NumCells() * sizeof(Real) );
+	memset( mVelocitiesV, 0, NumCells() * sizeof(Real) );
+	memset( mVelocitiesU0, 0, NumCells() * sizeof(Real) );
+	memset( mVelocitiesV0, 0, NumCells() * sizeof(Real) );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+FluidSimT< Real, W, H, Layout >::~FluidSimT()
+{
+	delete [] mDensities;		mDensities = NULL;
+	delete [] mDensities0;		mDensities0 = NULL;
+	delete [] mSources;			mSources = NULL;
+	delete [] mVelocitiesU;		mVelocitiesU = NULL;
+	delete [] mVelocitiesV;		mVelocitiesV = NULL;
+	delete [] mVelocitiesU0;	mVelocitiesU0 = NULL;
+	delete [] mVelocitiesV0;	mVelocitiesV0 = NULL;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::Update( Real dt )
+{
+	DensityStep( dt );
+	VelocityStep( dt );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::PlaceSource( uint x, uint y, Real r, Real g, Real b )
+{
+	if( x == 0 || x >= (SizeX()-1) ||
+		y == 0 || y >= (SizeY()-1) )
+	{
+		//We don't allow manipulation of the edge regions
+		return;
+	}
+
+	const uint cells[] = { IDX(x,y), IDX(x-1,y), IDX(x+1,y), IDX(x,y-1), IDX(x,y+1) };
+
+	for( uint c = 0; c < 5; ++c )
+	{
+		Real* source = mSources + (cells[c] * CHANNELS);
+		source[0] = r;
+		source[1] = g;
+		source[2] = b;
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::EraseSource( uint x, uint y )
+{
+	if( x == 0 || x >= (SizeX()-1) ||
+		y == 0 || y >= (SizeY()-1) )
+	{
+		//We don't allow manipulation of the edge regions
+		return;
+	}
+
+	const uint cells[] = { IDX(x,y), IDX(x-1,y), IDX(x+1,y), IDX(x,y-1), IDX(x,y+1) };
+
+	for( uint c = 0; c < 5; ++c )
+	{
+		memset( mSources + (cells[c] * CHANNELS), 0, CHANNELS * sizeof(Real) );
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::ApplyForce( uint x, uint y, Real amount )
+{
+	if( x == 0 || x >= (SizeX()-1) ||
+		y == 0 || y >= (SizeY()-1) )
+	{
+		//We don't allow manipulation of the edge regions
+		return;
+	}
+
+	//Create a splash velocity
+	mVelocitiesU[IDX(x-1,y-1)]	-= amount;
+	mVelocitiesU[IDX(x-1,y  )]	-= amount;
+	mVelocitiesU[IDX(x-1,y+1)]	-= amount;
+	mVelocitiesU[IDX(x+1,y-1)]	+= amount;
+	mVelocitiesU[IDX(x+1,y  )]	+= amount;
+	mVelocitiesU[IDX(x+1,y+1)]	+= amount;
+	mVelocitiesV[IDX(x-1,y-1)]	-= amount;
+	mVelocitiesV[IDX(x  ,y-1)]	-= amount;
+	mVelocitiesV[IDX(x+1,y-1)]	-= amount;
+	mVelocitiesV[IDX(x-1,y+1)]	+= amount;
+	mVelocitiesV[IDX(x  ,y+1)]	+= amount;
+	mVelocitiesV[IDX(x+1,y+1)]	+= amount;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::SetGravity( Real gu, Real gv )
+{
+	//Screen space has y pointing down, as in FluidSim
+	mGravityU = gu;
+	mGravityV = -gv;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::DensityStep( Real dt )
+{
+	AddSources( mDensities, mSources, dt, CHANNELS );
+	Diffuse( 0, mDensities0, mDensities, mDiffusion, dt, CHANNELS );
+	AdvectDensity( mDensities, mDensities0, mVelocitiesU, mVelocitiesV, mDecay * dt, dt );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::VelocityStep( Real dt )
+{
+	//Same buffer rotation as FluidSim::VelocityStep, spelled out. Pressure and divergence
+	//are left in u0 and v0, and the next step adds them back in as sources.
+	Real* u		= mVelocitiesU;
+	Real* v		= mVelocitiesV;
+	Real* u0	= mVelocitiesU0;
+	Real* v0	= mVelocitiesV0;
+
+	AddForces( u, v, u0, v0, dt );
+	Diffuse( 1, u0, u, mViscosity, dt, 1 );
+	Diffuse( 2, v0, v, mViscosity, dt, 1 );
+	Project( u0, v0, u, v );
+	AdvectVelocity( u, v, u0, v0, dt );
+	Project( u, v, u0, v0 );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::AddSources( Real* d, const Real* s, Real dt, uint channels )
+{
+	mLayout.ForEachInterior( [&]( uint, uint, uint i )
+	{
+		for( uint ch = i * channels, end = (i+1) * channels; ch < end; ++ch )
+		{
+			d[ ch ] += dt * s[ ch ];
+		}
+	} );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::AddForces( Real* u, Real* v, const Real* u0, const Real* v0, Real dt )
+{
+	//Velocity sources and gravity in one pass, as FluidSim does
+	const Real gu = mGravityU * dt;
+	const Real gv = mGravityV * dt;
+
+	mLayout.ForEachInterior( [&]( uint, uint, uint i )
+	{
+		const Real* density = mDensities + (i * CHANNELS);
+		Real d = ( density[0] + density[1] + density[2] ) / Real( 3 );
+
+		u[ i ] = ( u[ i ] + dt * u0[ i ] ) + d * gu;
+		v[ i ] = ( v[ i ] + dt * v0[ i ] ) + d * gv;
+	} );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::Diffuse( int b, Real* d, const Real* d0, Real diff, Real dt, uint channels )
+{
+	const Real a = dt * diff * SizeX() * SizeY();
+
+	LinearSolve<false>( b, d, d0, a, 1+4*a, channels );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::Backtrace( const Real* u, const Real* v, Real dt0, uint x, uint y, uint cell, uint& i0, uint& j0, Real& s1, Real& t1 ) const
+{
+	Real x1 = x - dt0 * u[cell];
+	Real y1 = y - dt0 * v[cell];
+
+	x1 = std::min( std::max( x1, Real( 0.5 ) ), SizeX() - Real( 1.501 ) );
+	y1 = std::min( std::max( y1, Real( 0.5 ) ), SizeY() - Real( 1.501 ) );
+
+	i0	= (int)x1;
+	j0	= (int)y1;
+	s1	= x1-i0;
+	t1	= y1-j0;
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::AdvectDensity( Real* d, const Real* d0, const Real* u, const Real* v, Real decay, Real dt )
+{
+	const Real dt0 = dt * SizeX();
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		uint i0, j0;
+		Real s1, t1;
+		Backtrace( u, v, dt0, x, y, i, i0, j0, s1, t1 );
+
+		const Real s0 = 1-s1;
+		const Real t0 = 1-t1;
+		const Real* src00 = d0 + (IDX(i0,j0) * CHANNELS);
+		const Real* src01 = d0 + (IDX(i0,j0+1) * CHANNELS);
+		const Real* src10 = d0 + (IDX(i0+1,j0) * CHANNELS);
+		const Real* src11 = d0 + (IDX(i0+1,j0+1) * CHANNELS);
+		Real* dst = d + (i * CHANNELS);
+
+		for( uint ch = 0; ch < CHANNELS; ++ch )
+		{
+			Real value = s0*(t0*src00[ch]+t1*src01[ch])+s1*(t0*src10[ch]+t1*src11[ch]);
+
+			value -= decay;
+			if( value < 0 )
+			{
+				value = 0;
+			}
+
+			dst[ch] = value;
+		}
+	} );
+
+	SetBoundary( 0, d, CHANNELS );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::AdvectVelocity( Real* u, Real* v, const Real* u0, const Real* v0, Real dt )
+{
+	const Real dt0 = dt * SizeX();
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		uint i0, j0;
+		Real s1, t1;
+		Backtrace( u0, v0, dt0, x, y, i, i0, j0, s1, t1 );
+
+		const Real s0 = 1-s1;
+		const Real t0 = 1-t1;
+		const uint i00 = IDX(i0,j0);
+		const uint i01 = IDX(i0,j0+1);
+		const uint i10 = IDX(i0+1,j0);
+		const uint i11 = IDX(i0+1,j0+1);
+
+		u[i] = s0*(t0*u0[i00]+t1*u0[i01])+s1*(t0*u0[i10]+t1*u0[i11]);
+		v[i] = s0*(t0*v0[i00]+t1*v0[i01])+s1*(t0*v0[i10]+t1*v0[i11]);
+	} );
+
+	SetBoundary( 1, u );
+	SetBoundary( 2, v );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::Project( Real* u, Real* v, Real* p, Real* div )
+{
+	const Real h = Real( 1 ) / SizeX();
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		div[i] = Real( -0.5 ) * h * ( u[IDX(x+1,y)] - u[IDX(x-1,y)] + v[IDX(x,y+1)] - v[IDX(x, y-1)] );
+	} );
+
+	memset( p, 0, NumCells() * sizeof(Real) );
+
+	SetBoundary( 0, div );
+	SetBoundary( 0, p );
+
+	LinearSolve<true>( 0, p, div, 1, 4, 1 );
+
+	mLayout.ForEachInterior( [&]( uint x, uint y, uint i )
+	{
+		u[i] -= Real( 0.5 )*(p[IDX(x+1,y)]-p[IDX(x-1,y)])/h;
+		v[i] -= Real( 0.5 )*(p[IDX(x,y+1)]-p[IDX(x,y-1)])/h;
+	} );
+
+	SetBoundary( 1, u );
+	SetBoundary( 2, v );
+}
+
+//------------------------------------------------------------------------------
+//Project's pressure solve sums the divergence in first, as FluidSim does
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+template< bool Pressure >
+void FluidSimT< Real, W, H, Layout >::LinearSolve( int b, Real* d, const Real* d0, Real a, Real c, uint channels )
+{
+	//Row by row whatever the layout, Gauss-Seidel's result depends on the order
+	for( uint k = 0; k < SOLVER_ITERATIONS; ++k )
+	{
+		for( uint y = 1; y < (SizeY()-1); ++y )
+		{
+			for( uint x = 1; x < (SizeX()-1); ++x )
+			{
+				const uint i		= IDX(x,y) * channels;
+				const uint left		= IDX(x-1,y) * channels;
+				const uint right	= IDX(x+1,y) * channels;
+				const uint up		= IDX(x,y-1) * channels;
+				const uint down		= IDX(x,y+1) * channels;
+
+				for( uint ch = 0; ch < channels; ++ch )
+				{
+					if( Pressure )
+					{
+						d[i+ch] = (d0[i+ch]+d[left+ch]+d[right+ch]+d[up+ch]+d[down+ch])/c;
+					}
+					else
+					{
+						d[i+ch] = (d0[i+ch] + a*(d[left+ch]+d[right+ch]+d[up+ch]+d[down+ch]))/c;
+					}
+				}
+			}
+
+			//Ghost cells are only read by the cell they copy, so the row's can be refreshed straight away
+			SetBoundaryRow( b, d, y, channels );
+		}
+	}
+
+	SetBoundaryCorners( d, channels );
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+template< int B >
+void FluidSimT< Real, W, H, Layout >::SetBoundaryRow( Real* d, uint y, uint channels )
+{
+	const uint left_ghost	= IDX(0,y) * channels;
+	const uint left			= IDX(1,y) * channels;
+	const uint right_ghost	= IDX(SizeX()-1,y) * channels;
+	const uint right		= IDX(SizeX()-2,y) * channels;
+
+	for( uint ch = 0; ch < channels; ++ch )
+	{
+		d[left_ghost + ch]	= B==1 ? -d[left + ch]	: d[left + ch];
+		d[right_ghost + ch]	= B==1 ? -d[right + ch]	: d[right + ch];
+	}
+
+	//The top and bottom ghost rows copy the first and last interior rows
+	if( y == 1 )
+	{
+		SetBoundaryGhostRow<B>( d, 0, y, channels );
+	}
+
+	if( y == SizeY()-2 )
+	{
+		SetBoundaryGhostRow<B>( d, SizeY()-1, y, channels );
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+template< int B >
+void FluidSimT< Real, W, H, Layout >::SetBoundaryGhostRow( Real* d, uint ghost_y, uint y, uint channels )
+{
+	for( uint x = 1; x < (SizeX()-1); ++x )
+	{
+		const uint ghost	= IDX(x,ghost_y) * channels;
+		const uint inside	= IDX(x,y) * channels;
+
+		for( uint ch = 0; ch < channels; ++ch )
+		{
+			d[ghost + ch] = B==2 ? -d[inside + ch] : d[inside + ch];
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::SetBoundaryRow( int b, Real* d, uint y, uint channels )
+{
+	switch( b )
+	{
+	case 1:		SetBoundaryRow<1>( d, y, channels );	break;
+	case 2:		SetBoundaryRow<2>( d, y, channels );	break;
+	default:	SetBoundaryRow<0>( d, y, channels );	break;
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::SetBoundaryCorners( Real* d, uint channels )
+{
+	const uint last_x = SizeX()-1;
+	const uint last_y = SizeY()-1;
+
+	const uint corners[][3] =
+	{
+		{ IDX(0,0),				IDX(1,0),				IDX(0,1) },
+		{ IDX(0,last_y),		IDX(1,last_y),			IDX(0,last_y-1) },
+		{ IDX(last_x,0),		IDX(last_x-1,0),		IDX(last_x,1) },
+		{ IDX(last_x,last_y),	IDX(last_x-1,last_y),	IDX(last_x,last_y-1) },
+	};
+
+	for( uint ch = 0; ch < channels; ++ch )
+	{
+		for( uint c = 0; c < 4; ++c )
+		{
+			d[(corners[c][0] * channels) + ch] = Real( 0.5f*(d[(corners[c][1] * channels) + ch] + d[(corners[c][2] * channels) + ch]) );
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+template< typename Real, uint W, uint H, template< uint, uint > class Layout >
+void FluidSimT< Real, W, H, Layout >::SetBoundary( int b, Real* d, uint channels )
+{
+	for( uint y = 1; y < (SizeY()-1); ++y )
+	{
+		SetBoundaryRow( b, d, y, channels );
+	}
+
+	SetBoundaryCorners( d, channels );
+}
+
+
+#endif //FLUIDSIMT_H
@@ -0,0 +1,250 @@
+#include "ForceKernels.h"
+#include "AdvectKernels.h"
+
+#if defined(SIMD_X86)
+	#include <immintrin.h>
+#endif
+
+namespace ForceKernels
+{
+	//------------------------------------------------------------------------------
+	const static uint CHANNELS = AdvectKernels::INTERLEAVED_CHANNELS;
+
+	//------------------------------------------------------------------------------
+	template< typename T > static inline void ApplyCell( float* u, float* v, const float* u0, const float* v0, const T* d, float dt, float gu, float gv, uint i )
+	{
+		//Gravity follows the mean of the colour channels
+		const T* cell = d + (i * CHANNELS);
+		const float density = ( float( cell[0] ) + float( cell[1] ) + float( cell[2] ) ) / 3.0f;
+
+		u[ i ] = ( u[ i ] + dt * u0[ i ] ) + density * gu;
+		v[ i ] = ( v[ i ] + dt * v0[ i ] ) + density * gv;
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > static void ScalarT( float* u, float* v, const float* u0, const float* v0, const T* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			for( uint i = (y * stride) + x_begin, end = (y * stride) + x_end; i < end; ++i )
+			{
+				ApplyCell( u, v, u0, v0, d, dt, gu, gv, i );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	void Scalar( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		ScalarT( u, v, u0, v0, d, dt, gu, gv, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+#if defined(SIMD_X86)
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 LoadCellSSE2( const float* src )
+	{
+		return _mm_loadu_ps( src );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 LoadCellSSE2( const Half::Float16* src )
+	{
+		//SSE2 has no conversion from half, F16C arrives with AVX2
+		float values[ CHANNELS ];
+		for( uint ch = 0; ch < CHANNELS; ++ch )
+		{
+			values[ch] = float( src[ch] );
+		}
+
+		return _mm_loadu_ps( values );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 LoadCellSSE2( const Half::BFloat16* src )
+	{
+		//bfloat16 is the top half of a float
+		return _mm_castsi128_ps( _mm_unpacklo_epi16( _mm_setzero_si128(), _mm_loadl_epi64( (const __m128i*)src ) ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 ForceLaneSSE2( const float* u, const float* u0, uint i, __m128 dt, __m128 force )
+	{
+		return _mm_add_ps( _mm_add_ps( _mm_loadu_ps( u + i ), _mm_mul_ps( dt, _mm_loadu_ps( u0 + i ) ) ), force );
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_SSE2 static void SSE2T( float* u, float* v, const float* u0, const float* v0, const T* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const __m128 vdt	= _mm_set1_ps( dt );
+		const __m128 vgu	= _mm_set1_ps( gu );
+		const __m128 vgv	= _mm_set1_ps( gv );
+		const __m128 three	= _mm_set1_ps( 3.0f );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			uint i = (y * stride) + x_begin;
+			const uint end = (y * stride) + x_end;
+
+			for( ; i + 4 <= end; i += 4 )
+			{
+				//One RGBX cell per vector, transposed so each vector holds one channel of four cells
+				__m128 r = LoadCellSSE2( d + (i + 0) * CHANNELS );
+				__m128 g = LoadCellSSE2( d + (i + 1) * CHANNELS );
+				__m128 b = LoadCellSSE2( d + (i + 2) * CHANNELS );
+				__m128 a = LoadCellSSE2( d + (i + 3) * CHANNELS );
+				_MM_TRANSPOSE4_PS( r, g, b, a );
+
+				const __m128 density = _mm_div_ps( _mm_add_ps( _mm_add_ps( r, g ), b ), three );
+
+				_mm_storeu_ps( u + i, ForceLaneSSE2( u, u0, i, vdt, _mm_mul_ps( density, vgu ) ) );
+				_mm_storeu_ps( v + i, ForceLaneSSE2( v, v0, i, vdt, _mm_mul_ps( density, vgv ) ) );
+			}
+
+			for( ; i < end; ++i )
+			{
+				ApplyCell( u, v, u0, v0, d, dt, gu, gv, i );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 void SSE2( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		SSE2T( u, v, u0, v0, d, dt, gu, gv, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 LoadCellPairAVX2( const float* src )
+	{
+		return _mm256_loadu_ps( src );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 LoadCellPairAVX2( const Half::Float16* src )
+	{
+		return _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)src ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 LoadCellPairAVX2( const Half::BFloat16* src )
+	{
+		return _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)src ) ), 16 ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 ForceLaneAVX2( const float* u, const float* u0, uint i, __m256 dt, __m256 force )
+	{
+		return _mm256_add_ps( _mm256_add_ps( _mm256_loadu_ps( u + i ), _mm256_mul_ps( dt, _mm256_loadu_ps( u0 + i ) ) ), force );
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_AVX2 static void AVX2T( float* u, float* v, const float* u0, const float* v0, const T* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		const __m256 vdt	= _mm256_set1_ps( dt );
+		const __m256 vgu	= _mm256_set1_ps( gu );
+		const __m256 vgv	= _mm256_set1_ps( gv );
+		const __m256 three	= _mm256_set1_ps( 3.0f );
+
+		for( uint y = y_begin; y < y_end; ++y )
+		{
+			uint i = (y * stride) + x_begin;
+			const uint end = (y * stride) + x_end;
+
+			for( ; i + 8 <= end; i += 8 )
+			{
+				const __m256 c01 = LoadCellPairAVX2( d + (i + 0) * CHANNELS );
+				const __m256 c23 = LoadCellPairAVX2( d + (i + 2) * CHANNELS );
+				const __m256 c45 = LoadCellPairAVX2( d + (i + 4) * CHANNELS );
+				const __m256 c67 = LoadCellPairAVX2( d + (i + 6) * CHANNELS );
+
+				//Pair the cells up across the lanes, cells n and n+4 share a vector, then
+				//transpose within the lanes as SSE2 does
+				const __m256 c04 = _mm256_permute2f128_ps( c01, c45, 0x20 );
+				const __m256 c15 = _mm256_permute2f128_ps( c01, c45, 0x31 );
+				const __m256 c26 = _mm256_permute2f128_ps( c23, c67, 0x20 );
+				const __m256 c37 = _mm256_permute2f128_ps( c23, c67, 0x31 );
+
+				const __m256 rg01 = _mm256_unpacklo_ps( c04, c15 );
+				const __m256 rg23 = _mm256_unpacklo_ps( c26, c37 );
+				const __m256 ba01 = _mm256_unpackhi_ps( c04, c15 );
+				const __m256 ba23 = _mm256_unpackhi_ps( c26, c37 );
+
+				const __m256 r = _mm256_shuffle_ps( rg01, rg23, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+				const __m256 g = _mm256_shuffle_ps( rg01, rg23, _MM_SHUFFLE( 3, 2, 3, 2 ) );
+				const __m256 b = _mm256_shuffle_ps( ba01, ba23, _MM_SHUFFLE( 1, 0, 1, 0 ) );
+
+				const __m256 density = _mm256_div_ps( _mm256_add_ps( _mm256_add_ps( r, g ), b ), three );
+
+				_mm256_storeu_ps( u + i, ForceLaneAVX2( u, u0, i, vdt, _mm256_mul_ps( density, vgu ) ) );
+				_mm256_storeu_ps( v + i, ForceLaneAVX2( v, v0, i, vdt, _mm256_mul_ps( density, vgv ) ) );
+			}
+
+			for( ; i < end; ++i )
+			{
+				ApplyCell( u, v, u0, v0, d, dt, gu, gv, i );
+			}
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 void AVX2( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		AVX2T( u, v, u0, v0, d, dt, gu, gv, stride, x_begin, x_end, y_begin, y_end );
+	}
+#else
+	//------------------------------------------------------------------------------
+	void SSE2( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		Scalar( u, v, u0, v0, d, dt, gu, gv, stride, x_begin, x_end, y_begin, y_end );
+	}
+
+	//------------------------------------------------------------------------------
+	void AVX2( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end )
+	{
+		Scalar( u, v, u0, v0, d, dt, gu, gv, stride, x_begin, x_end, y_begin, y_end );
+	}
+#endif
+
+	//------------------------------------------------------------------------------
+	Kernel Get( Simd::Level level )
+	{
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return AVX2;
+		case Simd::LEVEL_SSE2:		return SSE2;
+		case Simd::LEVEL_SCALAR:	return Scalar;
+		}
+
+		return Scalar;
+	}
+
+	//------------------------------------------------------------------------------
+	Float16Kernel GetFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return AVX2T<Half::Float16>;
+		case Simd::LEVEL_SSE2:		return SSE2T<Half::Float16>;
+		case Simd::LEVEL_SCALAR:	return ScalarT<Half::Float16>;
+		}
+#endif
+
+		return ScalarT<Half::Float16>;
+	}
+
+	//------------------------------------------------------------------------------
+	BFloat16Kernel GetBFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return AVX2T<Half::BFloat16>;
+		case Simd::LEVEL_SSE2:		return SSE2T<Half::BFloat16>;
+		case Simd::LEVEL_SCALAR:	return ScalarT<Half::BFloat16>;
+		}
+#endif
+
+		return ScalarT<Half::BFloat16>;
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef FORCEKERNELS_H
+#define FORCEKERNELS_H
+
+
+#include "Half.h"
+#include "Simd.h"
+#include "types.h"
+
+
+//Kernels for the per cell forces at the start of FluidSim::VelocityStep. Each
+//cell in columns [x_begin, x_end) of rows [y_begin, y_end) gets its velocity
+//sources added and is then pushed by gravity in proportion to its density, in
+//one pass over the five grids rather than one per force. d is the interleaved
+//(RGBX) density grid in its storage precision. Rows start stride cells apart.
+//All kernels produce bit-identical results.
+namespace ForceKernels
+{
+	typedef void (*Kernel)( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+	typedef void (*Float16Kernel)( float* u, float* v, const float* u0, const float* v0, const Half::Float16* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+	typedef void (*BFloat16Kernel)( float* u, float* v, const float* u0, const float* v0, const Half::BFloat16* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//Reference implementation
+	void Scalar( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//4 cells per iteration, transposing the densities to sum the channels
+	void SSE2( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	//8 cells per iteration
+	void AVX2( float* u, float* v, const float* u0, const float* v0, const float* d, float dt, float gu, float gv, uint stride, uint x_begin, uint x_end, uint y_begin, uint y_end );
+
+	Kernel Get( Simd::Level level );
+
+	//The same kernels reading 16 bit densities
+	Float16Kernel GetFloat16( Simd::Level level );
+	BFloat16Kernel GetBFloat16( Simd::Level level );
+}
+
+
+#endif //FORCEKERNELS_H
@@ -0,0 +1,163 @@
+#include "GridArena.h"
+#include <cassert>
+
+#if defined(__linux__)
+	#include <sys/mman.h>
+#endif
+
+//------------------------------------------------------------------------------
+const static size_t CACHE_LINE_SIZE		= 64;
+const static size_t CACHE_SET_PERIOD	= 4096;					//Addresses this far apart share a set in a typical L1
+const static size_t PAGE_SIZE			= 4096;
+const static size_t HUGE_PAGE_SIZE		= 2 * 1024 * 1024;
+
+//------------------------------------------------------------------------------
+static size_t RoundUp( size_t value, size_t alignment )
+{
+	return ((value + alignment-1) / alignment) * alignment;
+}
+
+//------------------------------------------------------------------------------
+GridArena::GridArena()
+	:	mTotalSize( 0 )
+	,	mBlock( NULL )
+	,	mBlockSize( 0 )
+	,	mBase( NULL )
+	,	mHugePages( false )
+	,	mShared( false )
+{
+}
+
+//------------------------------------------------------------------------------
+GridArena::~GridArena()
+{
+	if( mShared )
+	{
+#if defined(__linux__) && defined(MADV_REMOVE)
+		//The block outlives the arena, but the next one placed there should start from fresh zeroed pages
+		madvise( mBlock, mBlockSize, MADV_REMOVE );
+#endif
+		mBlock = NULL;
+	}
+
+	delete [] mBlock;	mBlock = NULL;
+	mBase = NULL;
+}
+
+//------------------------------------------------------------------------------
+uint GridArena::Add( const char* name, size_t bytes )
+{
+	assert( mBlock == NULL );
+
+	//Grid n starts n lines past a set period boundary
+	const uint index = (uint)mGrids.size();
+	const size_t stagger = (index * CACHE_LINE_SIZE) % CACHE_SET_PERIOD;
+
+	Grid grid;
+	grid.mName		= name;
+	grid.mOffset	= RoundUp( mTotalSize, CACHE_SET_PERIOD ) + stagger;
+	grid.mSize		= bytes;
+	mGrids.push_back( grid );
+
+	mTotalSize = grid.mOffset + bytes;
+
+	return index;
+}
+
+//------------------------------------------------------------------------------
+void GridArena::Allocate( bool huge_pages, void* block, size_t block_size )
+{
+	assert( mBlock == NULL );
+
+	const size_t alignment = huge_pages ? HUGE_PAGE_SIZE : PAGE_SIZE;
+
+	mHugePages = false;
+	mShared = block != NULL;
+
+	if( mShared )
+	{
+		assert( block_size >= GetBlockSize( huge_pages ) );
+
+		mBlock = (char*)block;
+		mBlockSize = block_size;
+	}
+	else
+	{
+		//Left uninitialised, large blocks come straight from the OS and aren't backed until they're written
+		mBlockSize = GetBlockSize( huge_pages );
+		mBlock = new char[ mBlockSize ];
+	}
+
+	mBase = mBlock + (alignment - ((size_t)mBlock % alignment)) % alignment;
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if( huge_pages )
+	{
+		mHugePages = madvise( mBase, RoundUp( mTotalSize, alignment ), MADV_HUGEPAGE ) == 0;
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+size_t GridArena::GetBlockSize( bool huge_pages ) const
+{
+	//Room to align the start as well
+	const size_t alignment = huge_pages ? HUGE_PAGE_SIZE : PAGE_SIZE;
+	return RoundUp( mTotalSize, alignment ) + alignment;
+}
+
+//------------------------------------------------------------------------------
+void* GridArena::Get( uint grid ) const
+{
+	assert( mBase != NULL && grid < mGrids.size() );
+
+	return mBase + mGrids[ grid ].mOffset;
+}
+
+//------------------------------------------------------------------------------
+uint GridArena::GetNumGrids() const
+{
+	return (uint)mGrids.size();
+}
+
+//------------------------------------------------------------------------------
+const char* GridArena::GetName( uint grid ) const
+{
+	return mGrids[ grid ].mName;
+}
+
+//------------------------------------------------------------------------------
+size_t GridArena::GetOffset( uint grid ) const
+{
+	return mGrids[ grid ].mOffset;
+}
+
+//------------------------------------------------------------------------------
+size_t GridArena::GetSize( uint grid ) const
+{
+	return mGrids[ grid ].mSize;
+}
+
+//------------------------------------------------------------------------------
+size_t GridArena::GetTotalSize() const
+{
+	return mTotalSize;
+}
+
+//------------------------------------------------------------------------------
+const void* GridArena::GetBase() const
+{
+	return mBase;
+}
+
+//------------------------------------------------------------------------------
+bool GridArena::HasHugePages() const
+{
+	return mHugePages;
+}
+
+//------------------------------------------------------------------------------
+bool GridArena::IsShared() const
+{
+	return mShared;
+}
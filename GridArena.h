@@ -0,0 +1,65 @@
+#ifndef GRIDARENA_H
+#define GRIDARENA_H
+
+
+#include <cstddef>
+#include <vector>
+#include "types.h"
+
+
+//One block of memory that all of a simulation's grids are carved from. Grids
+//are added up front and Allocate then reserves the whole block at once. Every
+//grid starts on a cache line, and each one is staggered by a further line so
+//the same cell in different grids doesn't land in the same cache set.
+//Allocate doesn't touch the memory, so on NUMA systems the thread that first
+//writes a page decides which node it's placed on.
+class GridArena
+{
+public:
+	GridArena();
+	~GridArena();
+
+	//Adds a grid of bytes and returns its index, only valid before Allocate
+	uint Add( const char* name, size_t bytes );
+
+	//With huge_pages the block is aligned to a huge page and, where the OS
+	//supports it, marked for transparent huge pages. Given a block, such as a
+	//ProcessGroup's shared memory, the arena is placed in that instead. It has
+	//to be at least GetBlockSize bytes, and its pages are handed back to the OS
+	//when the arena is destroyed.
+	void Allocate( bool huge_pages, void* block = NULL, size_t block_size = 0 );
+
+	//The bytes Allocate needs for the grids added so far
+	size_t GetBlockSize( bool huge_pages ) const;
+
+	void* Get( uint grid ) const;
+
+	//Layout, for benchmarks and debugging
+	uint GetNumGrids() const;
+	const char* GetName( uint grid ) const;
+	size_t GetOffset( uint grid ) const;		//From GetBase()
+	size_t GetSize( uint grid ) const;
+	size_t GetTotalSize() const;
+	const void* GetBase() const;
+	bool HasHugePages() const;					//Whether the OS accepted the request
+	bool IsShared() const;						//Whether it was placed in a block it was given
+
+private:
+	struct Grid
+	{
+		const char*	mName;
+		size_t		mOffset;
+		size_t		mSize;
+	};
+
+	std::vector<Grid>	mGrids;
+	size_t				mTotalSize;
+	char*				mBlock;
+	size_t				mBlockSize;
+	char*				mBase;
+	bool				mHugePages;
+	bool				mShared;
+};
+
+
+#endif //GRIDARENA_H
@@ -0,0 +1,229 @@
+#ifndef GRIDLAYOUT_H
+#define GRIDLAYOUT_H
+
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include "types.h"
+
+
+//Pass as both sizes to FluidSimT to choose the grid size at runtime
+const static uint DYNAMIC_SIZE = 0;
+
+//Grid dimensions for FluidSimT, compile time constants unless both are DYNAMIC_SIZE
+template< uint W, uint H >
+class FluidGridSize
+{
+public:
+	FluidGridSize( uint size_x, uint size_y )
+	{
+		assert( size_x == W && size_y == H );
+	}
+
+	uint SizeX() const { return W; }
+	uint SizeY() const { return H; }
+};
+
+template<>
+class FluidGridSize< DYNAMIC_SIZE, DYNAMIC_SIZE >
+{
+public:
+	FluidGridSize( uint size_x, uint size_y )
+		:	mSizeX( size_x )
+		,	mSizeY( size_y )
+	{
+	}
+
+	uint SizeX() const { return mSizeX; }
+	uint SizeY() const { return mSizeY; }
+
+private:
+	uint mSizeX;
+	uint mSizeY;
+};
+
+
+//Layouts decide where FluidSimT stores cell (x, y) of each grid. Index maps a
+//cell to its place in memory and NumCells is how many cells a grid takes,
+//padding included. ForEachInterior calls func( x, y, index ) once for every
+//cell off the boundary, in an order that walks memory forwards. Kernels whose
+//cells don't read each other's results use it, Gauss-Seidel keeps to rows so
+//that every layout gives the same results.
+
+//Visits the interior a tile_size square at a time, the tiles in row order
+template< typename Layout, typename Func >
+inline void ForEachInteriorTile( const Layout& layout, uint tile_size, Func func )
+{
+	const uint size_x = layout.SizeX();
+	const uint size_y = layout.SizeY();
+
+	for( uint ty = 0; ty < size_y; ty += tile_size )
+	{
+		const uint y_begin	= std::max( ty, 1u );
+		const uint y_end	= std::min( ty + tile_size, size_y-1 );
+
+		for( uint tx = 0; tx < size_x; tx += tile_size )
+		{
+			const uint x_begin	= std::max( tx, 1u );
+			const uint x_end	= std::min( tx + tile_size, size_x-1 );
+
+			for( uint y = y_begin; y < y_end; ++y )
+			{
+				for( uint x = x_begin; x < x_end; ++x )
+				{
+					func( x, y, layout.Index( x, y ) );
+				}
+			}
+		}
+	}
+}
+
+//Rows one after another, as FluidSim stores its grids
+template< uint W, uint H >
+class RowMajorLayout : public FluidGridSize< W, H >
+{
+public:
+	RowMajorLayout( uint size_x, uint size_y )
+		:	FluidGridSize< W, H >( size_x, size_y )
+	{
+	}
+
+	uint Index( uint x, uint y ) const
+	{
+		return (y * this->SizeX()) + x;
+	}
+
+	uint NumCells() const
+	{
+		return this->SizeX() * this->SizeY();
+	}
+
+	template< typename Func > void ForEachInterior( Func func ) const
+	{
+		for( uint y = 1; y < (this->SizeY()-1); ++y )
+		{
+			for( uint x = 1; x < (this->SizeX()-1); ++x )
+			{
+				func( x, y, Index( x, y ) );
+			}
+		}
+	}
+};
+
+//8x8 bricks of 64 consecutive cells, stored in row order. A cell's vertical
+//neighbours are 8 cells away rather than a row, so a stencil or a short
+//gather stays within one or two bricks. Sizes are padded up to whole bricks.
+template< uint W, uint H >
+class TiledLayout : public FluidGridSize< W, H >
+{
+public:
+	const static uint TILE_SHIFT	= 3;
+	const static uint TILE_SIZE		= 1 << TILE_SHIFT;
+	const static uint TILE_MASK		= TILE_SIZE-1;
+
+	TiledLayout( uint size_x, uint size_y )
+		:	FluidGridSize< W, H >( size_x, size_y )
+	{
+	}
+
+	uint TilesX() const { return (this->SizeX() + TILE_MASK) >> TILE_SHIFT; }
+	uint TilesY() const { return (this->SizeY() + TILE_MASK) >> TILE_SHIFT; }
+
+	uint Index( uint x, uint y ) const
+	{
+		const uint tile = ((y >> TILE_SHIFT) * TilesX()) + (x >> TILE_SHIFT);
+
+		return (tile << (2*TILE_SHIFT)) + ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
+	}
+
+	uint NumCells() const
+	{
+		return (TilesX() * TilesY()) << (2*TILE_SHIFT);
+	}
+
+	template< typename Func > void ForEachInterior( Func func ) const
+	{
+		ForEachInteriorTile( *this, TILE_SIZE, func );
+	}
+};
+
+//Z-order, the bits of x and y interleaved so every aligned power of two square
+//is contiguous, at every scale. When one side needs more bits than the other
+//its extra bits go above the interleaved ones. Each side is padded up to a
+//power of two, and Index looks the two halves up in tables.
+template< uint W, uint H >
+class MortonLayout : public FluidGridSize< W, H >
+{
+public:
+	MortonLayout( uint size_x, uint size_y )
+		:	FluidGridSize< W, H >( size_x, size_y )
+		,	mColumns( size_x )
+		,	mRows( size_y )
+	{
+		const uint bits_x = CeilLog2( size_x );
+		const uint bits_y = CeilLog2( size_y );
+		const uint shared = std::min( bits_x, bits_y );
+
+		for( uint x = 0; x < size_x; ++x )
+		{
+			mColumns[x] = Spread( x, shared, 0 );
+		}
+
+		for( uint y = 0; y < size_y; ++y )
+		{
+			mRows[y] = Spread( y, shared, 1 );
+		}
+
+		mNumCells = 1u << (bits_x + bits_y);
+	}
+
+	uint Index( uint x, uint y ) const
+	{
+		assert( x < this->SizeX() && y < this->SizeY() );
+
+		return mColumns[x] | mRows[y];
+	}
+
+	uint NumCells() const
+	{
+		return mNumCells;
+	}
+
+	template< typename Func > void ForEachInterior( Func func ) const
+	{
+		//Any aligned 8x8 square is one run of 64 cells
+		ForEachInteriorTile( *this, 8, func );
+	}
+
+private:
+	static uint CeilLog2( uint n )
+	{
+		uint bits = 0;
+		while( (1u << bits) < n )
+		{
+			++bits;
+		}
+
+		return bits;
+	}
+
+	//The low shared bits of value go to every other bit starting at offset, the rest above them
+	static uint Spread( uint value, uint shared, uint offset )
+	{
+		uint result = 0;
+		for( uint bit = 0; bit < shared; ++bit )
+		{
+			result |= ((value >> bit) & 1) << ((2*bit) + offset);
+		}
+
+		return result | ((value >> shared) << (2*shared));
+	}
+
+	std::vector<uint>	mColumns;
+	std::vector<uint>	mRows;
+	uint				mNumCells;
+};
+
+
+#endif //GRIDLAYOUT_H
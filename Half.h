@@ -0,0 +1,118 @@
+#ifndef HALF_H
+#define HALF_H
+
+
+#include <cstring>
+#include "types.h"
+
+
+//16 bit float storage formats. Values are widened to float for arithmetic and
+//rounded to nearest even when stored back.
+namespace Half
+{
+	enum Format
+	{
+		FORMAT_FLOAT16,		//IEEE 754 binary16, 10 bit mantissa and a range of about 6e-5 to 65504
+		FORMAT_BFLOAT16,	//Top half of a float, 7 bit mantissa and the full float range
+	};
+
+	inline uint FloatBits( float f )
+	{
+		uint bits;
+		memcpy( &bits, &f, sizeof(bits) );
+		return bits;
+	}
+
+	inline float BitsFloat( uint bits )
+	{
+		float f;
+		memcpy( &f, &bits, sizeof(f) );
+		return f;
+	}
+
+	struct Float16
+	{
+		unsigned short mBits;
+
+		Float16() {}
+
+		explicit Float16( float f )
+		{
+			const uint sign = FloatBits( f ) & 0x80000000u;
+			const uint abs = FloatBits( f ) ^ sign;
+			uint bits;
+
+			if( abs >= ((127 + 16) << 23) )
+			{
+				//Too large becomes infinity, NaN stays NaN
+				bits = abs > (255u << 23) ? 0x7e00 : 0x7c00;
+			}
+			else if( abs < (113 << 23) )
+			{
+				//Denormal, adding the magic number lets the float unit do the rounding
+				const float magic = BitsFloat( ((127 - 15) + (23 - 10) + 1) << 23 );
+				bits = FloatBits( BitsFloat( abs ) + magic ) - FloatBits( magic );
+			}
+			else
+			{
+				//Rebias the exponent and round the mantissa to nearest even
+				const uint odd = (abs >> 13) & 1;
+				bits = (abs + ((uint)(15 - 127) << 23) + 0xfff + odd) >> 13;
+			}
+
+			mBits = (unsigned short)(bits | (sign >> 16));
+		}
+
+		operator float() const
+		{
+			const uint exponent_mask = 0x7c00 << 13;
+			uint bits = (mBits & 0x7fff) << 13;
+			const uint exponent = bits & exponent_mask;
+
+			bits += (127 - 15) << 23;
+			if( exponent == exponent_mask )
+			{
+				//Infinity or NaN
+				bits += (128 - 16) << 23;
+			}
+			else if( exponent == 0 )
+			{
+				//Zero or denormal, renormalise through the float unit
+				bits += 1 << 23;
+				bits = FloatBits( BitsFloat( bits ) - BitsFloat( 113 << 23 ) );
+			}
+
+			return BitsFloat( bits | ((mBits & 0x8000) << 16) );
+		}
+	};
+
+	struct BFloat16
+	{
+		unsigned short mBits;
+
+		BFloat16() {}
+
+		explicit BFloat16( float f )
+		{
+			const uint bits = FloatBits( f );
+
+			//Rounding could carry a NaN's mantissa into infinity, so quieten it instead
+			if( (bits & 0x7fffffff) > 0x7f800000 )
+			{
+				mBits = (unsigned short)((bits >> 16) | 0x40);
+			}
+			else
+			{
+				mBits = (unsigned short)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+			}
+		}
+
+		operator float() const
+		{
+			return BitsFloat( (uint)mBits << 16 );
+		}
+	};
+}
+
+
+#endif //HALF_H
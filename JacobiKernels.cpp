@@ -0,0 +1,184 @@
+#include "JacobiKernels.h"
+
+#if defined(SIMD_X86)
+	#include <immintrin.h>
+#endif
+
+namespace JacobiKernels
+{
+	//------------------------------------------------------------------------------
+	template< typename T > static inline void UpdateFloat( float* next, const float* d, const T* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint i )
+	{
+		const float jacobi = (float( d0[i] ) + a*(((d[i-step] + d[i+step]) + d[i-row_stride]) + d[i+row_stride])) * inv_c;
+
+		next[i] = next[i] + omega*(jacobi - next[i]);
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > static void ScalarT( float* next, const float* d, const T* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		for( uint i = begin; i < end; ++i )
+		{
+			UpdateFloat( next, d, d0, a, inv_c, omega, step, row_stride, i );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	void Scalar( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		ScalarT( next, d, d0, a, inv_c, omega, step, row_stride, begin, end );
+	}
+
+#if defined(SIMD_X86)
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 LoadSSE2( const float* src )
+	{
+		return _mm_loadu_ps( src );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 LoadSSE2( const Half::Float16* src )
+	{
+		//SSE2 has no conversion from half, F16C arrives with AVX2
+		return _mm_setr_ps( float( src[0] ), float( src[1] ), float( src[2] ), float( src[3] ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 static inline __m128 LoadSSE2( const Half::BFloat16* src )
+	{
+		//bfloat16 is the top half of a float
+		return _mm_castsi128_ps( _mm_unpacklo_epi16( _mm_setzero_si128(), _mm_loadl_epi64( (const __m128i*)src ) ) );
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_SSE2 static void SSE2T( float* next, const float* d, const T* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		const __m128 va		= _mm_set1_ps( a );
+		const __m128 vinv_c	= _mm_set1_ps( inv_c );
+		const __m128 vomega	= _mm_set1_ps( omega );
+
+		uint i = begin;
+		for( ; i + 4 <= end; i += 4 )
+		{
+			const __m128 sum = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_loadu_ps( d + i - step ), _mm_loadu_ps( d + i + step ) ), _mm_loadu_ps( d + i - row_stride ) ), _mm_loadu_ps( d + i + row_stride ) );
+			const __m128 jacobi = _mm_mul_ps( _mm_add_ps( LoadSSE2( d0 + i ), _mm_mul_ps( va, sum ) ), vinv_c );
+			const __m128 old = _mm_loadu_ps( next + i );
+
+			_mm_storeu_ps( next + i, _mm_add_ps( old, _mm_mul_ps( vomega, _mm_sub_ps( jacobi, old ) ) ) );
+		}
+
+		for( ; i < end; ++i )
+		{
+			UpdateFloat( next, d, d0, a, inv_c, omega, step, row_stride, i );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_SSE2 void SSE2( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		SSE2T( next, d, d0, a, inv_c, omega, step, row_stride, begin, end );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 LoadAVX2( const float* src )
+	{
+		return _mm256_loadu_ps( src );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 LoadAVX2( const Half::Float16* src )
+	{
+		return _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)src ) );
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 static inline __m256 LoadAVX2( const Half::BFloat16* src )
+	{
+		return _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i*)src ) ), 16 ) );
+	}
+
+	//------------------------------------------------------------------------------
+	template< typename T > SIMD_TARGET_AVX2 static void AVX2T( float* next, const float* d, const T* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		const __m256 va		= _mm256_set1_ps( a );
+		const __m256 vinv_c	= _mm256_set1_ps( inv_c );
+		const __m256 vomega	= _mm256_set1_ps( omega );
+
+		uint i = begin;
+		for( ; i + 8 <= end; i += 8 )
+		{
+			const __m256 sum = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps( _mm256_loadu_ps( d + i - step ), _mm256_loadu_ps( d + i + step ) ), _mm256_loadu_ps( d + i - row_stride ) ), _mm256_loadu_ps( d + i + row_stride ) );
+			const __m256 jacobi = _mm256_mul_ps( _mm256_add_ps( LoadAVX2( d0 + i ), _mm256_mul_ps( va, sum ) ), vinv_c );
+			const __m256 old = _mm256_loadu_ps( next + i );
+
+			_mm256_storeu_ps( next + i, _mm256_add_ps( old, _mm256_mul_ps( vomega, _mm256_sub_ps( jacobi, old ) ) ) );
+		}
+
+		for( ; i < end; ++i )
+		{
+			UpdateFloat( next, d, d0, a, inv_c, omega, step, row_stride, i );
+		}
+	}
+
+	//------------------------------------------------------------------------------
+	SIMD_TARGET_AVX2 void AVX2( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		AVX2T( next, d, d0, a, inv_c, omega, step, row_stride, begin, end );
+	}
+#else
+	//------------------------------------------------------------------------------
+	void SSE2( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		Scalar( next, d, d0, a, inv_c, omega, step, row_stride, begin, end );
+	}
+
+	//------------------------------------------------------------------------------
+	void AVX2( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end )
+	{
+		Scalar( next, d, d0, a, inv_c, omega, step, row_stride, begin, end );
+	}
+#endif
+
+	//------------------------------------------------------------------------------
+	Kernel Get( Simd::Level level )
+	{
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return AVX2;
+		case Simd::LEVEL_SSE2:		return SSE2;
+		case Simd::LEVEL_SCALAR:	return Scalar;
+		}
+
+		return Scalar;
+	}
+
+	//------------------------------------------------------------------------------
+	Float16Kernel GetFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return AVX2T<Half::Float16>;
+		case Simd::LEVEL_SSE2:		return SSE2T<Half::Float16>;
+		case Simd::LEVEL_SCALAR:	return ScalarT<Half::Float16>;
+		}
+#endif
+
+		return ScalarT<Half::Float16>;
+	}
+
+	//------------------------------------------------------------------------------
+	BFloat16Kernel GetBFloat16( Simd::Level level )
+	{
+#if defined(SIMD_X86)
+		switch( level )
+		{
+		case Simd::LEVEL_AVX2:		return AVX2T<Half::BFloat16>;
+		case Simd::LEVEL_SSE2:		return SSE2T<Half::BFloat16>;
+		case Simd::LEVEL_SCALAR:	return ScalarT<Half::BFloat16>;
+		}
+#endif
+
+		return ScalarT<Half::BFloat16>;
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef JACOBIKERNELS_H
+#define JACOBIKERNELS_H
+
+
+#include "Half.h"
+#include "Simd.h"
+#include "types.h"
+
+
+//Kernels for one step of FluidSim's Chebyshev accelerated Jacobi solver. For
+//each float i in [begin, end), the Jacobi update of d is taken from
+//	(d0[i] + a*(d[i-step] + d[i+step] + d[i-row_stride] + d[i+row_stride])) * inv_c
+//and next, which holds the iterate before d, moves omega of the way from its
+//value towards it. step is the floats per cell and row_stride the floats per
+//row, so interleaved grids update every channel in one run. next and d are
+//separate grids, so every float is independent of the others. d0 is the right
+//hand side in its storage precision.
+//All kernels produce bit-identical results.
+namespace JacobiKernels
+{
+	typedef void (*Kernel)( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end );
+	typedef void (*Float16Kernel)( float* next, const float* d, const Half::Float16* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end );
+	typedef void (*BFloat16Kernel)( float* next, const float* d, const Half::BFloat16* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end );
+
+	//Reference implementation
+	void Scalar( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end );
+
+	//4 floats per iteration
+	void SSE2( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end );
+
+	//8 floats per iteration
+	void AVX2( float* next, const float* d, const float* d0, float a, float inv_c, float omega, uint step, uint row_stride, uint begin, uint end );
+
+	Kernel Get( Simd::Level level );
+
+	//The same kernels reading a 16 bit right hand side
+	Float16Kernel GetFloat16( Simd::Level level );
+	BFloat16Kernel GetBFloat16( Simd::Level level );
+}
+
+
+#endif //JACOBIKERNELS_H
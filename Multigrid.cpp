@@ -0,0 +1,342 @@
+#include "Multigrid.h"
+#include "Boundary.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+//------------------------------------------------------------------------------
+const static uint  PRE_SMOOTH_SWEEPS		= 2;
+const static uint  POST_SMOOTH_SWEEPS		= 2;
+const static uint  COARSEST_MAX_POINTS		= 64;
+
+//------------------------------------------------------------------------------
+Multigrid::Multigrid( uint size_x, uint size_y, uint stride )
+{
+	assert( size_x > 2 && size_y > 2 );
+
+	uint nx = size_x - 2;
+	uint ny = size_y - 2;
+
+	while( true )
+	{
+		Level level;
+		level.mSizeX	= nx + 2;
+		level.mSizeY	= ny + 2;
+		level.mStride	= mLevels.empty() ? stride : level.mSizeX;
+		level.mX		= NULL;
+		level.mRhs		= NULL;
+		level.mResidual.resize( level.mStride * level.mSizeY, 0.0f );
+		level.mCouplingX.resize( level.mStride * level.mSizeY, 0.0f );
+		level.mCouplingY.resize( level.mStride * level.mSizeY, 0.0f );
+		level.mInvDiagonal.resize( level.mStride * level.mSizeY, 0.0f );
+
+		mLevels.push_back( level );
+
+		if( nx <= 2 || ny <= 2 || nx * ny <= COARSEST_MAX_POINTS )
+		{
+			break;
+		}
+
+		//Each coarse cell covers (up to) 2x2 fine cells
+		nx = (nx + 1) / 2;
+		ny = (ny + 1) / 2;
+	}
+
+	//The finest level is the plain 5 point Laplacian, couplings to ghost cells are left at zero
+	Level& finest = mLevels[ 0 ];
+	for( uint y = 1; y < (finest.mSizeY-1); ++y )
+	{
+		for( uint x = 1; x < (finest.mSizeX-1); ++x )
+		{
+			const uint i = (y * finest.mStride) + x;
+			finest.mCouplingX[i] = ( x < (finest.mSizeX-2) ) ? 1.0f : 0.0f;
+			finest.mCouplingY[i] = ( y < (finest.mSizeY-2) ) ? 1.0f : 0.0f;
+		}
+	}
+	BuildDiagonal( finest );
+
+	//Coarse couplings are half the sum of the fine couplings crossing each aggregate face, which
+	//reduces to the geometric operator on full 2x2 blocks
+	for( uint l = 1; l < mLevels.size(); ++l )
+	{
+		const Level& fine = mLevels[ l-1 ];
+		Level& level = mLevels[ l ];
+
+		for( uint cy = 1; cy < (level.mSizeY-1); ++cy )
+		{
+			for( uint cx = 1; cx < (level.mSizeX-1); ++cx )
+			{
+				float cpx = 0.0f;
+				float cpy = 0.0f;
+
+				for( uint k = 0; k < 2; ++k )
+				{
+					const uint fx = 2*cx - 1 + k;
+					const uint fy = 2*cy - 1 + k;
+
+					if( 2*cx < (fine.mSizeX-1) && fy < (fine.mSizeY-1) )
+					{
+						cpx += fine.mCouplingX[ (fy * fine.mStride) + 2*cx ];
+					}
+
+					if( 2*cy < (fine.mSizeY-1) && fx < (fine.mSizeX-1) )
+					{
+						cpy += fine.mCouplingY[ (2*cy * fine.mStride) + fx ];
+					}
+				}
+
+				const uint i = (cy * level.mStride) + cx;
+				level.mCouplingX[i] = 0.5f * cpx;
+				level.mCouplingY[i] = 0.5f * cpy;
+			}
+		}
+
+		BuildDiagonal( level );
+
+		//The finest level works on the caller's arrays, the rest own their storage
+		level.mXStorage.resize( level.mStride * level.mSizeY, 0.0f );
+		level.mRhsStorage.resize( level.mStride * level.mSizeY, 0.0f );
+		level.mX	= &level.mXStorage[ 0 ];
+		level.mRhs	= &level.mRhsStorage[ 0 ];
+	}
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::Solve( float* p, const float* div, uint cycles, Cycle cycle )
+{
+	mLevels[ 0 ].mX		= p;
+	mLevels[ 0 ].mRhs	= div;
+
+	for( uint c = 0; c < cycles; ++c )
+	{
+		RunCycle( 0, cycle );
+	}
+
+	SetBoundary( 0, p, mLevels[ 0 ].mSizeX, mLevels[ 0 ].mSizeY, mLevels[ 0 ].mStride );
+
+	mLevels[ 0 ].mX		= NULL;
+	mLevels[ 0 ].mRhs	= NULL;
+}
+
+//------------------------------------------------------------------------------
+float Multigrid::Residual( const float* p, const float* div ) const
+{
+	const uint sx = mLevels[ 0 ].mSizeX;
+	const uint sy = mLevels[ 0 ].mSizeY;
+	const uint stride = mLevels[ 0 ].mStride;
+
+	double sum = 0.0;
+
+	for( uint y = 1; y < (sy-1); ++y )
+	{
+		for( uint x = 1; x < (sx-1); ++x )
+		{
+			const uint i = (y * stride) + x;
+			const float r = div[i] - (4.0f*p[i] - p[i-1] - p[i+1] - p[i-stride] - p[i+stride]);
+			sum += r * r;
+		}
+	}
+
+	return (float)std::sqrt( sum / ((sx-2) * (sy-2)) );
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::RunCycle( uint l, Cycle cycle )
+{
+	Level& level = mLevels[ l ];
+
+	if( l == mLevels.size() - 1 )
+	{
+		SolveCoarsest( level );
+		return;
+	}
+
+	Level& coarse = mLevels[ l+1 ];
+
+	Smooth( level, PRE_SMOOTH_SWEEPS );
+	ComputeResidual( level );
+	Restrict( level, coarse );
+
+	std::fill( coarse.mXStorage.begin(), coarse.mXStorage.end(), 0.0f );
+
+	RunCycle( l+1, cycle );
+	if( cycle == CYCLE_F )
+	{
+		//An F-cycle follows each coarse F-cycle with a V-cycle
+		RunCycle( l+1, CYCLE_V );
+	}
+
+	Prolongate( coarse, level );
+	Smooth( level, POST_SMOOTH_SWEEPS );
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::Smooth( Level& level, uint sweeps )
+{
+	const uint sx = level.mSizeX;
+	const uint sy = level.mSizeY;
+	const uint stride = level.mStride;
+	float* p = level.mX;
+	const float* div = level.mRhs;
+	const float* cx = &level.mCouplingX[ 0 ];
+	const float* cy = &level.mCouplingY[ 0 ];
+	const float* inv_diag = &level.mInvDiagonal[ 0 ];
+
+	//Red-black ordering smooths high frequencies better than lexicographic
+	for( uint k = 0; k < sweeps; ++k )
+	{
+		for( uint colour = 0; colour < 2; ++colour )
+		{
+			for( uint y = 1; y < (sy-1); ++y )
+			{
+				for( uint x = 1 + ((y + colour + 1) & 1); x < (sx-1); x += 2 )
+				{
+					const uint i = (y * stride) + x;
+					p[i] = (div[i] + cx[i]*p[i+1] + cx[i-1]*p[i-1] + cy[i]*p[i+stride] + cy[i-stride]*p[i-stride]) * inv_diag[i];
+				}
+			}
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::SolveCoarsest( Level& level )
+{
+	const uint sx = level.mSizeX;
+	const uint sy = level.mSizeY;
+	const uint stride = level.mStride;
+	const float* rhs = level.mRhs;
+
+	//The pure Neumann problem only has a solution for a zero mean right hand side
+	double sum = 0.0;
+	for( uint y = 1; y < (sy-1); ++y )
+	{
+		for( uint x = 1; x < (sx-1); ++x )
+		{
+			sum += rhs[ (y * stride) + x ];
+		}
+	}
+
+	//On a grid too small to coarsen this is the finest level, and its right hand side is the
+	//caller's. So the mean comes off a copy, in the residual grid the coarsest level doesn't use.
+	float* zero_mean = &level.mResidual[ 0 ];
+	const float mean = (float)( sum / ((sx-2) * (sy-2)) );
+	for( uint y = 1; y < (sy-1); ++y )
+	{
+		for( uint x = 1; x < (sx-1); ++x )
+		{
+			zero_mean[ (y * stride) + x ] = rhs[ (y * stride) + x ] - mean;
+		}
+	}
+
+	level.mRhs = zero_mean;
+	Smooth( level, 2 * (sx + sy) );
+	level.mRhs = rhs;
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::ComputeResidual( Level& level )
+{
+	const uint sx = level.mSizeX;
+	const uint sy = level.mSizeY;
+	const uint stride = level.mStride;
+	const float* p = level.mX;
+	const float* div = level.mRhs;
+	const float* cx = &level.mCouplingX[ 0 ];
+	const float* cy = &level.mCouplingY[ 0 ];
+	const float* inv_diag = &level.mInvDiagonal[ 0 ];
+	float* r = &level.mResidual[ 0 ];
+
+	for( uint y = 1; y < (sy-1); ++y )
+	{
+		for( uint x = 1; x < (sx-1); ++x )
+		{
+			const uint i = (y * stride) + x;
+			r[i] = div[i] - (p[i]/inv_diag[i] - cx[i]*p[i+1] - cx[i-1]*p[i-1] - cy[i]*p[i+stride] - cy[i-stride]*p[i-stride]);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::Restrict( const Level& fine, Level& coarse )
+{
+	const uint fsx = fine.mSizeX;
+	const uint fsy = fine.mSizeY;
+	const uint csx = coarse.mSizeX;
+	const uint csy = coarse.mSizeY;
+	const float* r = &fine.mResidual[ 0 ];
+	float* rhs = &coarse.mRhsStorage[ 0 ];
+
+	for( uint cy = 1; cy < (csy-1); ++cy )
+	{
+		for( uint cx = 1; cx < (csx-1); ++cx )
+		{
+			float sum = 0.0f;
+
+			for( uint fy = 2*cy - 1; fy <= 2*cy && fy < (fsy-1); ++fy )
+			{
+				for( uint fx = 2*cx - 1; fx <= 2*cx && fx < (fsx-1); ++fx )
+				{
+					sum += r[ (fy * fine.mStride) + fx ];
+				}
+			}
+
+			rhs[ (cy * coarse.mStride) + cx ] = sum;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::Prolongate( Level& coarse, Level& fine )
+{
+	const uint fsx = fine.mSizeX;
+	const uint fsy = fine.mSizeY;
+	const uint csx = coarse.mSizeX;
+	const float* e = coarse.mX;
+	float* p = fine.mX;
+
+	SetBoundary( 0, coarse.mX, csx, coarse.mSizeY, coarse.mStride );
+
+	//Bilinear interpolation between cell centres
+	for( uint fy = 1; fy < (fsy-1); ++fy )
+	{
+		const uint cy	= (fy + 1) / 2;
+		const uint cy1	= (fy & 1) ? cy - 1 : cy + 1;
+
+		for( uint fx = 1; fx < (fsx-1); ++fx )
+		{
+			const uint cx	= (fx + 1) / 2;
+			const uint cx1	= (fx & 1) ? cx - 1 : cx + 1;
+
+			const float correction =
+				0.5625f * e[ (cy  * csx) + cx  ] +
+				0.1875f * e[ (cy  * csx) + cx1 ] +
+				0.1875f * e[ (cy1 * csx) + cx  ] +
+				0.0625f * e[ (cy1 * csx) + cx1 ];
+
+			p[ (fy * fine.mStride) + fx ] += correction;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void Multigrid::BuildDiagonal( Level& level )
+{
+	const uint sx = level.mSizeX;
+	const uint sy = level.mSizeY;
+	const uint stride = level.mStride;
+	const float* cx = &level.mCouplingX[ 0 ];
+	const float* cy = &level.mCouplingY[ 0 ];
+
+	for( uint y = 1; y < (sy-1); ++y )
+	{
+		for( uint x = 1; x < (sx-1); ++x )
+		{
+			const uint i = (y * stride) + x;
+			const float diagonal = cx[i] + cx[i-1] + cy[i] + cy[i-stride];
+
+			//A single cell interior isn't coupled to anything, its zero mean solution is 0
+			level.mInvDiagonal[i] = diagonal > 0.0f ? 1.0f / diagonal : 0.0f;
+		}
+	}
+}
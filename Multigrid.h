@@ -0,0 +1,62 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+
+#include <vector>
+#include "types.h"
+
+
+//Geometric multigrid solver for the pressure Poisson equation used by
+//FluidSim::Project. Grids use the same layout as FluidSim (one ghost cell on
+//each edge, Neumann boundaries, rows stride cells apart), and each coarse
+//level halves the interior.
+//Coarse operators are built by aggregating 2x2 blocks of fine cells so odd
+//sized levels stay consistent with the level above them.
+class Multigrid
+{
+public:
+	enum Cycle
+	{
+		CYCLE_V,
+		CYCLE_F,
+	};
+
+	Multigrid( uint size_x, uint size_y, uint stride );
+
+	//Solves 4p - (sum of neighbours) = div, using p as the initial guess
+	void Solve( float* p, const float* div, uint cycles, Cycle cycle );
+
+	//Root mean square residual of p on the finest level
+	float Residual( const float* p, const float* div ) const;
+
+private:
+	struct Level
+	{
+		uint				mSizeX;
+		uint				mSizeY;
+		uint				mStride;
+		float*				mX;
+		const float*		mRhs;
+		std::vector<float>	mXStorage;
+		std::vector<float>	mRhsStorage;
+		std::vector<float>	mResidual;
+		std::vector<float>	mCouplingX;		//Between a cell and its +x neighbour
+		std::vector<float>	mCouplingY;		//Between a cell and its +y neighbour
+		std::vector<float>	mInvDiagonal;
+	};
+
+	void RunCycle( uint level, Cycle cycle );
+	void Smooth( Level& level, uint sweeps );
+	void SolveCoarsest( Level& level );
+	void ComputeResidual( Level& level );
+	void Restrict( const Level& fine, Level& coarse );
+	void Prolongate( Level& coarse, Level& fine );
+
+	static void BuildDiagonal( Level& level );
+
+private:
+	std::vector<Level>	mLevels;
+};
+
+
+#endif //MULTIGRID_H
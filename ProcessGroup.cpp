@@ -0,0 +1,330 @@
+#include "ProcessGroup.h"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if defined(__linux__)
+	#include <linux/futex.h>
+	#include <signal.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <time.h>
+	#include <sys/wait.h>
+	#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+const static uint SPIN_COUNT		= 4000;		//Polls before sleeping, a half sweep is often shorter than a context switch
+const static long CHECK_NS			= 100000000;	//How often a sleeping process checks the others are still there
+
+//------------------------------------------------------------------------------
+//Lives in memory shared by every process in the group. The counters are waited
+//on with futexes, so they must be lock free and 32 bit.
+struct ProcessGroup::Control
+{
+	std::atomic<unsigned int>	mGeneration;			//Bumped for each job
+	std::atomic<unsigned int>	mPending;				//Workers still running the job
+	std::atomic<unsigned int>	mBarrierCount;
+	std::atomic<unsigned int>	mBarrierGeneration;
+	bool						mShutdown;
+	Job							mJob;
+	char						mArgs[ MAX_ARGS_SIZE ];
+};
+
+#if defined(__linux__)
+//------------------------------------------------------------------------------
+//Not FUTEX_PRIVATE_FLAG, the waiters are in other processes
+static void FutexWait( std::atomic<unsigned int>* address, unsigned int expected, const timespec* timeout )
+{
+	syscall( SYS_futex, (unsigned int*)address, FUTEX_WAIT, expected, timeout, NULL, 0 );
+}
+
+//------------------------------------------------------------------------------
+static void FutexWakeAll( std::atomic<unsigned int>* address )
+{
+	syscall( SYS_futex, (unsigned int*)address, FUTEX_WAKE, 0x7fffffff, NULL, NULL, 0 );
+}
+
+//------------------------------------------------------------------------------
+//A job or barrier can't finish without every worker, so once one has died the
+//parent would wait forever. Nothing can be recovered from a job that's half
+//run, so the rest are killed and the parent aborts.
+static void CheckWorkers( const int* workers, uint num_workers )
+{
+	for( uint i = 0; i < num_workers; ++i )
+	{
+		int status = 0;
+		if( waitpid( workers[ i ], &status, WNOHANG ) != workers[ i ] )
+		{
+			continue;
+		}
+
+		if( WIFSIGNALED( status ) )
+		{
+			fprintf( stderr, "ProcessGroup: worker %d was killed by signal %d\n", workers[ i ], WTERMSIG( status ) );
+		}
+		else
+		{
+			fprintf( stderr, "ProcessGroup: worker %d exited with status %d\n", workers[ i ], WEXITSTATUS( status ) );
+		}
+
+		for( uint j = 0; j < num_workers; ++j )
+		{
+			if( j != i )
+			{
+				kill( workers[ j ], SIGKILL );
+			}
+		}
+
+		abort();
+	}
+}
+
+//------------------------------------------------------------------------------
+//Returns once address no longer holds value. A worker passes its parent and
+//exits if it goes away, an orphan is handed to another process. The parent
+//passes 0 and its workers, and aborts if one of them goes away.
+static void WaitWhileEqual( std::atomic<unsigned int>* address, unsigned int value, pid_t parent, const int* workers, uint num_workers )
+{
+	for( uint spin = 0; spin < SPIN_COUNT; ++spin )
+	{
+		if( address->load( std::memory_order_acquire ) != value )
+		{
+			return;
+		}
+	}
+
+	const timespec timeout = { 0, CHECK_NS };
+
+	while( address->load( std::memory_order_acquire ) == value )
+	{
+		FutexWait( address, value, &timeout );
+
+		if( parent != 0 )
+		{
+			if( getppid() != parent )
+			{
+				_exit( 0 );
+			}
+		}
+		else
+		{
+			CheckWorkers( workers, num_workers );
+		}
+	}
+}
+#endif
+
+//------------------------------------------------------------------------------
+ProcessGroup::ProcessGroup( uint num_processes, size_t shared_size )
+	:	mNumProcesses( 1 )
+	,	mControl( NULL )
+	,	mWorkers( NULL )
+	,	mParent( 0 )
+	,	mShared( NULL )
+	,	mSharedSize( shared_size )
+{
+	assert( num_processes > 0 );
+
+#if defined(__linux__)
+	void* memory = mmap( NULL, sizeof(Control), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	void* shared = mmap( NULL, mSharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+	if( memory == MAP_FAILED || shared == MAP_FAILED )
+	{
+		if( memory != MAP_FAILED )
+		{
+			munmap( memory, sizeof(Control) );
+		}
+
+		if( shared != MAP_FAILED )
+		{
+			munmap( shared, mSharedSize );
+		}
+
+		return;
+	}
+
+	mShared = shared;
+
+	mControl = new( memory ) Control;
+	mControl->mGeneration			= 0;
+	mControl->mPending				= 0;
+	mControl->mBarrierCount			= 0;
+	mControl->mBarrierGeneration	= 0;
+	mControl->mShutdown				= false;
+	mControl->mJob					= NULL;
+
+	mWorkers = new int[ num_processes ];
+
+	const pid_t parent = getpid();
+
+	for( uint rank = 1; rank < num_processes; ++rank )
+	{
+		const pid_t pid = fork();
+		if( pid == 0 )
+		{
+			//The parent may have gone before this process got going
+			if( getppid() != parent )
+			{
+				_exit( 0 );
+			}
+
+			//Everything the workers forked so far see is a copy, this one only knows its own rank
+			mNumProcesses = num_processes;
+			mParent = parent;
+			WorkerLoop( rank );
+			_exit( 0 );
+		}
+
+		if( pid < 0 )
+		{
+			//The workers so far expect num_processes at every barrier, so send them all away
+			Shutdown();
+			mNumProcesses = 1;
+			return;
+		}
+
+		mWorkers[ mNumProcesses-1 ] = pid;
+		++mNumProcesses;
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+ProcessGroup::~ProcessGroup()
+{
+	Shutdown();
+
+#if defined(__linux__)
+	if( mShared != NULL )
+	{
+		munmap( mShared, mSharedSize );
+		mShared = NULL;
+	}
+#endif
+
+	delete [] mWorkers;		mWorkers = NULL;
+}
+
+//------------------------------------------------------------------------------
+bool ProcessGroup::IsSupported()
+{
+#if defined(__linux__)
+	return true;
+#else
+	return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+void ProcessGroup::Run( Job job, const void* args, size_t args_size )
+{
+	assert( args_size <= MAX_ARGS_SIZE );
+
+	if( mNumProcesses == 1 )
+	{
+		job( *this, args, 0 );
+		return;
+	}
+
+#if defined(__linux__)
+	mControl->mJob = job;
+	memcpy( mControl->mArgs, args, args_size );
+
+	mControl->mPending.store( mNumProcesses-1, std::memory_order_relaxed );
+	mControl->mGeneration.fetch_add( 1, std::memory_order_release );
+	FutexWakeAll( &mControl->mGeneration );
+
+	job( *this, mControl->mArgs, 0 );
+
+	for( unsigned int pending = mControl->mPending.load( std::memory_order_acquire ); pending > 0; pending = mControl->mPending.load( std::memory_order_acquire ) )
+	{
+		WaitWhileEqual( &mControl->mPending, pending, 0, mWorkers, mNumProcesses-1 );
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+void ProcessGroup::Barrier()
+{
+	if( mNumProcesses == 1 )
+	{
+		return;
+	}
+
+#if defined(__linux__)
+	const unsigned int generation = mControl->mBarrierGeneration.load( std::memory_order_acquire );
+
+	if( mControl->mBarrierCount.fetch_add( 1, std::memory_order_acq_rel ) + 1 == mNumProcesses )
+	{
+		//Last one in resets the count before letting the others go, so it's ready for the next barrier
+		mControl->mBarrierCount.store( 0, std::memory_order_relaxed );
+		mControl->mBarrierGeneration.fetch_add( 1, std::memory_order_release );
+		FutexWakeAll( &mControl->mBarrierGeneration );
+	}
+	else
+	{
+		WaitWhileEqual( &mControl->mBarrierGeneration, generation, mParent, mWorkers, mNumProcesses-1 );
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+void ProcessGroup::GetRange( uint begin, uint end, uint rank, uint& out_begin, uint& out_end ) const
+{
+	const uint count = end - begin;
+
+	out_begin	= begin + (uint)( ((unsigned long long)count * rank) / mNumProcesses );
+	out_end		= begin + (uint)( ((unsigned long long)count * (rank+1)) / mNumProcesses );
+}
+
+//------------------------------------------------------------------------------
+void ProcessGroup::Shutdown()
+{
+#if defined(__linux__)
+	if( mControl != NULL )
+	{
+		mControl->mShutdown = true;
+		mControl->mGeneration.fetch_add( 1, std::memory_order_release );
+		FutexWakeAll( &mControl->mGeneration );
+
+		for( uint i = 0; i+1 < mNumProcesses; ++i )
+		{
+			waitpid( mWorkers[ i ], NULL, 0 );
+		}
+
+		mControl->~Control();
+		munmap( mControl, sizeof(Control) );
+		mControl = NULL;
+	}
+#endif
+}
+
+#if defined(__linux__)
+//------------------------------------------------------------------------------
+void ProcessGroup::WorkerLoop( uint rank )
+{
+	unsigned int generation = 0;
+
+	while( true )
+	{
+		WaitWhileEqual( &mControl->mGeneration, generation, mParent, mWorkers, mNumProcesses-1 );
+		generation = mControl->mGeneration.load( std::memory_order_acquire );
+
+		if( mControl->mShutdown )
+		{
+			return;
+		}
+
+		mControl->mJob( *this, mControl->mArgs, rank );
+
+		if( mControl->mPending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+		{
+			FutexWakeAll( &mControl->mPending );
+		}
+	}
+}
+#endif
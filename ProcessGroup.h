@@ -0,0 +1,67 @@
+#ifndef PROCESSGROUP_H
+#define PROCESSGROUP_H
+
+
+#include <cstddef>
+#include "types.h"
+
+
+//The calling process plus num_processes-1 worker processes forked from it,
+//for splitting grid loops into row strips across address spaces. The group
+//maps shared_size bytes before it forks, at the same address in every process,
+//and that's the only memory the workers share. Anything else they read is
+//their copy from the time of the fork. So jobs are plain functions with their
+//arguments copied into the group's shared control block, rather than closures.
+//The workers wait on futexes in that block, Linux only. Elsewhere, or if the
+//mapping or the fork fails, the group is just the calling process.
+//Fork copies only the calling thread, so a worker never touches a thread pool
+//or the heap. Jobs have to stay that way, and the group should be created
+//while the process has no other threads that could be holding a heap lock.
+//A worker exits once it notices its parent has gone. If a worker dies the
+//parent aborts, rather than waiting forever for a job or barrier to finish.
+class ProcessGroup
+{
+public:
+	//Runs on every process with the same args. rank 0 is the calling process.
+	typedef void (*Job)( ProcessGroup& group, const void* args, uint rank );
+
+	//The most bytes of arguments a job can have
+	const static size_t MAX_ARGS_SIZE = 256;
+
+	ProcessGroup( uint num_processes, size_t shared_size );
+	~ProcessGroup();
+
+	static bool IsSupported();
+
+	uint GetNumProcesses() const { return mNumProcesses; }
+
+	//Zeroed, page aligned, and not backed until it's written. NULL if it couldn't be mapped.
+	void* GetSharedMemory() const { return mShared; }
+	size_t GetSharedSize() const { return mSharedSize; }
+
+	//Runs job on every process and waits for them all to finish it
+	void Run( Job job, const void* args, size_t args_size );
+
+	//Called by every process from inside a job, returns once they've all reached it
+	void Barrier();
+
+	//Rank's contiguous block of [begin, end), split as ThreadPool::ParallelFor does
+	void GetRange( uint begin, uint end, uint rank, uint& out_begin, uint& out_end ) const;
+
+private:
+	struct Control;
+
+	void WorkerLoop( uint rank );
+	void Shutdown();
+
+private:
+	uint		mNumProcesses;
+	Control*	mControl;
+	int*		mWorkers;		//Process ids, mNumProcesses-1 of them
+	int			mParent;		//In a worker, the calling process's id, otherwise 0
+	void*		mShared;
+	size_t		mSharedSize;
+};
+
+
+#endif //PROCESSGROUP_H
@@ -0,0 +1,39 @@
+#include "Simd.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+	#include <intrin.h>
+#endif
+
+namespace Simd
+{
+	Level DetectLevel()
+	{
+#if defined(SIMD_X86) && defined(_MSC_VER)
+		int info[4];
+
+		__cpuid( info, 1 );
+		const bool sse2		= ( info[3] & (1 << 26) ) != 0;
+		const bool osxsave	= ( info[2] & (1 << 27) ) != 0;
+		const bool avx		= ( info[2] & (1 << 28) ) != 0;
+		const bool f16c		= ( info[2] & (1 << 29) ) != 0;
+
+		//The OS has to save the ymm registers on context switches too
+		const bool ymm_state = osxsave && avx && ( _xgetbv( 0 ) & 6 ) == 6;
+
+		__cpuidex( info, 7, 0 );
+		const bool avx2 = ( info[1] & (1 << 5) ) != 0;
+
+		if( ymm_state && avx2 && f16c )	return LEVEL_AVX2;
+		if( sse2 )						return LEVEL_SSE2;
+		return LEVEL_SCALAR;
+#elif defined(SIMD_X86) && defined(__GNUC__)
+		__builtin_cpu_init();
+
+		if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "f16c" ) )	return LEVEL_AVX2;
+		if( __builtin_cpu_supports( "sse2" ) )										return LEVEL_SSE2;
+		return LEVEL_SCALAR;
+#else
+		return LEVEL_SCALAR;
+#endif
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+
+#include "types.h"
+
+
+//Instruction sets the SIMD kernels can be built for. x86 only, everything
+//else falls back to the scalar kernels.
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+	#define SIMD_X86
+#endif
+
+//GCC and clang only emit AVX2 instructions in functions marked for it, MSVC
+//allows the intrinsics anywhere. The AVX2 level includes the F16C half float
+//conversions, which every AVX2 CPU has.
+#if defined(SIMD_X86) && defined(__GNUC__)
+	#define SIMD_TARGET_SSE2 __attribute__((target("sse2")))
+	#define SIMD_TARGET_AVX2 __attribute__((target("avx2,f16c")))
+#else
+	#define SIMD_TARGET_SSE2
+	#define SIMD_TARGET_AVX2
+#endif
+
+
+namespace Simd
+{
+	enum Level
+	{
+		LEVEL_SCALAR,
+		LEVEL_SSE2,
+		LEVEL_AVX2,
+	};
+
+	//Highest level supported by both the CPU and the OS
+	Level DetectLevel();
+}
+
+
+#endif //SIMD_H
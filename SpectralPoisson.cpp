@@ -0,0 +1,205 @@
+#include "SpectralPoisson.h"
+#include "Boundary.h"
+#include "Fft.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+//------------------------------------------------------------------------------
+const static double PI					= 3.14159265358979323846;
+const static uint   TRANSPOSE_BLOCK		= 16;
+
+//------------------------------------------------------------------------------
+SpectralPoisson::SpectralPoisson( uint size_x, uint size_y, uint stride )
+	:	mSizeX( size_x )
+	,	mSizeY( size_y )
+	,	mStride( stride )
+{
+	assert( size_x > 2 && size_y > 2 );
+
+	const uint nx = size_x - 2;
+	const uint ny = size_y - 2;
+
+	//Square grids share one plan
+	Fft* fft_x = new Fft( nx );
+	BuildAxis( mAxisX, nx, fft_x );
+	BuildAxis( mAxisY, ny, nx == ny ? fft_x : new Fft( ny ) );
+
+	//lambda_k = 2 - 2cos( pi k/N ) on each axis, the mean mode's zero eigenvalue is left out
+	mScale.resize( nx * ny );
+	for( uint kx = 0; kx < nx; ++kx )
+	{
+		for( uint ky = 0; ky < ny; ++ky )
+		{
+			const double eigenvalue = (2.0 - 2.0*cos( PI * kx / nx )) + (2.0 - 2.0*cos( PI * ky / ny ));
+			mScale[ (kx * ny) + ky ] = eigenvalue > 0.0 ? (float)( 1.0 / (eigenvalue * nx * ny) ) : 0.0f;
+		}
+	}
+
+	mRe.resize( nx * ny );
+	mIm.resize( nx * ny );
+	mModes.resize( nx * ny );
+}
+
+//------------------------------------------------------------------------------
+SpectralPoisson::~SpectralPoisson()
+{
+	if( mAxisY.mFft != mAxisX.mFft )
+	{
+		delete mAxisY.mFft;
+	}
+	delete mAxisX.mFft;
+
+	mAxisX.mFft = NULL;
+	mAxisY.mFft = NULL;
+}
+
+//------------------------------------------------------------------------------
+void SpectralPoisson::BuildAxis( Axis& axis, uint length, Fft* fft )
+{
+	axis.mLength	= length;
+	axis.mFft		= fft;
+
+	//Even elements forwards, then odd elements backwards
+	axis.mOrder.resize( length );
+	for( uint n = 0; n < length; ++n )
+	{
+		axis.mOrder[n] = ( 2*n < length ) ? 2*n : (2*(length-1-n)) + 1;
+	}
+
+	axis.mCos.resize( length );
+	axis.mSin.resize( length );
+	for( uint k = 0; k < length; ++k )
+	{
+		axis.mCos[k] = (float)cos( (PI * k) / (2.0 * length) );
+		axis.mSin[k] = (float)sin( (PI * k) / (2.0 * length) );
+	}
+}
+
+//------------------------------------------------------------------------------
+void SpectralPoisson::Solve( float* p, const float* div )
+{
+	const uint nx = mAxisX.mLength;
+	const uint ny = mAxisY.mLength;
+
+	//Transform along y, with the rows in the y axis's order so each x is one signal
+	for( uint n = 0; n < ny; ++n )
+	{
+		memcpy( &mRe[ n * nx ], &div[ ((mAxisY.mOrder[n] + 1) * mStride) + 1 ], nx * sizeof(float) );
+	}
+
+	ForwardDct( mAxisY, &mModes[0], nx );
+
+	//Then along x, transposed so each y is one signal, in the x axis's order. In blocks so both
+	//sides stay in cache.
+	for( uint by = 0; by < ny; by += TRANSPOSE_BLOCK )
+	{
+		const uint y_end = std::min( by + TRANSPOSE_BLOCK, ny );
+
+		for( uint bn = 0; bn < nx; bn += TRANSPOSE_BLOCK )
+		{
+			const uint n_end = std::min( bn + TRANSPOSE_BLOCK, nx );
+
+			for( uint n = bn; n < n_end; ++n )
+			{
+				const uint x = mAxisX.mOrder[n];
+
+				for( uint y = by; y < y_end; ++y )
+				{
+					mRe[ (n * ny) + y ] = mModes[ (y * nx) + x ];
+				}
+			}
+		}
+	}
+
+	ForwardDct( mAxisX, &mModes[0], ny );
+
+	for( uint i = 0; i < (nx * ny); ++i )
+	{
+		mModes[i] *= mScale[i];
+	}
+
+	//And back again in the opposite order
+	InverseDct( mAxisX, &mModes[0], ny );
+
+	for( uint bn = 0; bn < nx; bn += TRANSPOSE_BLOCK )
+	{
+		const uint n_end = std::min( bn + TRANSPOSE_BLOCK, nx );
+
+		for( uint by = 0; by < ny; by += TRANSPOSE_BLOCK )
+		{
+			const uint y_end = std::min( by + TRANSPOSE_BLOCK, ny );
+
+			for( uint y = by; y < y_end; ++y )
+			{
+				for( uint n = bn; n < n_end; ++n )
+				{
+					mModes[ (y * nx) + mAxisX.mOrder[n] ] = mRe[ (n * ny) + y ];
+				}
+			}
+		}
+	}
+
+	InverseDct( mAxisY, &mModes[0], nx );
+
+	for( uint n = 0; n < ny; ++n )
+	{
+		memcpy( &p[ ((mAxisY.mOrder[n] + 1) * mStride) + 1 ], &mRe[ n * nx ], nx * sizeof(float) );
+	}
+
+	SetBoundary( 0, p, mSizeX, mSizeY, mStride );
+}
+
+//------------------------------------------------------------------------------
+//X_k = sum of x_n cos( pi (n + 1/2) k/N ), the real part of e^(-pi i k/2N) times the FFT of the reordered x
+void SpectralPoisson::ForwardDct( const Axis& axis, float* out, uint batch )
+{
+	float* re = &mRe[0];
+	float* im = &mIm[0];
+
+	memset( im, 0, axis.mLength * batch * sizeof(float) );
+
+	axis.mFft->Forward( re, im, batch );
+
+	for( uint k = 0; k < axis.mLength; ++k )
+	{
+		const float c = axis.mCos[k];
+		const float s = axis.mSin[k];
+
+		for( uint b = 0, i = k * batch; b < batch; ++b, ++i )
+		{
+			out[i] = (re[i] * c) + (im[i] * s);
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+//The FFT of the reordered signal is V_k = e^(pi i k/2N) (X_k - i X_(N-k)), taking X_N as zero
+void SpectralPoisson::InverseDct( const Axis& axis, const float* in, uint batch )
+{
+	float* re = &mRe[0];
+	float* im = &mIm[0];
+
+	for( uint b = 0; b < batch; ++b )
+	{
+		re[b] = in[b];
+		im[b] = 0.0f;
+	}
+
+	for( uint k = 1; k < axis.mLength; ++k )
+	{
+		const float c = axis.mCos[k];
+		const float s = axis.mSin[k];
+		const float* x = in + (k * batch);
+		const float* mirror = in + ((axis.mLength - k) * batch);
+
+		for( uint b = 0, i = k * batch; b < batch; ++b, ++i )
+		{
+			re[i] = (x[b] * c) + (mirror[b] * s);
+			im[i] = (x[b] * s) - (mirror[b] * c);
+		}
+	}
+
+	axis.mFft->Inverse( re, im, batch );
+}
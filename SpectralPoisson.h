@@ -0,0 +1,62 @@
+#ifndef SPECTRALPOISSON_H
+#define SPECTRALPOISSON_H
+
+
+#include <vector>
+#include "types.h"
+
+class Fft;
+
+
+//Direct solver for the pressure Poisson equation used by FluidSim::Project,
+//on the same grids as Multigrid (one ghost cell on each edge, Neumann
+//boundaries, rows stride cells apart).
+//The cosine modes of the interior are the eigenvectors of the 5 point
+//Laplacian with those boundaries, so a 2D discrete cosine transform turns the
+//solve into a division per mode. Each axis's DCT-II is worked out with one
+//complex FFT of the axis length (Makhoul's reordering), and the transforms
+//and eigenvalues are planned once, in the constructor.
+class SpectralPoisson
+{
+public:
+	SpectralPoisson( uint size_x, uint size_y, uint stride );
+	~SpectralPoisson();
+
+	//Solves 4p - (sum of neighbours) = div exactly and fills p's ghost cells.
+	//The mean of div has no solution and is dropped, p comes out with zero mean.
+	void Solve( float* p, const float* div );
+
+private:
+	struct Axis
+	{
+		uint				mLength;
+		Fft*				mFft;
+		std::vector<uint>	mOrder;		//Makhoul's order, element n of the FFT input is element mOrder[n] of the signal
+		std::vector<float>	mCos;		//cos( pi k/2N )
+		std::vector<float>	mSin;
+	};
+
+	static void BuildAxis( Axis& axis, uint length, Fft* fft );
+
+	//Cosine transforms of batch signals stored as Fft lays them out. Forward
+	//takes its input already in axis order in mRe and leaves the result in out.
+	//Inverse takes a transform in in and leaves the reordered signal, times
+	//the axis length, in mRe.
+	void ForwardDct( const Axis& axis, float* out, uint batch );
+	void InverseDct( const Axis& axis, const float* in, uint batch );
+
+private:
+	uint				mSizeX;
+	uint				mSizeY;
+	uint				mStride;
+	Axis				mAxisX;
+	Axis				mAxisY;
+
+	std::vector<float>	mScale;		//1/eigenvalue for mode [ (kx * ny) + ky ], with the inverse transforms' scale folded in
+	std::vector<float>	mRe;
+	std::vector<float>	mIm;
+	std::vector<float>	mModes;
+};
+
+
+#endif //SPECTRALPOISSON_H
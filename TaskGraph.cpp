@@ -0,0 +1,236 @@
+#include "TaskGraph.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+//------------------------------------------------------------------------------
+TaskGraph::TaskGraph()
+	:	mNumFinished( 0 )
+{
+}
+
+//------------------------------------------------------------------------------
+TaskGraph::~TaskGraph()
+{
+	for( uint i = 0; i < mQueues.size(); ++i )
+	{
+		delete mQueues[ i ];
+	}
+	mQueues.clear();
+}
+
+//------------------------------------------------------------------------------
+void TaskGraph::Clear()
+{
+	mNodes.clear();
+}
+
+//------------------------------------------------------------------------------
+TaskGraph::Task TaskGraph::Add( const TaskFunc& func )
+{
+	Node node;
+	node.mFunc				= func;
+	node.mNumDependencies	= 0;
+	node.mMilliseconds		= 0.0f;
+	mNodes.push_back( node );
+
+	return (Task)mNodes.size() - 1;
+}
+
+//------------------------------------------------------------------------------
+void TaskGraph::Depend( Task task, Task before )
+{
+	assert( task < mNodes.size() && before < mNodes.size() && task != before );
+
+	mNodes[ before ].mDependents.push_back( task );
+	mNodes[ task ].mNumDependencies += 1;
+}
+
+//------------------------------------------------------------------------------
+void TaskGraph::Run( ThreadPool* pool )
+{
+	const uint num_threads = pool != NULL ? pool->GetNumThreads() : 1;
+
+	while( mQueues.size() < num_threads )
+	{
+		mQueues.push_back( new Queue() );
+	}
+
+	//The atomics can't be moved, so the counters are rebuilt rather than resized
+	std::vector<std::atomic<uint>> pending( mNodes.size() );
+	mPending.swap( pending );
+	mNumFinished = 0;
+
+	//Tasks that are ready from the start are dealt out between the threads
+	uint next_thread = 0;
+	for( uint t = 0; t < mNodes.size(); ++t )
+	{
+		mPending[ t ] = mNodes[ t ].mNumDependencies;
+
+		if( mNodes[ t ].mNumDependencies == 0 )
+		{
+			mQueues[ next_thread ]->mTasks.push_back( t );
+			next_thread = (next_thread + 1) % num_threads;
+		}
+	}
+
+	if( pool != NULL )
+	{
+		//One block per thread, each of which runs a worker
+		pool->ParallelFor( 0, num_threads, [this]( uint begin, uint end )
+		{
+			for( uint thread = begin; thread < end; ++thread )
+			{
+				RunWorker( thread );
+			}
+		} );
+	}
+	else
+	{
+		RunWorker( 0 );
+	}
+
+	assert( mNumFinished == mNodes.size() );
+}
+
+//------------------------------------------------------------------------------
+uint TaskGraph::GetNumTasks() const
+{
+	return (uint)mNodes.size();
+}
+
+//------------------------------------------------------------------------------
+float TaskGraph::GetWorkMilliseconds() const
+{
+	float work = 0.0f;
+	for( uint t = 0; t < mNodes.size(); ++t )
+	{
+		work += mNodes[ t ].mMilliseconds;
+	}
+
+	return work;
+}
+
+//------------------------------------------------------------------------------
+float TaskGraph::GetCriticalPathMilliseconds() const
+{
+	//Walks the tasks in dependency order, tracking the latest each one could finish
+	std::vector<float> finish( mNodes.size(), 0.0f );
+	std::vector<uint> remaining( mNodes.size() );
+	std::vector<Task> ready;
+
+	for( uint t = 0; t < mNodes.size(); ++t )
+	{
+		remaining[ t ] = mNodes[ t ].mNumDependencies;
+		if( remaining[ t ] == 0 )
+		{
+			ready.push_back( t );
+		}
+	}
+
+	float longest = 0.0f;
+	while( ! ready.empty() )
+	{
+		const Task t = ready.back();
+		ready.pop_back();
+
+		finish[ t ] += mNodes[ t ].mMilliseconds;
+		longest = std::max( longest, finish[ t ] );
+
+		for( uint d = 0; d < mNodes[ t ].mDependents.size(); ++d )
+		{
+			const Task dependent = mNodes[ t ].mDependents[ d ];
+			finish[ dependent ] = std::max( finish[ dependent ], finish[ t ] );
+
+			if( --remaining[ dependent ] == 0 )
+			{
+				ready.push_back( dependent );
+			}
+		}
+	}
+
+	return longest;
+}
+
+//------------------------------------------------------------------------------
+void TaskGraph::RunWorker( uint thread )
+{
+	while( mNumFinished < mNodes.size() )
+	{
+		Task task;
+		if( PopTask( thread, task ) )
+		{
+			RunTask( task, thread );
+		}
+		else
+		{
+			//Everything that's ready is running elsewhere
+			std::this_thread::yield();
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void TaskGraph::RunTask( Task task, uint thread )
+{
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point start = Clock::now();
+
+	Node& node = mNodes[ task ];
+	node.mFunc();
+	node.mMilliseconds = std::chrono::duration<float, std::milli>( Clock::now() - start ).count();
+
+	//Whatever this task unblocks goes on this thread's queue, its inputs are likely still in cache
+	for( uint d = 0; d < node.mDependents.size(); ++d )
+	{
+		if( --mPending[ node.mDependents[ d ] ] == 0 )
+		{
+			PushTask( thread, node.mDependents[ d ] );
+		}
+	}
+
+	++mNumFinished;
+}
+
+//------------------------------------------------------------------------------
+bool TaskGraph::PopTask( uint thread, Task& task )
+{
+	const uint num_queues = (uint)mQueues.size();
+
+	for( uint i = 0; i < num_queues; ++i )
+	{
+		//Own queue from the back, anybody else's from the front
+		const uint victim = (thread + i) % num_queues;
+		Queue& queue = *mQueues[ victim ];
+
+		std::lock_guard<std::mutex> lock( queue.mMutex );
+		if( ! queue.mTasks.empty() )
+		{
+			if( i == 0 )
+			{
+				task = queue.mTasks.back();
+				queue.mTasks.pop_back();
+			}
+			else
+			{
+				task = queue.mTasks.front();
+				queue.mTasks.pop_front();
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//------------------------------------------------------------------------------
+void TaskGraph::PushTask( uint thread, Task task )
+{
+	Queue& queue = *mQueues[ thread ];
+
+	std::lock_guard<std::mutex> lock( queue.mMutex );
+	queue.mTasks.push_back( task );
+}
@@ -0,0 +1,75 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "types.h"
+
+
+class ThreadPool;
+
+
+//A set of tasks and the order they have to run in, executed by a work stealing
+//scheduler on a ThreadPool's threads. Each thread runs ready tasks from its own
+//queue, newest first so the data a task just wrote is still in cache, and
+//steals the oldest task from another queue when its own runs dry.
+//Tasks mustn't use the pool themselves.
+class TaskGraph
+{
+public:
+	typedef std::function<void()> TaskFunc;
+	typedef uint Task;
+
+	TaskGraph();
+	~TaskGraph();
+
+	//Removes every task, ready to build the graph again
+	void Clear();
+
+	Task Add( const TaskFunc& func );
+
+	//task won't start until before has finished
+	void Depend( Task task, Task before );
+
+	//Runs every task and waits for them. With no pool they run in order on the calling thread.
+	void Run( ThreadPool* pool );
+
+	//What the last Run did. The work is the time spent in all of the tasks, the critical path
+	//is the longest chain of dependent tasks, so work / critical path bounds the speedup.
+	uint GetNumTasks() const;
+	float GetWorkMilliseconds() const;
+	float GetCriticalPathMilliseconds() const;
+
+private:
+	struct Node
+	{
+		TaskFunc			mFunc;
+		std::vector<Task>	mDependents;
+		uint				mNumDependencies;
+		float				mMilliseconds;
+	};
+
+	struct Queue
+	{
+		std::mutex			mMutex;
+		std::deque<Task>	mTasks;
+	};
+
+	void RunWorker( uint thread );
+	void RunTask( Task task, uint thread );
+	bool PopTask( uint thread, Task& task );
+	void PushTask( uint thread, Task task );
+
+private:
+	std::vector<Node>					mNodes;
+	std::vector<std::atomic<uint>>		mPending;			//Unfinished dependencies of each task
+	std::vector<Queue*>					mQueues;
+	std::atomic<uint>					mNumFinished;
+};
+
+
+#endif //TASKGRAPH_H
@@ -0,0 +1,118 @@
+#include "ThreadPool.h"
+#include <cassert>
+
+//------------------------------------------------------------------------------
+ThreadPool::ThreadPool( uint num_threads )
+	:	mFunc( NULL )
+	,	mBegin( 0 )
+	,	mEnd( 0 )
+	,	mGeneration( 0 )
+	,	mPending( 0 )
+	,	mShutdown( false )
+{
+	assert( num_threads > 0 );
+
+	for( uint i = 1; i < num_threads; ++i )
+	{
+		mWorkers.push_back( std::thread( &ThreadPool::WorkerLoop, this, i ) );
+	}
+}
+
+//------------------------------------------------------------------------------
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mShutdown = true;
+	}
+
+	mWakeWorkers.notify_all();
+
+	for( uint i = 0; i < mWorkers.size(); ++i )
+	{
+		mWorkers[ i ].join();
+	}
+}
+
+//------------------------------------------------------------------------------
+void ThreadPool::ParallelFor( uint begin, uint end, const RangeFunc& func )
+{
+	if( mWorkers.empty() || end - begin < 2 )
+	{
+		func( begin, end );
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mFunc		= &func;
+		mBegin		= begin;
+		mEnd		= end;
+		mPending	= (uint)mWorkers.size();
+		++mGeneration;
+	}
+
+	mWakeWorkers.notify_all();
+
+	RunBlock( 0 );
+
+	std::unique_lock<std::mutex> lock( mMutex );
+	while( mPending > 0 )
+	{
+		mWorkDone.wait( lock );
+	}
+
+	mFunc = NULL;
+}
+
+//------------------------------------------------------------------------------
+void ThreadPool::WorkerLoop( uint index )
+{
+	uint generation = 0;
+
+	while( true )
+	{
+		{
+			std::unique_lock<std::mutex> lock( mMutex );
+			while( ! mShutdown && mGeneration == generation )
+			{
+				mWakeWorkers.wait( lock );
+			}
+
+			if( mShutdown )
+			{
+				return;
+			}
+
+			generation = mGeneration;
+		}
+
+		RunBlock( index );
+
+		bool last = false;
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			last = ( --mPending == 0 );
+		}
+
+		if( last )
+		{
+			mWorkDone.notify_one();
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+void ThreadPool::RunBlock( uint index )
+{
+	const uint num_threads = GetNumThreads();
+	const uint count = mEnd - mBegin;
+
+	const uint block_begin	= mBegin + (uint)( ((unsigned long long)count * index) / num_threads );
+	const uint block_end	= mBegin + (uint)( ((unsigned long long)count * (index+1)) / num_threads );
+
+	if( block_begin < block_end )
+	{
+		(*mFunc)( block_begin, block_end );
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "types.h"
+
+
+//Fixed set of worker threads for splitting grid loops into row blocks. The
+//calling thread always runs the first block itself.
+class ThreadPool
+{
+public:
+	typedef std::function<void( uint begin, uint end )> RangeFunc;
+
+	explicit ThreadPool( uint num_threads );
+	~ThreadPool();
+
+	uint GetNumThreads() const { return (uint)mWorkers.size() + 1; }
+
+	//Splits [begin, end) into one contiguous block per thread and waits for them all
+	void ParallelFor( uint begin, uint end, const RangeFunc& func );
+
+private:
+	void WorkerLoop( uint index );
+	void RunBlock( uint index );
+
+private:
+	std::vector<std::thread>	mWorkers;
+
+	std::mutex					mMutex;
+	std::condition_variable		mWakeWorkers;
+	std::condition_variable		mWorkDone;
+
+	const RangeFunc*			mFunc;
+	uint						mBegin;
+	uint						mEnd;
+	uint						mGeneration;
+	uint						mPending;
+	bool						mShutdown;
+};
+
+
+#endif //THREADPOOL_H
@@ -1,10 +1,12 @@
 #include "PixelToaster.h"
 #include "types.h"
 #include "FluidSim.h"
+#include "Benchmark.h"
 #include "Profiler.h"
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <ctime>
 #include <utility>
 
@@ -289,8 +291,13 @@ private:
 };
 
 //------------------------------------------------------------------------------
-int main()
+int main( int argc, char** argv )
 {
+	if( argc > 1 && strcmp( argv[1], "-benchmark" ) == 0 )
+	{
+		return Benchmark::Run() ? 0 : 1;
+	}
+
 	srand((uint)time(0));
 
 	std::cout